@@ -0,0 +1,301 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2021 Xu Zhen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+// duktod: receives files without the user interface, for headless machines,
+// or sends files to a list of buddies with --send.
+// It only needs QtCore and QtNetwork at run time, the GUI classes are not created.
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QScopedPointer>
+#include <QSet>
+#include <QTextStream>
+#include <QTimer>
+#include <csignal>
+#include <algorithm>
+
+#include "duktoprotocol.h"
+#include "miniwebserver.h"
+#include "settings.h"
+#include "transfermetrics.h"
+
+#define NETWORK_PORT 4644
+
+static volatile std::sig_atomic_t quitRequested = 0;
+
+static void requestQuit(int) {
+    quitRequested = 1;
+}
+
+static void logLine(const QString &message) {
+    static QTextStream out(stdout);
+    out << QDateTime::currentDateTime().toString(Qt::ISODate) << ' ' << message << '\n';
+    out.flush();
+}
+
+// Logs how every session went once it ends, and appends its timings to
+// file as a line of JSON if one is given
+static void watchStats(DuktoProtocol &protocol, QFile *file)
+{
+    QObject::connect(&protocol, &DuktoProtocol::transferStatsUpdate, [file](qint64 session, const TransferStats &stats) {
+        if (stats.finished() == false) {
+            return;
+        }
+        logLine(QStringLiteral("[%1] %2 KB/s on average, %3 ms moving data, %4 stalls (%5 ms)").arg(session)
+                .arg(stats.averageRate() / 1024, 0, 'f', 1).arg(stats.phaseTime(TransferStats::PHASE_DATA))
+                .arg(stats.stalls()).arg(stats.stallTime()));
+        if (file != nullptr) {
+            QJsonObject json = stats.toJson();
+            json.insert(QStringLiteral("session"), session);
+            file->write(QJsonDocument(json).toJson(QJsonDocument::Compact) + '\n');
+            file->flush();
+        }
+    });
+}
+
+// Sends paths to every destination, returns the exit code once all jobs are done
+static int sendToAll(DuktoProtocol &protocol, const QStringList &dests, const QStringList &paths)
+{
+    QSet<qint64> running;
+    // last logged tenth of every job
+    QHash<qint64, int> steps;
+    int failures = 0;
+    auto finished = [&](qint64 session) {
+        running.remove(session);
+        if (running.isEmpty()) {
+            QCoreApplication::quit();
+        }
+    };
+    QObject::connect(&protocol, &DuktoProtocol::sendStarted, [](qint64 session, const QString &ipDest) {
+        logLine(QStringLiteral("[%1] Sending to %2").arg(session).arg(ipDest));
+    });
+    QObject::connect(&protocol, &DuktoProtocol::transferStatusUpdate, [&steps](qint64 session, qint64 total, qint64 partial, qint64 wire) {
+        Q_UNUSED(wire)
+        int step = (total > 0 ? static_cast<int>(partial * 10 / total) : 0);
+        if (step > steps.value(session, 0)) {
+            steps.insert(session, step);
+            logLine(QStringLiteral("[%1] %2% of %3 bytes").arg(session).arg(step * 10).arg(total));
+        }
+    });
+    QObject::connect(&protocol, &DuktoProtocol::sendFileComplete, [&](qint64 session) {
+        logLine(QStringLiteral("[%1] Sent").arg(session));
+        finished(session);
+    });
+    QObject::connect(&protocol, &DuktoProtocol::sendFileError, [&](qint64 session, const QString &error) {
+        logLine(QStringLiteral("[%1] Failed: %2").arg(session).arg(error));
+        failures++;
+        finished(session);
+    });
+
+    QList<QPair<QString, qint16> > targets;
+    for (const QString &dest : dests) {
+        QString ip = dest.section(QChar(':'), 0, 0);
+        qint16 port = static_cast<qint16>(dest.section(QChar(':'), 1, 1).toUShort());
+        targets.append(qMakePair(ip, port));
+    }
+    // several buddies share one listing and one read of the files
+    QList<qint64> sessions;
+    if (targets.size() > 1) {
+        sessions = protocol.sendFileToMany(targets, paths);
+    } else {
+        sessions.append(protocol.sendFile(targets.first().first, targets.first().second, paths));
+    }
+    for (int i = 0; i < sessions.size(); i++) {
+        running.insert(sessions.at(i));
+        logLine(QStringLiteral("[%1] Queued for %2").arg(sessions.at(i)).arg(dests.at(i)));
+    }
+    QCoreApplication::exec();
+    return failures > 0 ? 1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName(QStringLiteral("Dukto"));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Receives files sent with Dukto, or sends them, without the user interface."));
+    parser.addHelpOption();
+    QCommandLineOption destOption(QStringList() << QStringLiteral("d") << QStringLiteral("dest"),
+                                  QStringLiteral("Directory for received files, the one set in Dukto by default."), QStringLiteral("dir"));
+    QCommandLineOption portOption(QStringList() << QStringLiteral("p") << QStringLiteral("port"),
+                                  QStringLiteral("UDP and TCP port, %1 by default.").arg(NETWORK_PORT), QStringLiteral("port"), QString::number(NETWORK_PORT));
+    QCommandLineOption sessionsOption(QStringList() << QStringLiteral("s") << QStringLiteral("sessions"),
+                                      QStringLiteral("Transfers run at the same time, others wait in a queue."), QStringLiteral("count"));
+    QCommandLineOption sendOption(QStringLiteral("send"),
+                                  QStringLiteral("Send the paths to this buddy instead of receiving, may be given several times."), QStringLiteral("host[:port]"));
+    QCommandLineOption statsOption(QStringLiteral("stats"),
+                                   QStringLiteral("Append the timings of every finished transfer to this file, one JSON object per line."), QStringLiteral("file"));
+    QCommandLineOption extendedOption(QStringLiteral("extended"),
+                                      QStringLiteral("With --send, the buddies speak the protocol extensions enabled in Dukto. Buddies are not discovered when sending, so the classic protocol is used otherwise."));
+    QCommandLineOption metricsOption(QStringLiteral("metrics"),
+                                     QStringLiteral("Serve the transfer totals for Prometheus at http://host:<port + 1>/metrics."));
+    QCommandLineOption limitOption(QStringLiteral("limit"),
+                                   QStringLiteral("Rate for all transfers together in KB/s, 0 for no limit, the one set in Dukto by default."), QStringLiteral("rate"));
+    parser.addOption(destOption);
+    parser.addOption(portOption);
+    parser.addOption(sessionsOption);
+    parser.addOption(sendOption);
+    parser.addOption(extendedOption);
+    parser.addOption(limitOption);
+    parser.addOption(statsOption);
+    parser.addOption(metricsOption);
+    parser.addPositionalArgument(QStringLiteral("paths"), QStringLiteral("Files and folders to send with --send."), QStringLiteral("[paths...]"));
+    parser.process(app);
+
+    QFile statsFile(parser.value(statsOption));
+    if (parser.isSet(statsOption) && statsFile.open(QFile::WriteOnly | QFile::Append) == false) {
+        logLine(QStringLiteral("Can not write %1").arg(statsFile.fileName()));
+        return 1;
+    }
+    QFile *stats = (statsFile.isOpen() ? &statsFile : nullptr);
+
+    if (parser.isSet(sendOption)) {
+        QStringList paths;
+        for (const QString &path : parser.positionalArguments()) {
+            QFileInfo info(path);
+            if (info.exists() == false) {
+                logLine(QStringLiteral("%1 does not exist").arg(path));
+                return 1;
+            }
+            paths << info.absoluteFilePath();
+        }
+        if (paths.isEmpty()) {
+            logLine(QStringLiteral("Nothing to send"));
+            return 1;
+        }
+        DuktoProtocol protocol;
+        TransferOptions options = gSettings->transferOptions();
+        if (parser.isSet(sessionsOption)) {
+            options.concurrentSends = std::max(1, parser.value(sessionsOption).toInt());
+        }
+        if (parser.isSet(limitOption)) {
+            options.rateLimit = std::max<qint64>(0, parser.value(limitOption).toLongLong()) * 1024;
+        }
+        protocol.setTransferOptions(options);
+        if (parser.isSet(extendedOption)) {
+            for (const QString &dest : parser.values(sendOption)) {
+                protocol.setPeerFeatures(dest.section(QChar(':'), 0, 0), TransferOptions::supportedFeatures());
+            }
+        }
+        watchStats(protocol, stats);
+        return sendToAll(protocol, parser.values(sendOption), paths);
+    }
+
+    QString destDir = parser.isSet(destOption) ? parser.value(destOption) : gSettings->destPath();
+    bool ok;
+    quint16 port = parser.value(portOption).toUShort(&ok);
+    if (ok == false || port == 0) {
+        logLine(QStringLiteral("Invalid port %1").arg(parser.value(portOption)));
+        return 1;
+    }
+    QDir dir(destDir);
+    if (dir.exists() == false && dir.mkpath(QStringLiteral(".")) == false) {
+        logLine(QStringLiteral("The directory %1 is inaccessible.").arg(destDir));
+        return 1;
+    }
+    destDir = dir.absolutePath();
+
+    DuktoProtocol protocol;
+    protocol.setDestDir(destDir);
+    TransferOptions options = gSettings->transferOptions();
+    if (parser.isSet(sessionsOption)) {
+        options.concurrentSessions = std::max(1, parser.value(sessionsOption).toInt());
+    }
+    if (parser.isSet(limitOption)) {
+        options.rateLimit = std::max<qint64>(0, parser.value(limitOption).toLongLong()) * 1024;
+    }
+    protocol.setTransferOptions(options);
+    watchStats(protocol, stats);
+
+    // the avatar is served along with the totals, as the GUI does
+    TransferMetrics metrics(&protocol);
+    QScopedPointer<MiniWebServer> webServer;
+    if (parser.isSet(metricsOption)) {
+        webServer.reset(new MiniWebServer(port + 1));
+        webServer->setMetrics(&metrics);
+        if (webServer->isListening() == false) {
+            logLine(QStringLiteral("Can not serve the metrics on port %1: %2").arg(port + 1).arg(webServer->errorString()));
+            return 1;
+        }
+    }
+
+    QObject::connect(&protocol, &DuktoProtocol::peerListAdded, [](const Peer &peer) {
+        logLine(QStringLiteral("Found %1 at %2").arg(peer.name, peer.address.toString()));
+    });
+    QObject::connect(&protocol, &DuktoProtocol::peerListRemoved, [](const Peer &peer) {
+        logLine(QStringLiteral("Lost %1 at %2").arg(peer.name, peer.address.toString()));
+    });
+    QObject::connect(&protocol, &DuktoProtocol::receiveQueued, [](qint64 session, const QString &senderIp) {
+        logLine(QStringLiteral("[%1] Queued sender %2").arg(session).arg(senderIp));
+    });
+    QObject::connect(&protocol, &DuktoProtocol::receiveStarted, [](qint64 session, const QString &senderIp) {
+        logLine(QStringLiteral("[%1] Receiving from %2").arg(session).arg(senderIp));
+    });
+    QObject::connect(&protocol, &DuktoProtocol::receiveFileCompleted, [](qint64 session, const QString &name, const QString &path, qint64 size) {
+        Q_UNUSED(name)
+        logLine(QStringLiteral("[%1] Received file %2 (%3 bytes)").arg(session).arg(path).arg(size));
+    });
+    QObject::connect(&protocol, &DuktoProtocol::receiveDirCompleted, [](qint64 session, const QString &name, const QString &path) {
+        Q_UNUSED(name)
+        logLine(QStringLiteral("[%1] Received directory %2").arg(session).arg(path));
+    });
+    QObject::connect(&protocol, &DuktoProtocol::receiveTextCompleted, [](qint64 session, const QString &text) {
+        logLine(QStringLiteral("[%1] Received text: %2").arg(session).arg(text));
+    });
+    QObject::connect(&protocol, &DuktoProtocol::receiveCompleted, [](qint64 session) {
+        logLine(QStringLiteral("[%1] Transfer completed").arg(session));
+    });
+    QObject::connect(&protocol, &DuktoProtocol::receiveAborted, [](qint64 session, const QString &error) {
+        logLine(QStringLiteral("[%1] Transfer aborted: %2").arg(session).arg(error));
+    });
+
+    QString error;
+    if (protocol.setupUdpServer(port, error) == false || protocol.setupTcpServer(port, error) == false) {
+        protocol.closeServers();
+        logLine(error);
+        return 1;
+    }
+    logLine(QStringLiteral("Listening on port %1, saving to %2").arg(port).arg(destDir));
+
+    // Say "hello", later ones are sent by the messenger as needed
+    protocol.greeting();
+
+    // Quit cleanly on SIGINT / SIGTERM so that other buddies are told goodbye,
+    // the handler only sets a flag which is polled here
+    std::signal(SIGINT, requestQuit);
+    std::signal(SIGTERM, requestQuit);
+    QTimer quitTimer;
+    QObject::connect(&quitTimer, &QTimer::timeout, &app, []() {
+        if (quitRequested) {
+            QCoreApplication::quit();
+        }
+    });
+    quitTimer.start(500);
+
+    int result = app.exec();
+    protocol.closeServers();
+    logLine(QStringLiteral("Stopped"));
+    return result;
+}
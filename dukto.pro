@@ -55,10 +55,25 @@ SOURCES += main.cpp \
     guibehind.cpp \
     miniwebserver.cpp \
     network/buddymessage.cpp \
+    network/checksum.cpp \
+    network/compression.cpp \
+    network/delta.cpp \
+    network/diskwriter.cpp \
     network/filedata.cpp \
+    network/filehasher.cpp \
+    network/filescanner.cpp \
+    network/flowwindow.cpp \
+    network/interfacecache.cpp \
     network/messenger.cpp \
+    network/progressthrottle.cpp \
+    network/rangereceiver.cpp \
+    network/rangesender.cpp \
+    network/ratelimiter.cpp \
     network/receiver.cpp \
+    network/resumejournal.cpp \
     network/sender.cpp \
+    network/sharedsource.cpp \
+    network/transferstats.cpp \
     platform.cpp \
     buddylistitemmodel.cpp \
     duktoprotocol.cpp \
@@ -68,16 +83,33 @@ SOURCES += main.cpp \
     destinationbuddy.cpp \
     duktowindow.cpp \
     theme.cpp \
-    systemtray.cpp
+    systemtray.cpp \
+    transfermetrics.cpp
 
 HEADERS += \
     guibehind.h \
     miniwebserver.h \
     network/buddymessage.h \
+    network/checksum.h \
+    network/compression.h \
+    network/delta.h \
+    network/diskwriter.h \
     network/filedata.h \
+    network/filehasher.h \
+    network/filescanner.h \
+    network/flowwindow.h \
+    network/interfacecache.h \
     network/messenger.h \
+    network/progressthrottle.h \
+    network/rangereceiver.h \
+    network/rangesender.h \
+    network/ratelimiter.h \
     network/receiver.h \
+    network/resumejournal.h \
     network/sender.h \
+    network/sharedsource.h \
+    network/transferoptions.h \
+    network/transferstats.h \
     platform.h \
     buddylistitemmodel.h \
     duktoprotocol.h \
@@ -89,6 +121,7 @@ HEADERS += \
     duktowindow.h \
     theme.h \
     systemtray.h \
+    transfermetrics.h \
     version.h
 
 RESOURCES += \
@@ -113,6 +146,14 @@ contains(DEFINES, SINGLE_APP) {
     DEFINES += QAPPLICATION_CLASS=QApplication
 }
 
+# compressed frames are LZ4 blocks, without the library compression is
+# not offered, see network/compression.cpp
+unix:!android:packagesExist(liblz4) {
+    CONFIG += link_pkgconfig
+    PKGCONFIG += liblz4
+    DEFINES += USE_LZ4
+}
+
 contains(DEFINES, NOTIFY_LIBNOTIFY) {
     CONFIG+=link_pkgconfig
     PKGCONFIG+=libnotify
@@ -120,6 +161,14 @@ contains(DEFINES, NOTIFY_LIBNOTIFY) {
 
 OTHER_FILES += CMakeLists.txt dukto.rc
 
+# the loopback benchmark of the transfer engine is a project of its own, see tools/transferbench.pro
+unix:!android {
+    transferbench.commands = $(MKDIR) transferbench-build && cd transferbench-build && $$QMAKE_QMAKE $$PWD/tools/transferbench.pro && $(MAKE)
+    transferbench-check.commands = cd transferbench-build && $(MAKE) check
+    transferbench-check.depends = transferbench
+    QMAKE_EXTRA_TARGETS += transferbench transferbench-check
+}
+
 win32 {
     RC_FILE = dukto.rc
     msvc:LIBS += ws2_32.lib ole32.lib user32.lib
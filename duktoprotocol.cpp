@@ -28,13 +28,19 @@
 #include <QNetworkInterface>
 #include <QNetworkProxy>
 #include <QTimer>
+#include <QThread>
+#include <QPointer>
 
 #include "network/messenger.h"
 #include "network/receiver.h"
 #include "network/sender.h"
+#include "network/sharedsource.h"
+#include "network/ratelimiter.h"
 
 #define DEFAULT_UDP_PORT 4644
 #define DEFAULT_TCP_PORT 4644
+// a connection which has not told what it is by then is closed, in ms
+#define PENDING_TIMEOUT 10000
 
 enum MSG_TYPE {
     MSG_HELLO_BROADCAST = 0x01,
@@ -48,11 +54,29 @@ DuktoProtocol::DuktoProtocol(QObject *parent)
     : QObject(parent), mLocalTcpPort(DEFAULT_TCP_PORT)
 {
     QNetworkProxy::setApplicationProxy(QNetworkProxy(QNetworkProxy::NoProxy));
+    qRegisterMetaType<QTcpSocket*>("QTcpSocket*");
+    qRegisterMetaType<TransferStats>("TransferStats");
+    mRateLimiter = new RateLimiter();
+
+    mTransferThread = new QThread(this);
+    mTransferThread->setObjectName(QStringLiteral("DuktoTransfer"));
+    mTransferThread->start();
 }
 
 DuktoProtocol::~DuktoProtocol()
 {
     closeServers();
+    // pending deferred deletions are processed before the thread finishes
+    while (mSenders.isEmpty() == false) {
+        removeSender(mSenders.constBegin().key());
+    }
+    for (Receiver *receiver : mReceivers) {
+        receiver->deleteLater();
+    }
+    mReceivers.clear();
+    mTransferThread->quit();
+    mTransferThread->wait();
+    delete mRateLimiter;
     delete mMessenger;
     delete mTcpServer;
 }
@@ -63,7 +87,12 @@ bool DuktoProtocol::setupUdpServer(quint16 port, QString &error)
         mMessenger = new Messenger(DEFAULT_UDP_PORT, this);
         connect(mMessenger, &Messenger::buddyFound, this, &DuktoProtocol::peerListAdded, Qt::QueuedConnection);
         connect(mMessenger, &Messenger::buddyGone, this, &DuktoProtocol::peerListRemoved, Qt::QueuedConnection);
+        connect(mMessenger, &Messenger::buddyGone, this, [this](const Peer &peer) {
+            mPeerFeatures.remove(peer.address.toString());
+        }, Qt::QueuedConnection);
+        connect(mMessenger, &Messenger::buddyFeatures, this, &DuktoProtocol::setPeerFeatures, Qt::QueuedConnection);
     }
+    mMessenger->setFeatures(mOptions.receiveFeatures & TransferOptions::supportedFeatures());
     if (mMessenger->start(port, error) == false) {
         return false;
     }
@@ -76,9 +105,9 @@ bool DuktoProtocol::setupTcpServer(quint16 port, QString &error)
         mTcpServer = new QTcpServer(this);
     }
     if (mLocalTcpPort != port && mTcpServer->isListening()) {
-        mLocalTcpPort = port;
         mTcpServer->close();
     }
+    mLocalTcpPort = port;
     if (mTcpServer->isListening() == false && mTcpServer->listen(QHostAddress::AnyIPv4, mLocalTcpPort) == false) {
         switch (mTcpServer->serverError()) {
             case QAbstractSocket::AddressInUseError:
@@ -112,101 +141,349 @@ void DuktoProtocol::greeting() {
 void DuktoProtocol::newIncomingConnection()
 {
     // Recieve connection
-    QTcpSocket* s = mTcpServer->nextPendingConnection();
-    if(s == nullptr) return;
+    QTcpSocket* s;
+    while ((s = mTcpServer->nextPendingConnection()) != nullptr) {
+        // a new session, or an extra connection of a running one
+        mPendingConnections.append(s);
+        connect(s, &QTcpSocket::readyRead, this, [this, s]() {
+            classifyConnection(s);
+        });
+        connect(s, &QTcpSocket::disconnected, this, [this, s]() {
+            mPendingConnections.removeOne(s);
+            s->deleteLater();
+        });
+        // a peer which connects and sends nothing would hold the socket forever
+        QPointer<QTcpSocket> pending(s);
+        QTimer::singleShot(PENDING_TIMEOUT, this, [this, pending]() {
+            if (pending.isNull() == false && mPendingConnections.contains(pending.data())) {
+                mPendingConnections.removeOne(pending.data());
+                pending->disconnect(this);
+                pending->abort();
+                pending->deleteLater();
+            }
+        });
+        classifyConnection(s);
+    }
+}
 
-    if (mReceiver != nullptr || mSender != nullptr) {
+void DuktoProtocol::classifyConnection(QTcpSocket *s) {
+    qint64 header[2];
+    if (s->bytesAvailable() < static_cast<qint64>(sizeof(qint64))) {
+        // wait for more data
+        return;
+    }
+    s->peek(reinterpret_cast<char*>(header), sizeof(qint64));
+    if (header[0] != TransferOptions::STREAM_MAGIC) {
+        mPendingConnections.removeOne(s);
+        s->disconnect(this);
+        createReceiver(s);
+        return;
+    }
+    if (s->bytesAvailable() < static_cast<qint64>(sizeof(header))) {
+        // wait for the session token
+        return;
+    }
+    s->peek(reinterpret_cast<char*>(header), sizeof(header));
+    mPendingConnections.removeOne(s);
+    s->disconnect(this);
+    Receiver *receiver = mReceivers.value(mReceiverTokens.value(header[1]), nullptr);
+    if (receiver == nullptr) {
+        // the session is over
         s->close();
+        s->deleteLater();
         return;
     }
+    s->setParent(nullptr);
+    s->moveToThread(mTransferThread);
+    QMetaObject::invokeMethod(receiver, "addStream", Qt::QueuedConnection, Q_ARG(QTcpSocket*, s));
+}
 
-    mReceiver = new Receiver(s, mDestDir, this);
-    connect(mReceiver, &Receiver::progress, this, &DuktoProtocol::transferStatusUpdate);
-    connect(mReceiver, &Receiver::itemProgress, this, &DuktoProtocol::transferItemUpdate);
-    connect(mReceiver, &Receiver::dirReceived, this, &DuktoProtocol::receiveDirCompleted);
-    connect(mReceiver, &Receiver::fileReceived, this, &DuktoProtocol::receiveFileCompleted);
-    connect(mReceiver, &Receiver::textReceived, this, &DuktoProtocol::receiveTextCompleted);
-    connect(mReceiver, &Receiver::aborted, this, [this](const QString &error) {
-        mReceiver->deleteLater();
-        mReceiver = nullptr;
-        emit receiveAborted(error);
+void DuktoProtocol::createReceiver(QTcpSocket *s) {
+    qint64 session = ++mLastSession;
+    qint64 token = Receiver::newSessionToken();
+    QString senderIp = s->peerAddress().toString();
+    Receiver *receiver = new Receiver(s, mDestDir);
+    receiver->setOptions(mOptions);
+    receiver->setSessionToken(token);
+    receiver->setRateLimiter(mRateLimiter);
+    mReceivers.insert(session, receiver);
+    mReceiverTokens.insert(token, session);
+    mReceiverPeers.insert(session, senderIp);
+    connect(receiver, &Receiver::progress, this, [this, session](qint64 total, qint64 partial, qint64 wire) {
+        queueTransferStatus(session, total, partial, wire);
+    }, Qt::DirectConnection);
+    connect(receiver, &Receiver::statsUpdated, this, [this, session](const TransferStats &stats) {
+        queueTransferStats(session, stats);
+    }, Qt::DirectConnection);
+    connect(receiver, &Receiver::itemProgress, this, [this, session](qint64 total, qint64 current, const QString &name) {
+        emit transferItemUpdate(session, total, current, name);
+    });
+    connect(receiver, &Receiver::dirReceived, this, [this, session](const QString &name, const QString &path) {
+        emit receiveDirCompleted(session, name, path);
     });
-    connect(mReceiver, &Receiver::completed, this, [this]() {
-        mReceiver->deleteLater();
-        mReceiver = nullptr;
-        emit receiveCompleted();
+    connect(receiver, &Receiver::fileReceived, this, [this, session](const QString &name, const QString &path, qint64 size) {
+        emit receiveFileCompleted(session, name, path, size);
     });
+    connect(receiver, &Receiver::textReceived, this, [this, session](const QString &text) {
+        emit receiveTextCompleted(session, text);
+    });
+    connect(receiver, &Receiver::aborted, this, [this, session](const QString &error) {
+        if (mReceivers.contains(session) == false) {
+            // already aborted by user
+            return;
+        }
+        flushTransferStatus();
+        removeReceiver(session);
+        emit receiveAborted(session, error);
+        startQueuedReceivers();
+    });
+    connect(receiver, &Receiver::completed, this, [this, session]() {
+        if (mReceivers.contains(session) == false) {
+            return;
+        }
+        flushTransferStatus();
+        removeReceiver(session);
+        emit receiveCompleted(session);
+        startQueuedReceivers();
+    });
+
+    // the handshake is still answered, the data waits for a free slot
+    bool queued = (mReceivers.size() - mQueuedReceivers.size() > mOptions.concurrentSessions);
+    if (queued) {
+        receiver->hold();
+        mQueuedReceivers.append(session);
+    }
+    receiver->moveToThread(mTransferThread);
+    QMetaObject::invokeMethod(receiver, "start", Qt::QueuedConnection);
 
     // Update GUI
-    emit receiveStarted(s->peerAddress().toString());
+    if (queued) {
+        emit receiveQueued(session, senderIp);
+    } else {
+        emit receiveStarted(session, senderIp);
+    }
+}
+
+void DuktoProtocol::removeReceiver(qint64 session) {
+    Receiver *receiver = mReceivers.take(session);
+    mQueuedReceivers.removeOne(session);
+    mReceiverPeers.remove(session);
+    for (auto it = mReceiverTokens.begin(); it != mReceiverTokens.end(); ++it) {
+        if (it.value() == session) {
+            mReceiverTokens.erase(it);
+            break;
+        }
+    }
+    // The object lives in the transfer thread, its destructor aborts the connection there
+    receiver->deleteLater();
 }
 
-void DuktoProtocol::createSender(const QString &ipDest, qint16 port) {
-    mSender = new Sender(ipDest, port);
-    connect(mSender, &Sender::progress, this, &DuktoProtocol::transferStatusUpdate);
-    connect(mSender, &Sender::itemProgress, this, &DuktoProtocol::transferItemUpdate);
-    connect(mSender, &Sender::completed, this, [this]() {
-        mSender->deleteLater();
-        mSender = nullptr;
-        emit sendFileComplete();
+void DuktoProtocol::startQueuedReceivers() {
+    while (mQueuedReceivers.isEmpty() == false && mReceivers.size() - mQueuedReceivers.size() < mOptions.concurrentSessions) {
+        qint64 session = mQueuedReceivers.takeFirst();
+        Receiver *receiver = mReceivers.value(session);
+        QMetaObject::invokeMethod(receiver, "release", Qt::QueuedConnection);
+        emit receiveStarted(session, mReceiverPeers.value(session));
+    }
+}
+
+void DuktoProtocol::createSender(const SendJob &job, SharedSource *source) {
+    qint64 session = job.session;
+    Sender *sender = new Sender(job.ipDest, job.port);
+    sender->setOptions(mOptions);
+    sender->setPeerFeatures(mPeerFeatures.value(job.ipDest, 0));
+    sender->setRateLimiter(mRateLimiter);
+    mSenders.insert(session, sender);
+    if (source != nullptr) {
+        sender->setSource(source);
+        mSenderSources.insert(session, source);
+    }
+    connect(sender, &Sender::progress, this, [this, session](qint64 total, qint64 partial, qint64 wire) {
+        queueTransferStatus(session, total, partial, wire);
+    }, Qt::DirectConnection);
+    connect(sender, &Sender::statsUpdated, this, [this, session](const TransferStats &stats) {
+        queueTransferStats(session, stats);
+    }, Qt::DirectConnection);
+    connect(sender, &Sender::itemProgress, this, [this, session](qint64 total, qint64 current, const QString &name) {
+        emit transferItemUpdate(session, total, current, name);
     });
-    connect(mSender, &Sender::aborted, this, [this](const QString &error) {
-        mSender->deleteLater();
-        mSender = nullptr;
-        emit sendFileError(error);
+    connect(sender, &Sender::completed, this, [this, session]() {
+        if (mSenders.contains(session) == false) {
+            return;
+        }
+        flushTransferStatus();
+        removeSender(session);
+        emit sendFileComplete(session);
+        startQueuedSends();
+    });
+    connect(sender, &Sender::aborted, this, [this, session](const QString &error) {
+        if (mSenders.contains(session) == false) {
+            return;
+        }
+        flushTransferStatus();
+        removeSender(session);
+        emit sendFileError(session, error);
+        startQueuedSends();
     });
+    sender->moveToThread(mTransferThread);
+
+    switch (job.kind) {
+        case SEND_FILES:
+            if (source != nullptr) {
+                QMetaObject::invokeMethod(sender, "sendShared", Qt::QueuedConnection);
+                break;
+            }
+            QMetaObject::invokeMethod(sender, "sendFiles", Qt::QueuedConnection, Q_ARG(QStringList, job.files));
+            break;
+        case SEND_TEXT:
+            QMetaObject::invokeMethod(sender, "sendText", Qt::QueuedConnection, Q_ARG(QString, job.text));
+            break;
+        case SEND_SCREEN:
+            QMetaObject::invokeMethod(sender, "sendFile", Qt::QueuedConnection, Q_ARG(QString, job.files.value(0)), Q_ARG(QString, QStringLiteral("Screenshot.jpg")));
+            break;
+    }
+    emit sendStarted(session, job.ipDest);
 }
 
-void DuktoProtocol::sendFile(const QString &ipDest, qint16 port, const QStringList &files)
-{
+void DuktoProtocol::removeSender(qint64 session) {
+    // The object lives in the transfer thread, its destructor aborts the connection there
+    mSenders.take(session)->deleteLater();
+    // the source goes with the last sender of its group, after it in the event queue
+    SharedSource *source = mSenderSources.take(session);
+    if (source != nullptr) {
+        bool used = false;
+        for (SharedSource *other : mSenderSources) {
+            used = used || other == source;
+        }
+        if (used == false) {
+            source->deleteLater();
+        }
+    }
+}
+
+qint64 DuktoProtocol::queueSend(const QString &ipDest, qint16 port, SEND_KIND kind, const QStringList &files, const QString &text) {
     // Check for default port
     if (port == 0) port = DEFAULT_TCP_PORT;
 
-    // Verifica altre attività in corso
-    if (mReceiver != nullptr || mSender != nullptr) {
-        return;
+    SendJob job;
+    job.session = ++mLastSession;
+    job.ipDest = ipDest;
+    job.port = static_cast<quint16>(port);
+    job.kind = kind;
+    job.files = files;
+    job.text = text;
+    mSendQueue.append(job);
+    startQueuedSends();
+    return job.session;
+}
+
+void DuktoProtocol::startQueuedSends() {
+    while (mSendQueue.isEmpty() == false && mSenders.size() < mOptions.concurrentSends) {
+        createSender(mSendQueue.takeFirst());
     }
+}
 
-    createSender(ipDest, port);
-    mSender->sendFiles(files);
+// Called in the transfer thread. Only the latest values are kept, and at most
+// one delivery is queued to the GUI thread no matter how fast chunks go by
+void DuktoProtocol::queueTransferStatus(qint64 session, qint64 total, qint64 partial, qint64 wire) {
+    QMutexLocker locker(&mStatusMutex);
+    mStatus.insert(session, {total, partial, wire});
+    if (mStatusPending == false) {
+        mStatusPending = true;
+        QMetaObject::invokeMethod(this, "flushTransferStatus", Qt::QueuedConnection);
+    }
 }
 
-void DuktoProtocol::sendText(const QString &ipDest, qint16 port, const QString &text)
-{
-    // Check for default port
-    if (port == 0) port = DEFAULT_TCP_PORT;
+// The same for the timings, which come less often
+void DuktoProtocol::queueTransferStats(qint64 session, const TransferStats &stats) {
+    QMutexLocker locker(&mStatusMutex);
+    mStats.insert(session, stats);
+    if (mStatusPending == false) {
+        mStatusPending = true;
+        QMetaObject::invokeMethod(this, "flushTransferStatus", Qt::QueuedConnection);
+    }
+}
 
-    // Verifica altre attività in corso
-    if (mReceiver != nullptr || mSender != nullptr) return;
+void DuktoProtocol::flushTransferStatus() {
+    QHash<qint64, TransferStatus> status;
+    QHash<qint64, TransferStats> stats;
+    {
+        QMutexLocker locker(&mStatusMutex);
+        if (mStatusPending == false) {
+            return;
+        }
+        mStatusPending = false;
+        status.swap(mStatus);
+        stats.swap(mStats);
+    }
+    for (auto it = status.constBegin(); it != status.constEnd(); ++it) {
+        emit transferStatusUpdate(it.key(), it.value().total, it.value().partial, it.value().wire);
+    }
+    for (auto it = stats.constBegin(); it != stats.constEnd(); ++it) {
+        emit transferStatsUpdate(it.key(), it.value());
+    }
+}
 
-    createSender(ipDest, port);
-    mSender->sendText(text);
+qint64 DuktoProtocol::sendFile(const QString &ipDest, qint16 port, const QStringList &files)
+{
+    return queueSend(ipDest, port, SEND_FILES, files, QString());
 }
 
-void DuktoProtocol::sendScreen(const QString &ipDest, qint16 port, const QString &path)
+qint64 DuktoProtocol::sendText(const QString &ipDest, qint16 port, const QString &text)
 {
-    // Check for default port
-    if (port == 0) port = DEFAULT_TCP_PORT;
+    return queueSend(ipDest, port, SEND_TEXT, QStringList(), text);
+}
 
-    // Verifica altre attività in corso
-    if (mReceiver != nullptr || mSender != nullptr) return;
+qint64 DuktoProtocol::sendScreen(const QString &ipDest, qint16 port, const QString &path)
+{
+    return queueSend(ipDest, port, SEND_SCREEN, QStringList(path), QString());
+}
 
-    createSender(ipDest, port);
-    mSender->sendFile(path, "Screenshot.jpg");
+QList<qint64> DuktoProtocol::sendFileToMany(const QList<QPair<QString, qint16> > &dests, const QStringList &files)
+{
+    QList<qint64> sessions;
+    if (dests.isEmpty()) {
+        return sessions;
+    }
+    SharedSource *source = new SharedSource(files, mOptions.fanOutWindow);
+    source->moveToThread(mTransferThread);
+    for (const QPair<QString, qint16> &dest : dests) {
+        SendJob job;
+        job.session = ++mLastSession;
+        job.ipDest = dest.first;
+        job.port = static_cast<quint16>(dest.second == 0 ? DEFAULT_TCP_PORT : dest.second);
+        job.kind = SEND_FILES;
+        job.files = files;
+        createSender(job, source);
+        sessions.append(job.session);
+    }
+    // the senders wait for the list, they were queued first
+    QMetaObject::invokeMethod(source, "start", Qt::QueuedConnection);
+    return sessions;
 }
 
-// Interrompe un trasferimento in corso (utilizzabile solo lato invio)
-void DuktoProtocol::abortCurrentTransfer()
+// Interrompe un trasferimento in corso
+void DuktoProtocol::abortTransfer(qint64 session)
 {
     // Abort current connection
-    if (mSender != nullptr) {
-        mSender->abort();
-        emit sendFileAborted();
-        mSender = nullptr;
-    } else if (mReceiver != nullptr) {
-        mReceiver->abort();
-        emit receiveAborted(QString());
-        mReceiver = nullptr;
+    // The objects live in the transfer thread, their destructors abort the connections there
+    if (mSenders.contains(session)) {
+        removeSender(session);
+        emit sendFileAborted(session);
+        startQueuedSends();
+        return;
+    }
+    for (int i = 0; i < mSendQueue.size(); i++) {
+        if (mSendQueue.at(i).session == session) {
+            mSendQueue.removeAt(i);
+            emit sendFileAborted(session);
+            return;
+        }
+    }
+    if (mReceivers.contains(session)) {
+        removeReceiver(session);
+        emit receiveAborted(session, QString());
+        startQueuedReceivers();
     }
 }
 
@@ -229,3 +506,16 @@ void DuktoProtocol::setDestDir(const QString &dir) {
     }
 #endif
 }
+
+void DuktoProtocol::setTransferOptions(const TransferOptions &options) {
+    mOptions = options;
+    if (mMessenger != nullptr) {
+        mMessenger->setFeatures(options.receiveFeatures & TransferOptions::supportedFeatures());
+    }
+    // running sessions follow the new rates too
+    mRateLimiter->setRates(options.rateLimit, options.peerRateLimits);
+}
+
+void DuktoProtocol::setPeerFeatures(const QString &address, qint64 features) {
+    mPeerFeatures.insert(address, features);
+}
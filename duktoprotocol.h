@@ -27,12 +27,20 @@
 #include <QHash>
 #include <QFile>
 #include <QStringList>
+#include <QMutex>
+#include <QList>
+#include <QPair>
 
 #include "peer.h"
+#include "network/transferoptions.h"
+#include "network/transferstats.h"
 
 class Messenger;
 class Receiver;
 class Sender;
+class SharedSource;
+class RateLimiter;
+class QThread;
 
 class DuktoProtocol : public QObject
 {
@@ -45,42 +53,115 @@ public:
     bool setupTcpServer(quint16 port, QString &error);
     void closeServers();
     void greeting();
-    void sendFile(const QString &ipDest, qint16 port, const QStringList &files);
-    void sendText(const QString &ipDest, qint16 port, const QString &text);
-    void sendScreen(const QString &ipDest, qint16 port, const QString &path);
-    void abortCurrentTransfer();
+    // queue a send job and return the id of its session, jobs run in order,
+    // no more than TransferOptions::concurrentSends at a time
+    qint64 sendFile(const QString &ipDest, qint16 port, const QStringList &files);
+    qint64 sendText(const QString &ipDest, qint16 port, const QString &text);
+    qint64 sendScreen(const QString &ipDest, qint16 port, const QString &path);
+    // sends the same files to every destination, one session each. The files are
+    // listed and read once for all of them. The sessions start at once, beyond
+    // TransferOptions::concurrentSends, as they have to move together
+    QList<qint64> sendFileToMany(const QList<QPair<QString, qint16> > &dests, const QStringList &files);
+    void abortTransfer(qint64 session);
     void updateBuddy();
     void setDestDir(const QString &dir);
+    void setTransferOptions(const TransferOptions &options);
+    // the protocol extensions a buddy accepts, as it announced them. senders
+    // offer only these, a buddy which announced none gets the classic protocol
+    void setPeerFeatures(const QString &address, qint64 features);
     
 private slots:
     void newIncomingConnection();
+    void flushTransferStatus();
 
 signals:
+     // every transfer is a session, identified by the id passed first
      void peerListAdded(Peer peer);
      void peerListRemoved(Peer peer);
-     void sendFileComplete();
-     void sendFileError(QString error);
-     void sendFileAborted();
-     void receiveStarted(QString senderIp);
-     void receiveCompleted();
-     void receiveAborted(QString error);
-     void receiveFileCompleted(QString name, QString path, qint64 size);
-     void receiveDirCompleted(QString name, QString path);
-     void receiveTextCompleted(QString text);
-     void transferStatusUpdate(qint64 total, qint64 partial);
-     void transferItemUpdate(qint64 total, qint64 current, QString name);
+     // a queued send job is connecting to its destination
+     void sendStarted(qint64 session, QString ipDest);
+     void sendFileComplete(qint64 session);
+     void sendFileError(qint64 session, QString error);
+     void sendFileAborted(qint64 session);
+     // more senders than allowed at a time, the session starts later
+     void receiveQueued(qint64 session, QString senderIp);
+     void receiveStarted(qint64 session, QString senderIp);
+     void receiveCompleted(qint64 session);
+     void receiveAborted(qint64 session, QString error);
+     void receiveFileCompleted(qint64 session, QString name, QString path, qint64 size);
+     void receiveDirCompleted(qint64 session, QString name, QString path);
+     void receiveTextCompleted(qint64 session, QString text);
+     void transferStatusUpdate(qint64 session, qint64 total, qint64 partial, qint64 wire);
+     void transferItemUpdate(qint64 session, qint64 total, qint64 current, QString name);
+     // rate, stalls and phase timings, now and then and once more when the session ends
+     void transferStatsUpdate(qint64 session, TransferStats stats);
 
 private:
-    void createSender(const QString &ipDest, qint16 port);
+    void classifyConnection(QTcpSocket *s);
+    void createReceiver(QTcpSocket *s);
+    void removeReceiver(qint64 session);
+    void startQueuedReceivers();
+    enum SEND_KIND {
+        SEND_FILES,
+        SEND_TEXT,
+        SEND_SCREEN,
+    };
+    struct SendJob {
+        qint64 session;
+        QString ipDest;
+        quint16 port;
+        SEND_KIND kind;
+        // paths for files and the screenshot, or the text
+        QStringList files;
+        QString text;
+    };
+    qint64 queueSend(const QString &ipDest, qint16 port, SEND_KIND kind, const QStringList &files, const QString &text);
+    void startQueuedSends();
+    void createSender(const SendJob &job, SharedSource *source = nullptr);
+    void removeSender(qint64 session);
+    void queueTransferStatus(qint64 session, qint64 total, qint64 partial, qint64 wire);
+    void queueTransferStats(qint64 session, const TransferStats &stats);
 
     Messenger *mMessenger = nullptr;
-    Receiver *mReceiver = nullptr;
-    Sender *mSender = nullptr;
+    qint64 mLastSession = 0;
+    // receive sessions by id, the queued ones wait for a free slot in arrival order
+    QHash<qint64, Receiver*> mReceivers;
+    QList<qint64> mQueuedReceivers;
+    // tokens of the receive sessions, to route their extra connections
+    QHash<qint64, qint64> mReceiverTokens;
+    QHash<qint64, QString> mReceiverPeers;
+    // protocol extensions announced by the buddies, by address
+    QHash<QString, qint64> mPeerFeatures;
+    // connections whose first bytes have not arrived yet
+    QList<QTcpSocket*> mPendingConnections;
+    // send sessions by id, and the jobs waiting for a free slot
+    QHash<qint64, Sender*> mSenders;
+    QList<SendJob> mSendQueue;
+    // the source of every send session of a fan-out group
+    QHash<qint64, SharedSource*> mSenderSources;
+    // paces all sessions, its rates follow setTransferOptions()
+    RateLimiter *mRateLimiter = nullptr;
     QTcpServer *mTcpServer = nullptr;           // Socket TCP attesa dati
     QTcpSocket *mCurrentSocket = nullptr;       // Socket TCP dell'attuale trasferimento file
     qint16 mLocalTcpPort;
 
     QString mDestDir;
+    TransferOptions mOptions;
+
+    // senders and receivers run here, away from the GUI event loop
+    QThread *mTransferThread = nullptr;
+
+    // progress reported by the transfer thread, the latest values of every
+    // session are delivered in one queued call
+    struct TransferStatus {
+        qint64 total;
+        qint64 partial;
+        qint64 wire;
+    };
+    QMutex mStatusMutex;
+    QHash<qint64, TransferStatus> mStatus;
+    QHash<qint64, TransferStats> mStats;
+    bool mStatusPending = false;
 };
 
 #endif // DUKTOPROTOCOL_H
@@ -20,6 +20,7 @@
 
 #include "settings.h"
 #include "miniwebserver.h"
+#include "transfermetrics.h"
 #include "duktowindow.h"
 #include "platform.h"
 #include "updateschecker.h"
@@ -43,6 +44,7 @@
 #include <QMessageBox>
 #include <QImage>
 #include <QStandardPaths>
+#include <algorithm>
 
 #if QT_VERSION >= QT_VERSION_CHECK(5, 10 ,0)
 #include <QRandomGenerator>
@@ -71,6 +73,10 @@ GuiBehind::GuiBehind() : QObject(nullptr)
 
     // Mini web server
     mMiniWebServer = new MiniWebServer(NETWORK_PORT + 1);
+    if (gSettings->metricsEnabled()) {
+        mMetrics = new TransferMetrics(&mDuktoProtocol, this);
+        mMiniWebServer->setMetrics(mMetrics);
+    }
 
     // Destination buddy
     mDestBuddy = new DestinationBuddy(this);
@@ -78,6 +84,8 @@ GuiBehind::GuiBehind() : QObject(nullptr)
     // Set destination folder
     mDuktoProtocol.setDestDir(gSettings->destPath());
 
+    mDuktoProtocol.setTransferOptions(gSettings->transferOptions());
+
     // Set current theme color
     mTheme.setThemeColor(gSettings->themeColor());
 
@@ -86,6 +94,7 @@ GuiBehind::GuiBehind() : QObject(nullptr)
     connect(&mDuktoProtocol, &DuktoProtocol::peerListRemoved, this, &GuiBehind::peerListRemoved);
     connect(&mDuktoProtocol, &DuktoProtocol::transferStatusUpdate, this, &GuiBehind::transferStatusUpdate);
     connect(&mDuktoProtocol, &DuktoProtocol::transferItemUpdate, this, &GuiBehind::transferItemUpdate);
+    connect(&mDuktoProtocol, &DuktoProtocol::transferStatsUpdate, this, &GuiBehind::transferStatsUpdate);
     connect(&mDuktoProtocol, &DuktoProtocol::receiveStarted, this, &GuiBehind::receiveFileStart);
     connect(&mDuktoProtocol, &DuktoProtocol::receiveAborted, this, &GuiBehind::receiveFileCancelled);
     connect(&mDuktoProtocol, &DuktoProtocol::receiveCompleted, this, &GuiBehind::receiveComplete);
@@ -99,10 +108,6 @@ GuiBehind::GuiBehind() : QObject(nullptr)
     // Register other signals
     connect(this, &GuiBehind::remoteDestinationAddressChanged, this, &GuiBehind::remoteDestinationAddressHandler);
 
-    // Periodic "hello" timer
-    mPeriodicHelloTimer = new QTimer(this);
-    connect(mPeriodicHelloTimer, &QTimer::timeout, this, &GuiBehind::discoveryNeighbors);
-
     // Setup protocol
     initialize();
 
@@ -131,7 +136,6 @@ GuiBehind::~GuiBehind()
 #endif
     if (mMiniWebServer) mMiniWebServer->deleteLater();
     if (mShowBackTimer) mShowBackTimer->deleteLater();
-    if (mPeriodicHelloTimer) mPeriodicHelloTimer->deleteLater();
     if (mDestBuddy) mDestBuddy->deleteLater();
 }
 
@@ -160,9 +164,15 @@ void GuiBehind::setViewer(DuktoWindow *view, SystemTray *tray) {
 #endif
 
     if (tray != nullptr) {
-        connect(&mDuktoProtocol, &DuktoProtocol::receiveTextCompleted, tray, &SystemTray::received_text);
-        connect(&mDuktoProtocol, &DuktoProtocol::receiveFileCompleted, tray, &SystemTray::received_file);
-        connect(&mDuktoProtocol, &DuktoProtocol::receiveDirCompleted, tray, &SystemTray::received_folder);
+        connect(&mDuktoProtocol, &DuktoProtocol::receiveTextCompleted, tray, [tray](qint64, const QString &text) {
+            tray->received_text(text);
+        });
+        connect(&mDuktoProtocol, &DuktoProtocol::receiveFileCompleted, tray, [tray](qint64, const QString &name, const QString &path, qint64 size) {
+            tray->received_file(name, path, size);
+        });
+        connect(&mDuktoProtocol, &DuktoProtocol::receiveDirCompleted, tray, [tray](qint64, const QString &name, const QString &path) {
+            tray->received_folder(name, path);
+        });
     }
 }
 
@@ -213,14 +223,20 @@ void GuiBehind::clipboardChanged()
     emit clipboardTextAvailableChanged();
 }
 
-void GuiBehind::receiveFileStart(const QString &senderIp)
+void GuiBehind::receiveFileStart(qint64 session, const QString &senderIp)
 {
     // Look for the sender in the buddy list
     QString sender = mBuddiesList.buddyNameByIp(senderIp);
     if (sender.isEmpty())
-        setCurrentTransferBuddy("remote sender");
-    else
-        setCurrentTransferBuddy(sender);
+        sender = "remote sender";
+    mReceiveBuddies.insert(session, sender);
+
+    // Another transfer is shown already
+    if (mCurrentSession != 0)
+        return;
+    mCurrentSession = session;
+    setCurrentTransferBuddy(sender);
+    setCurrentTransferDetails(QVariantMap());
 
     // Update user interface
     setCurrentTransferSending(false);
@@ -231,17 +247,45 @@ void GuiBehind::receiveFileStart(const QString &senderIp)
     emit transferStart();
 }
 
-void GuiBehind::transferStatusUpdate(qint64 total, qint64 partial)
+void GuiBehind::transferStatusUpdate(qint64 session, qint64 total, qint64 partial, qint64 wire)
 {
-    // Stats formatting
-    if (total < 1024)
-        setCurrentTransferStats(QString::number(partial) + " B of " + QString::number(total) + " B");
+    if (session != mCurrentSession)
+        return;
+
+    // Stats formatting, the total is not known while the sender is still listing its files
+    QString stats;
+    if (total < 0) {
+        if (partial < 1024)
+            stats = QString::number(partial) + " B";
+        else if (partial < 1048576)
+            stats = QString::number(partial * 1.0 / 1024, 'f', 1) + " KB";
+        else
+            stats = QString::number(partial * 1.0 / 1048576, 'f', 1) + " MB";
+    } else if (total < 1024)
+        stats = QString::number(partial) + " B of " + QString::number(total) + " B";
     else if (total < 1048576)
-        setCurrentTransferStats(QString::number(partial * 1.0 / 1024, 'f', 1) + " KB of " + QString::number(total * 1.0 / 1024, 'f', 1) + " KB");
+        stats = QString::number(partial * 1.0 / 1024, 'f', 1) + " KB of " + QString::number(total * 1.0 / 1024, 'f', 1) + " KB";
     else
-        setCurrentTransferStats(QString::number(partial * 1.0 / 1048576, 'f', 1) + " MB of " + QString::number(total * 1.0 / 1048576, 'f', 1) + " MB");
+        stats = QString::number(partial * 1.0 / 1048576, 'f', 1) + " MB of " + QString::number(total * 1.0 / 1048576, 'f', 1) + " MB";
+    // Compressed data moves faster than the link
+    if (wire > 0 && wire < partial * 0.9)
+        stats += " (" + QString::number(partial * 1.0 / wire, 'f', 1) + "x compressed)";
+    // Rate and time left, once they have been measured
+    double rate = mCurrentTransferDetails.value("rate").toDouble();
+    if (rate >= 1048576)
+        stats += ", " + QString::number(rate / 1048576, 'f', 1) + " MB/s";
+    else if (rate > 0)
+        stats += ", " + QString::number(rate / 1024, 'f', 1) + " KB/s";
+    qint64 eta = mCurrentTransferDetails.value("eta", -1).toLongLong();
+    if (rate > 0 && eta >= 0) {
+        QString left = QStringLiteral("%1:%2").arg(eta / 60 % 60, 2, 10, QChar('0')).arg(eta % 60, 2, 10, QChar('0'));
+        if (eta >= 3600)
+            left.prepend(QString::number(eta / 3600) + ":");
+        stats += ", " + left + " left";
+    }
+    setCurrentTransferStats(stats);
 
-    double percent = partial * 1.0 / total * 100;
+    double percent = (total > 0 ? partial * 1.0 / total * 100 : 0);
     setCurrentTransferProgress(percent);
 
 #ifdef Q_OS_WIN
@@ -249,27 +293,55 @@ void GuiBehind::transferStatusUpdate(qint64 total, qint64 partial)
 #endif
 }
 
-void GuiBehind::transferItemUpdate(qint64 total, qint64 current, const QString &name) {
+void GuiBehind::transferItemUpdate(qint64 session, qint64 total, qint64 current, const QString &name) {
+    if (session != mCurrentSession)
+        return;
     const static QString textTemplate = QStringLiteral("(%1 / %2)  %3");
-    setCurrentTransferItem(textTemplate.arg(current).arg(total).arg(name));
+    const static QString streamedTemplate = QStringLiteral("(%1)  %2");
+    if (total < 0)
+        setCurrentTransferItem(streamedTemplate.arg(current).arg(name));
+    else
+        setCurrentTransferItem(textTemplate.arg(current).arg(total).arg(name));
 }
 
-void GuiBehind::receiveFileComplete(const QString &name, const QString &path, qint64 size) {
+void GuiBehind::transferStatsUpdate(qint64 session, const TransferStats &stats) {
+    if (session != mCurrentSession)
+        return;
+    setCurrentTransferDetails(stats.toVariantMap());
+}
+
+void GuiBehind::receiveFileComplete(qint64 session, const QString &name, const QString &path, qint64 size) {
     // Add an entry to recent activities
-    mRecentList.addRecent(name, path, "file", mCurrentTransferBuddy, size);
+    mRecentList.addRecent(name, path, "file", mReceiveBuddies.value(session, mCurrentTransferBuddy), size);
 }
 
-void GuiBehind::receiveDirComplete(const QString &name, const QString &path) {
+void GuiBehind::receiveDirComplete(qint64 session, const QString &name, const QString &path) {
     // Add an entry to recent activities
-    mRecentList.addRecent(name, path, "dir", mCurrentTransferBuddy, -1);
+    mRecentList.addRecent(name, path, "dir", mReceiveBuddies.value(session, mCurrentTransferBuddy), -1);
 }
 
-void GuiBehind::receiveTextComplete(const QString &text) {
+void GuiBehind::receiveTextComplete(qint64 session, const QString &text) {
     // Add an entry to recent activities
-    mRecentList.addRecent("Text snippet", text, "text", mCurrentTransferBuddy, text.size());
+    mRecentList.addRecent("Text snippet", text, "text", mReceiveBuddies.value(session, mCurrentTransferBuddy), text.size());
+}
+
+// Shows another running receive session in place of the finished one
+bool GuiBehind::showNextReceive() {
+    mCurrentSession = 0;
+    if (mReceiveBuddies.isEmpty())
+        return false;
+    mCurrentSession = mReceiveBuddies.constBegin().key();
+    setCurrentTransferBuddy(mReceiveBuddies.constBegin().value());
+    setCurrentTransferItem("");
+    setCurrentTransferDetails(QVariantMap());
+    return true;
 }
 
-void GuiBehind::receiveComplete() {
+void GuiBehind::receiveComplete(qint64 session) {
+    mReceiveBuddies.remove(session);
+    if (session != mCurrentSession || showNextReceive())
+        return;
+
     // Update GUI
 #ifdef Q_OS_WIN
     mView->hideTaskbarProgress();
@@ -492,7 +564,7 @@ void GuiBehind::sendScreenStage2() {
                 if (!prepareStartTransfer(&ip, &port)) return;
 
                 // Start screen transfer
-                mDuktoProtocol.sendScreen(ip, port, mScreenTempPath);
+                mCurrentSession = mDuktoProtocol.sendScreen(ip, port, mScreenTempPath);
                 return;
             } else {
                 tempFile.remove();
@@ -515,7 +587,7 @@ void GuiBehind::startTransfer(const QStringList &files)
     if (!prepareStartTransfer(&ip, &port)) return;
 
     // Start files transfer
-    mDuktoProtocol.sendFile(ip, port, files);
+    mCurrentSession = mDuktoProtocol.sendFile(ip, port, files);
 }
 
 void GuiBehind::startTransfer(const QString &text)
@@ -526,7 +598,7 @@ void GuiBehind::startTransfer(const QString &text)
     if (!prepareStartTransfer(&ip, &port)) return;
 
     // Start files transfer
-    mDuktoProtocol.sendText(ip, port, text);
+    mCurrentSession = mDuktoProtocol.sendText(ip, port, text);
 }
 
 bool GuiBehind::prepareStartTransfer(QString *ip, qint16 *port)
@@ -577,6 +649,7 @@ bool GuiBehind::prepareStartTransfer(QString *ip, qint16 *port)
     setCurrentTransferSending(true);
     setCurrentTransferStats("Connecting...");
     setCurrentTransferItem("");
+    setCurrentTransferDetails(QVariantMap());
     setCurrentTransferProgress(0);
 #ifdef Q_OS_WIN
     mView->showTaskbarProgress(0);
@@ -586,8 +659,12 @@ bool GuiBehind::prepareStartTransfer(QString *ip, qint16 *port)
     return true;
 }
 
-void GuiBehind::sendFileComplete()
+void GuiBehind::sendFileComplete(qint64 session)
 {
+    if (session != mCurrentSession)
+        return;
+    mCurrentSession = 0;
+
     // Show completed message
     setMessagePageTitle("Send");
 #ifdef MOBILE_APP
@@ -644,8 +721,12 @@ bool GuiBehind::canAcceptDrop()
 }
 
 // Handles send error
-void GuiBehind::sendFileError(const QString &error)
+void GuiBehind::sendFileError(qint64 session, const QString &error)
 {
+    if (session != mCurrentSession)
+        return;
+    mCurrentSession = 0;
+
     setMessagePageTitle("Error");
     setMessagePageText("Sorry, an error has occurred while sending your data...\n\n" + error);
     setMessagePageBackState("send");
@@ -665,14 +746,18 @@ void GuiBehind::sendFileError(const QString &error)
 }
 
 // Handles receive error
-void GuiBehind::receiveFileCancelled(const QString &error)
+void GuiBehind::receiveFileCancelled(qint64 session, const QString &error)
 {
+    mReceiveBuddies.remove(session);
+    if (session != mCurrentSession)
+        return;
     if (error.isEmpty() == false) {
+        mCurrentSession = 0;
         setMessagePageTitle("Error");
         setMessagePageText("An error has occurred during the transfer... The data you received could be incomplete or broken.\n\n" + error);
         setMessagePageBackState("");
         emit gotoMessagePage();
-    } else {
+    } else if (showNextReceive() == false) {
         // no reason, cancelled by user
         emit receiveCompleted();
     }
@@ -727,12 +812,15 @@ void GuiBehind::showUpdatesMessage()
 // Abort current transfer while sending data
 void GuiBehind::abortTransfer()
 {
-    mDuktoProtocol.abortCurrentTransfer();
+    mDuktoProtocol.abortTransfer(mCurrentSession);
 }
 
 // Protocol confirms that abort has been done
-void GuiBehind::sendFileAborted()
+void GuiBehind::sendFileAborted(qint64 session)
 {
+    if (session != mCurrentSession)
+        return;
+    mCurrentSession = 0;
     resetProgressStatus();
     emit gotoSendPage();
 }
@@ -788,6 +876,18 @@ void GuiBehind::setCurrentTransferItem(const QString &item)
     emit currentTransferItemChanged();
 }
 
+QVariantMap GuiBehind::currentTransferDetails()
+{
+    return mCurrentTransferDetails;
+}
+
+void GuiBehind::setCurrentTransferDetails(const QVariantMap &details)
+{
+    if (details == mCurrentTransferDetails) return;
+    mCurrentTransferDetails = details;
+    emit currentTransferDetailsChanged();
+}
+
 QString GuiBehind::textSnippetBuddy()
 {
     return mTextSnippetBuddy;
@@ -978,6 +1078,17 @@ bool GuiBehind::closeToTray() {
     return gSettings->closeToTrayEnabled();
 }
 
+void GuiBehind::setRateLimit(int rate) {
+    gSettings->saveRateLimit(static_cast<qint64>(std::max(rate, 0)) * 1024);
+    // applies to the transfers going on as well
+    mDuktoProtocol.setTransferOptions(gSettings->transferOptions());
+    emit rateLimitChanged();
+}
+
+int GuiBehind::rateLimit() {
+    return static_cast<int>(gSettings->rateLimit() / 1024);
+}
+
 void GuiBehind::setInitError(const QString &error, const QString &action) {
     if (error != mInitError) {
         mInitError = error;
@@ -1077,7 +1188,6 @@ void GuiBehind::initialize() {
     setInitError(QString(""));
     // Say "hello"
     discoveryNeighbors();
-    mPeriodicHelloTimer->start(60000);
 }
 
 void GuiBehind::reinitialize(const QString &action) {
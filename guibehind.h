@@ -32,6 +32,7 @@
 class UpdatesChecker;
 #endif
 class MiniWebServer;
+class TransferMetrics;
 class DuktoWindow;
 class SystemTray;
 
@@ -42,6 +43,8 @@ class GuiBehind : public QObject
     Q_PROPERTY(int currentTransferProgress READ currentTransferProgress NOTIFY currentTransferProgressChanged)
     Q_PROPERTY(QString currentTransferStats READ currentTransferStats NOTIFY currentTransferStatsChanged)
     Q_PROPERTY(QString currentTransferItem READ currentTransferItem NOTIFY currentTransferItemChanged)
+    // rate, time left, stalls and phase timings of the transfer shown, see TransferStats::toJson()
+    Q_PROPERTY(QVariantMap currentTransferDetails READ currentTransferDetails NOTIFY currentTransferDetailsChanged)
     Q_PROPERTY(bool currentTransferSending READ currentTransferSending NOTIFY currentTransferSendingChanged)
     Q_PROPERTY(QString textSnippetBuddy READ textSnippetBuddy NOTIFY textSnippetBuddyChanged)
     Q_PROPERTY(QString textSnippet READ textSnippet WRITE setTextSnippet NOTIFY textSnippetChanged)
@@ -59,6 +62,7 @@ class GuiBehind : public QObject
     Q_PROPERTY(QString buddyAvatar READ buddyAvatar NOTIFY buddyAvatarChanged)
     Q_PROPERTY(bool showNotification READ showNotification WRITE setShowNotification NOTIFY showNotificationChanged)
     Q_PROPERTY(bool closeToTray READ closeToTray WRITE setCloseToTray NOTIFY closeToTrayChanged)
+    Q_PROPERTY(int rateLimit READ rateLimit WRITE setRateLimit NOTIFY rateLimitChanged)
     Q_PROPERTY(QString initError READ initError NOTIFY initErrorChanged)
     Q_PROPERTY(QString initErrorAction READ initErrorAction NOTIFY initErrorActionChanged)
     Q_PROPERTY(QMargins screenPadding READ screenPadding NOTIFY screenPaddingChanged)
@@ -80,6 +84,8 @@ public:
     void setCurrentTransferStats(const QString &stats);
     QString currentTransferItem();
     void setCurrentTransferItem(const QString &item);
+    QVariantMap currentTransferDetails();
+    void setCurrentTransferDetails(const QVariantMap &details);
     QString textSnippetBuddy();
     void setTextSnippetBuddy(const QString &buddy);
     QString textSnippet();
@@ -112,6 +118,9 @@ public:
     bool showNotification();
     void setCloseToTray(bool enabled);
     bool closeToTray();
+    // KB/s, 0 for no limit
+    void setRateLimit(int rate);
+    int rateLimit();
     void setInitError(const QString &error, const QString &action = "Retry");
     QString initError();
     QString initErrorAction();
@@ -128,6 +137,7 @@ signals:
     void currentTransferProgressChanged();
     void currentTransferStatsChanged();
     void currentTransferItemChanged();
+    void currentTransferDetailsChanged();
     void currentTransferSendingChanged();
     void textSnippetBuddyChanged();
     void textSnippetChanged();
@@ -145,6 +155,7 @@ signals:
     void buddyAvatarChanged();
     void showNotificationChanged();
     void closeToTrayChanged();
+    void rateLimitChanged();
     void initErrorChanged();
     void initErrorActionChanged();
     void screenPaddingChanged();
@@ -162,17 +173,18 @@ public slots:
     // Called by Dukto protocol
     void peerListAdded(const Peer &peer);
     void peerListRemoved(const Peer &peer);
-    void receiveFileStart(const QString &senderIp);
-    void transferStatusUpdate(qint64 total, qint64 partial);
-    void transferItemUpdate(qint64 total, qint64 current, const QString &name);
-    void receiveFileComplete(const QString &name, const QString &path, qint64 size);
-    void receiveDirComplete(const QString &name, const QString &path);
-    void receiveTextComplete(const QString &text);
-    void receiveComplete();
-    void sendFileComplete();
-    void sendFileError(const QString &error);
-    void receiveFileCancelled(const QString &error);
-    void sendFileAborted();
+    void receiveFileStart(qint64 session, const QString &senderIp);
+    void transferStatusUpdate(qint64 session, qint64 total, qint64 partial, qint64 wire);
+    void transferItemUpdate(qint64 session, qint64 total, qint64 current, const QString &name);
+    void transferStatsUpdate(qint64 session, const TransferStats &stats);
+    void receiveFileComplete(qint64 session, const QString &name, const QString &path, qint64 size);
+    void receiveDirComplete(qint64 session, const QString &name, const QString &path);
+    void receiveTextComplete(qint64 session, const QString &text);
+    void receiveComplete(qint64 session);
+    void sendFileComplete(qint64 session);
+    void sendFileError(qint64 session, const QString &error);
+    void receiveFileCancelled(qint64 session, const QString &error);
+    void sendFileAborted(qint64 session);
 
     // Called by QML
     void openDestinationFolder();
@@ -210,8 +222,8 @@ private slots:
 private:
     DuktoWindow *mView = nullptr;
     QTimer *mShowBackTimer = nullptr;
-    QTimer *mPeriodicHelloTimer = nullptr;
     MiniWebServer *mMiniWebServer = nullptr;
+    TransferMetrics *mMetrics = nullptr;
     DestinationBuddy *mDestBuddy = nullptr;
     BuddyListItemModel mBuddiesList;
     RecentListItemModel mRecentList;
@@ -222,10 +234,15 @@ private:
     UpdatesChecker *mUpdatesChecker;
 #endif
 
+    // the transfer shown, others received at the same time go on in the background
+    qint64 mCurrentSession = 0;
+    // buddy names of the running receive sessions
+    QHash<qint64, QString> mReceiveBuddies;
     int mCurrentTransferProgress;
     QString mCurrentTransferBuddy;
     QString mCurrentTransferStats;
     QString mCurrentTransferItem;
+    QVariantMap mCurrentTransferDetails;
     bool mCurrentTransferSending;
     QString mTextSnippetBuddy;
     QString mTextSnippet;
@@ -244,6 +261,7 @@ private:
     QMargins mScreenPadding;
 
     bool testFolder(const QString &dir);
+    bool showNextReceive();
     bool prepareStartTransfer(QString *ip, qint16 *port);
     void startTransfer(const QStringList &files);
     void startTransfer(const QString &text);
@@ -19,7 +19,8 @@
 #include "ipaddressitemmodel.h"
 
 #include <QHostAddress>
-#include <QNetworkInterface>
+
+#include "network/interfacecache.h"
 
 IpAddressItemModel::IpAddressItemModel() :
     QStandardItemModel(nullptr)
@@ -29,6 +30,8 @@ IpAddressItemModel::IpAddressItemModel() :
     setItemRoleNames(roleNames);
 
     refreshIpList();
+    // follow the interfaces as they come and go
+    connect(&InterfaceCache::instance(), &InterfaceCache::changed, this, &IpAddressItemModel::refreshIpList);
 }
 
 void IpAddressItemModel::addIp(QString ip)
@@ -43,15 +46,16 @@ void IpAddressItemModel::refreshIpList()
     // Clear current IP list
     clear();
 
-    // Load IP list
-    QList<QHostAddress> addrs = QNetworkInterface::allAddresses();
-    for(QList<QHostAddress>::iterator iter = addrs.begin(); iter != addrs.end(); ++iter)
+    // Load IP list, the cache has no loopback addresses
+    const QList<InterfaceCache::Entry> entries = InterfaceCache::instance().entries();
+    QStringList added;
+    for (const InterfaceCache::Entry &entry: entries)
     {
-        if(iter->protocol() == QAbstractSocket::IPv4Protocol)
+        QString addr = entry.ip.toString();
+        if (added.contains(addr) == false)
         {
-            QString addr = iter->toString();
-            if(addr != "127.0.0.1")
-                addIp(addr);
+            added.append(addr);
+            addIp(addr);
         }
     }
 }
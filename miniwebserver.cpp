@@ -27,6 +27,7 @@
 #include <QRegularExpression>
 
 #include "platform.h"
+#include "transfermetrics.h"
 
 MiniWebServer::MiniWebServer(quint16 port) : port(port)
 {
@@ -36,6 +37,7 @@ MiniWebServer::MiniWebServer(quint16 port) : port(port)
 void MiniWebServer::restart() {
     close();
     // Load and convert avatar image
+    mAvatarData.clear();
     QString path = Platform::getAvatarPath();
     if (!path.isEmpty()) {
         QImage img(path);
@@ -43,12 +45,19 @@ void MiniWebServer::restart() {
         QBuffer tmp(&mAvatarData);
         tmp.open(QIODevice::WriteOnly);
         scaled.save(&tmp, "PNG");
+    }
 
-        // Start server
+    // Start server
+    if (!mAvatarData.isEmpty() || mMetrics != nullptr) {
         listen(QHostAddress::AnyIPv4, port);
     }
 }
 
+void MiniWebServer::setMetrics(TransferMetrics *metrics) {
+    mMetrics = metrics;
+    restart();
+}
+
 void MiniWebServer::incomingConnection(qintptr handle)
 {
     QTcpSocket* s = new QTcpSocket(this);
@@ -63,7 +72,18 @@ void MiniWebServer::readClient()
     if (socket->canReadLine()) {
         static const QRegularExpression re("[ \r\n][ \r\n]*");
         QStringList tokens = QString(socket->readLine()).split(re);
-        if (tokens.at(0) == "GET" && (tokens.at(1) == "/" || tokens.at(1) == "/dukto/avatar" || tokens.at(1).startsWith("/dukto/avatar?"))) {
+        if (tokens.at(0) == "GET" && tokens.at(1) == "/metrics" && mMetrics != nullptr) {
+
+            QByteArray body = mMetrics->render();
+            QTextStream os(socket);
+            os << "HTTP/1.0 200 OK\r\n"
+                "Content-Type: text/plain; version=0.0.4\r\n"
+                "Content-Length: " << body.size() << "\r\n"
+                "\r\n";
+            os.flush();
+            socket->write(body);
+
+        } else if (tokens.at(0) == "GET" && !mAvatarData.isEmpty() && (tokens.at(1) == "/" || tokens.at(1) == "/dukto/avatar" || tokens.at(1).startsWith("/dukto/avatar?"))) {
 
             QTextStream os(socket);
             os.setAutoDetectUnicode(true);
@@ -23,6 +23,8 @@
 
 // FROM: http://doc.qt.nokia.com/solutions/4/qtservice/qtservice-example-server.html
 
+class TransferMetrics;
+
 class MiniWebServer : public QTcpServer
 {
     Q_OBJECT
@@ -30,6 +32,8 @@ class MiniWebServer : public QTcpServer
 public:
     MiniWebServer(quint16 port);
     void restart();
+    // serves them at /metrics, the server listens then even without an avatar
+    void setMetrics(TransferMetrics *metrics);
 
 protected:
     void incomingConnection(qintptr handle) override;
@@ -40,6 +44,7 @@ private slots:
 private:
      quint16 port;
      QByteArray mAvatarData;
+     TransferMetrics *mMetrics = nullptr;
 
 };
 
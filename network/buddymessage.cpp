@@ -18,6 +18,8 @@
 
 #include "buddymessage.h"
 
+#include <string.h>
+
 
 BuddyMessage BuddyMessage::parse(const QByteArray &data) {
     if (data.isEmpty()) {
@@ -44,6 +46,14 @@ BuddyMessage BuddyMessage::parse(const QByteArray &data) {
             signature = QString::fromUtf8(data.mid(1 + sizeof(quint16)));
             break;
         }
+        case MSG_FEATURES: {
+            if (data.size() < static_cast<int>(1 + sizeof(qint64))) {
+                return BuddyMessage(MSG_INVALID, 0, QString());
+            }
+            qint64 features;
+            memcpy(&features, data.constData() + 1, sizeof(features));
+            return featureList(features);
+        }
     }
     if ((type != MSG_GOODBYE && signature.isEmpty())
             || ((type == MSG_HELLO_PORT_BROADCAST || type == MSG_HELLO_PORT_UNICAST) && port == 0)) {
@@ -52,9 +62,19 @@ BuddyMessage BuddyMessage::parse(const QByteArray &data) {
     return BuddyMessage(static_cast<MSG_TYPE>(type), port, signature);
 }
 
+BuddyMessage BuddyMessage::featureList(qint64 features) {
+    BuddyMessage message(MSG_FEATURES, 0, QString());
+    message.features = features;
+    return message;
+}
+
 QByteArray BuddyMessage::serialize() const {
     QByteArray bytes;
     bytes.append(static_cast<char>(type));
+    if (type == MSG_FEATURES) {
+        bytes.append(reinterpret_cast<const char *>(&features), sizeof(features));
+        return bytes;
+    }
     if (type == MSG_HELLO_PORT_BROADCAST || type == MSG_HELLO_PORT_UNICAST) {
         bytes.append(reinterpret_cast<const char *>(&port), sizeof(quint16));
     }
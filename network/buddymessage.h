@@ -32,22 +32,27 @@ public:
         MSG_GOODBYE              = 0x03,
         MSG_HELLO_PORT_BROADCAST = 0x04,
         MSG_HELLO_PORT_UNICAST   = 0x05,
+        // the protocol extensions a buddy accepts when receiving, see transferoptions.h.
+        // sent along with every hello, older clients drop it as an unknown type
+        MSG_FEATURES             = 0x06,
 
-        MSG_MAX = MSG_HELLO_PORT_UNICAST
+        MSG_MAX = MSG_FEATURES
     };
 
     BuddyMessage(MSG_TYPE type, quint16 port, const QString &signature) : type(type), port(port), signature(signature) {}
-    BuddyMessage(const BuddyMessage &another) : type(another.type), port(another.type), signature(another.signature) {}
+    BuddyMessage(const BuddyMessage &another) : type(another.type), port(another.type), signature(another.signature), features(another.features) {}
 
     inline bool isValid() const { return type != MSG_INVALID; }
     inline MSG_TYPE getType() const { return type; }
     inline quint16 getPort() const { return port; }
     inline const QString getSignature() const { return signature; }
+    inline qint64 getFeatures() const { return features; }
 
     static BuddyMessage parse(const QByteArray &data);
     QByteArray serialize() const;
 
     inline static BuddyMessage goodbye() { return BuddyMessage(MSG_GOODBYE, 0, QString()); }
+    static BuddyMessage featureList(qint64 features);
     inline static MSG_TYPE broadcastType(bool withPort) { return withPort ? MSG_HELLO_BROADCAST : MSG_HELLO_PORT_BROADCAST; }
     inline static MSG_TYPE unicastType(bool withPort) { return withPort ? MSG_HELLO_UNICAST : MSG_HELLO_PORT_UNICAST; }
 
@@ -55,6 +60,7 @@ private:
     MSG_TYPE type;
     quint16 port;
     QString signature;
+    qint64 features = 0;
 };
 
 #endif // BUDDYMESSAGE_H
@@ -0,0 +1,136 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2021 Xu Zhen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+#include "checksum.h"
+#include <QtEndian>
+#include <string.h>
+
+static const quint64 PRIME1 = 0x9E3779B185EBCA87ULL;
+static const quint64 PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+static const quint64 PRIME3 = 0x165667B19E3779F9ULL;
+static const quint64 PRIME4 = 0x85EBCA77C2B2AE63ULL;
+static const quint64 PRIME5 = 0x27D4EB2F165667C5ULL;
+
+static inline quint64 rotl(quint64 x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline quint64 read64(const unsigned char *p) {
+    return qFromLittleEndian<quint64>(p);
+}
+
+static inline quint64 read32(const unsigned char *p) {
+    return qFromLittleEndian<quint32>(p);
+}
+
+static inline quint64 mixRound(quint64 acc, quint64 input) {
+    acc += input * PRIME2;
+    acc = rotl(acc, 31);
+    return acc * PRIME1;
+}
+
+static inline quint64 mergeRound(quint64 acc, quint64 value) {
+    acc ^= mixRound(0, value);
+    return acc * PRIME1 + PRIME4;
+}
+
+Checksum::Checksum(quint64 seed) {
+    reset(seed);
+}
+
+void Checksum::reset(quint64 seed) {
+    this->seed = seed;
+    lanes[0] = seed + PRIME1 + PRIME2;
+    lanes[1] = seed + PRIME2;
+    lanes[2] = seed;
+    lanes[3] = seed - PRIME1;
+    totalSize = 0;
+    stripeSize = 0;
+}
+
+void Checksum::update(const char *data, qint64 size) {
+    const unsigned char *p = reinterpret_cast<const unsigned char *>(data);
+    const unsigned char *end = p + size;
+    totalSize += size;
+    if (stripeSize + size < 32) {
+        memcpy(stripe + stripeSize, p, size);
+        stripeSize += static_cast<int>(size);
+        return;
+    }
+    if (stripeSize > 0) {
+        // complete the stripe left from the previous call
+        int fill = 32 - stripeSize;
+        memcpy(stripe + stripeSize, p, fill);
+        p += fill;
+        for (int i = 0; i < 4; i++) {
+            lanes[i] = mixRound(lanes[i], read64(stripe + i * 8));
+        }
+        stripeSize = 0;
+    }
+    quint64 v1 = lanes[0], v2 = lanes[1], v3 = lanes[2], v4 = lanes[3];
+    while (end - p >= 32) {
+        v1 = mixRound(v1, read64(p));
+        v2 = mixRound(v2, read64(p + 8));
+        v3 = mixRound(v3, read64(p + 16));
+        v4 = mixRound(v4, read64(p + 24));
+        p += 32;
+    }
+    lanes[0] = v1;
+    lanes[1] = v2;
+    lanes[2] = v3;
+    lanes[3] = v4;
+    stripeSize = static_cast<int>(end - p);
+    memcpy(stripe, p, stripeSize);
+}
+
+quint64 Checksum::digest() const {
+    quint64 h;
+    if (totalSize >= 32) {
+        h = rotl(lanes[0], 1) + rotl(lanes[1], 7) + rotl(lanes[2], 12) + rotl(lanes[3], 18);
+        for (int i = 0; i < 4; i++) {
+            h = mergeRound(h, lanes[i]);
+        }
+    } else {
+        h = seed + PRIME5;
+    }
+    h += totalSize;
+    const unsigned char *p = stripe;
+    const unsigned char *end = stripe + stripeSize;
+    while (end - p >= 8) {
+        h ^= mixRound(0, read64(p));
+        h = rotl(h, 27) * PRIME1 + PRIME4;
+        p += 8;
+    }
+    if (end - p >= 4) {
+        h ^= read32(p) * PRIME1;
+        h = rotl(h, 23) * PRIME2 + PRIME3;
+        p += 4;
+    }
+    while (p < end) {
+        h ^= *p * PRIME5;
+        h = rotl(h, 11) * PRIME1;
+        p++;
+    }
+    h ^= h >> 33;
+    h *= PRIME2;
+    h ^= h >> 29;
+    h *= PRIME3;
+    h ^= h >> 32;
+    return h;
+}
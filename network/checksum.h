@@ -0,0 +1,46 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2021 Xu Zhen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <QtGlobal>
+
+// Streaming XXH64, fed with the data of an element as it passes through.
+// The hash is computed 32 bytes at a time in four independent lanes, which
+// keeps it well above the speed of the network
+class Checksum
+{
+public:
+    explicit Checksum(quint64 seed = 0);
+
+    void reset(quint64 seed = 0);
+    void update(const char *data, qint64 size);
+    quint64 digest() const;
+
+private:
+    quint64 seed;
+    quint64 lanes[4];
+    quint64 totalSize;
+    // the tail which does not fill a 32 byte stripe yet
+    unsigned char stripe[32];
+    int stripeSize;
+};
+
+#endif // CHECKSUM_H
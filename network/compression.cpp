@@ -0,0 +1,127 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2021 Xu Zhen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "compression.h"
+#include <string.h>
+
+#ifdef USE_LZ4
+// LZ4 compresses at several hundred MB/s on one core, so even a gigabit
+// link is slower than the compressor; zlib level 1 is not
+#include <lz4.h>
+#endif
+
+// signatures of formats which are compressed already
+static const struct {
+    int offset;
+    const char *magic;
+    int size;
+} compressedFormats[] = {
+    { 0, "PK\x03\x04", 4 },                 // zip, jar, docx, apk...
+    { 0, "\x1f\x8b", 2 },                   // gzip
+    { 0, "BZh", 3 },                        // bzip2
+    { 0, "\xfd" "7zXZ\x00", 6 },            // xz
+    { 0, "7z\xbc\xaf\x27\x1c", 6 },         // 7z
+    { 0, "\x28\xb5\x2f\xfd", 4 },           // zstd
+    { 0, "\x04\x22\x4d\x18", 4 },           // lz4
+    { 0, "Rar!\x1a\x07", 6 },               // rar
+    { 0, "\x89PNG", 4 },                    // png
+    { 0, "\xff\xd8\xff", 3 },               // jpeg
+    { 0, "GIF8", 4 },                       // gif
+    { 4, "ftyp", 4 },                       // mp4, mov, heic...
+    { 0, "\x1a\x45\xdf\xa3", 4 },           // mkv, webm
+    { 0, "OggS", 4 },                       // ogg
+    { 0, "fLaC", 4 },                       // flac
+    { 0, "ID3", 3 },                        // mp3
+};
+
+bool Compression::worthCompressing(const QByteArray &sample) {
+    for (const auto &format : compressedFormats) {
+        if (sample.size() >= format.offset + format.size && memcmp(sample.constData() + format.offset, format.magic, format.size) == 0) {
+            return false;
+        }
+    }
+    // anything else is judged by the ratio of a sample
+    return compress(sample).size() < sample.size() * 9 / 10;
+}
+
+// Returns the LZ4 block of raw, or an empty array if it does not fit in the raw size
+QByteArray Compression::compress(const QByteArray &raw) {
+#ifdef USE_LZ4
+    QByteArray data(raw.size(), Qt::Uninitialized);
+    int size = LZ4_compress_default(raw.constData(), data.data(), raw.size(), data.size());
+    data.resize(size);
+    return data;
+#else
+    Q_UNUSED(raw)
+    return QByteArray();
+#endif
+}
+
+/*
+ * raw size (qint32)
+ * stored size (qint32), negative if the data is stored uncompressed
+ * data, an LZ4 block
+ */
+QByteArray Compression::encodeFrame(const QByteArray &raw, bool &tryCompress) {
+    qint32 header[2] = { raw.size(), -raw.size() };
+    QByteArray data;
+    if (tryCompress) {
+        data = compress(raw);
+        if (data.isEmpty() == false && data.size() < raw.size() * 9 / 10) {
+            header[1] = data.size();
+        } else {
+            // the file turns out to be incompressible
+            tryCompress = false;
+        }
+    }
+    QByteArray frame(reinterpret_cast<char *>(header), sizeof(header));
+    frame.append(header[1] < 0 ? raw : data);
+    return frame;
+}
+
+qint64 Compression::frameSize(const char *header) {
+    qint32 h[2];
+    memcpy(h, header, sizeof(h));
+    if (h[0] < 0 || h[0] > FRAME_SIZE || h[1] == 0 || h[1] < -FRAME_SIZE || h[1] > FRAME_SIZE) {
+        return -1;
+    }
+    if (h[1] < 0 && h[1] != -h[0]) {
+        return -1;
+    }
+    return HEADER_SIZE + (h[1] < 0 ? -h[1] : h[1]);
+}
+
+// The header has been checked by frameSize(), so h[0] is at most FRAME_SIZE.
+// Nothing is allocated from the sizes inside the compressed data
+bool Compression::decodeFrame(const QByteArray &frame, QByteArray &raw) {
+    qint32 h[2];
+    memcpy(h, frame.constData(), sizeof(h));
+    if (h[1] < 0) {
+        raw = frame.mid(HEADER_SIZE);
+        return raw.size() == h[0];
+    }
+#ifdef USE_LZ4
+    // decompressed into a buffer of the announced size, more data than that is an error
+    raw.resize(h[0]);
+    int size = LZ4_decompress_safe(frame.constData() + HEADER_SIZE, raw.data(), frame.size() - HEADER_SIZE, raw.size());
+    return size == h[0];
+#else
+    // not offered without LZ4, see TransferOptions::supportedFeatures()
+    return false;
+#endif
+}
@@ -0,0 +1,47 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2021 Xu Zhen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <QByteArray>
+
+// Frames of compressed element data, see FEATURE_COMPRESSION in transferoptions.h
+class Compression
+{
+public:
+    // raw bytes carried by one frame at most
+    static const int FRAME_SIZE = 1024 * 1024;
+    static const int HEADER_SIZE = 8;
+
+    // Decides from the first bytes of a file whether compressing it pays off
+    static bool worthCompressing(const QByteArray &sample);
+
+    // Packs raw data into a frame. Stores it uncompressed if compressing does
+    // not help, and clears tryCompress so the rest of the file is not tried again
+    static QByteArray encodeFrame(const QByteArray &raw, bool &tryCompress);
+
+    // Returns the size of a frame from its header, or -1 for an invalid header
+    static qint64 frameSize(const char *header);
+    static bool decodeFrame(const QByteArray &frame, QByteArray &raw);
+
+private:
+    static QByteArray compress(const QByteArray &raw);
+};
+
+#endif // COMPRESSION_H
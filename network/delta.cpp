@@ -0,0 +1,268 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2021 Xu Zhen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+#include "delta.h"
+#include "checksum.h"
+#include <algorithm>
+#include <string.h>
+
+// literal runs are cut at this size, so that the receiver can write them as they come
+static const qint64 MAX_LITERAL_SIZE = 1024 * 1024;
+// a block is 12 bytes in a signature
+static const qint64 BLOCK_ENTRY_SIZE = sizeof(quint32) + sizeof(quint64);
+
+static quint64 blockHash(const char *data, qint64 size) {
+    Checksum checksum;
+    checksum.update(data, size);
+    return checksum.digest();
+}
+
+// About the square root of the file size, which keeps both the signature and
+// the literal runs around a changed byte small
+qint64 DeltaSignature::blockSizeFor(qint64 fileSize) {
+    qint64 blockSize = 4096;
+    while (blockSize < 1024 * 1024 && blockSize * blockSize < fileSize) {
+        blockSize *= 2;
+    }
+    return blockSize;
+}
+
+quint32 DeltaSignature::weakChecksum(const char *data, qint64 size) {
+    const unsigned char *p = reinterpret_cast<const unsigned char *>(data);
+    quint32 a = 0;
+    quint32 b = 0;
+    for (qint64 i = 0; i < size; i++) {
+        a += p[i];
+        b += a;
+    }
+    return (a & 0xffff) | ((b & 0xffff) << 16);
+}
+
+QByteArray DeltaSignature::encode() const {
+    qint64 header[3] = { blockSize, fileSize, weak.size() };
+    QByteArray bytes(reinterpret_cast<char *>(header), sizeof(header));
+    bytes.reserve(static_cast<int>(sizeof(header) + weak.size() * BLOCK_ENTRY_SIZE));
+    for (int i = 0; i < weak.size(); i++) {
+        quint32 w = weak.at(i);
+        quint64 s = strong.at(i);
+        bytes.append(reinterpret_cast<char *>(&w), sizeof(w));
+        bytes.append(reinterpret_cast<char *>(&s), sizeof(s));
+    }
+    return bytes;
+}
+
+bool DeltaSignature::decode(const char *data, qint64 available, qint64 &size) {
+    qint64 header[3];
+    if (available < static_cast<qint64>(sizeof(header))) {
+        return false;
+    }
+    memcpy(header, data, sizeof(header));
+    if (header[0] < 4096 || header[0] > 1024 * 1024 || header[1] <= 0 || header[2] != (header[1] + header[0] - 1) / header[0]
+            || header[2] > (available - static_cast<qint64>(sizeof(header))) / BLOCK_ENTRY_SIZE) {
+        return false;
+    }
+    size = sizeof(header) + header[2] * BLOCK_ENTRY_SIZE;
+    if (available < size) {
+        return false;
+    }
+    blockSize = header[0];
+    fileSize = header[1];
+    weak.resize(static_cast<int>(header[2]));
+    strong.resize(static_cast<int>(header[2]));
+    const char *p = data + sizeof(header);
+    for (int i = 0; i < weak.size(); i++) {
+        memcpy(&weak[i], p, sizeof(quint32));
+        memcpy(&strong[i], p + sizeof(quint32), sizeof(quint64));
+        p += BLOCK_ENTRY_SIZE;
+    }
+    return true;
+}
+
+DeltaSignatureBuilder::DeltaSignatureBuilder(qint64 fileSize) {
+    signature.blockSize = DeltaSignature::blockSizeFor(fileSize);
+    signature.fileSize = 0;
+}
+
+void DeltaSignatureBuilder::addBlock(const char *data, qint64 size) {
+    signature.weak.append(DeltaSignature::weakChecksum(data, size));
+    signature.strong.append(blockHash(data, size));
+    signature.fileSize += size;
+}
+
+void DeltaSignatureBuilder::update(const char *data, qint64 size) {
+    const qint64 blockSize = signature.blockSize;
+    if (pending.isEmpty() == false) {
+        qint64 fill = std::min(blockSize - pending.size(), size);
+        pending.append(data, static_cast<int>(fill));
+        data += fill;
+        size -= fill;
+        if (pending.size() < blockSize) {
+            return;
+        }
+        addBlock(pending.constData(), pending.size());
+        pending.clear();
+    }
+    while (size >= blockSize) {
+        addBlock(data, blockSize);
+        data += blockSize;
+        size -= blockSize;
+    }
+    pending.append(data, static_cast<int>(size));
+}
+
+DeltaSignature DeltaSignatureBuilder::finish() {
+    if (pending.isEmpty() == false) {
+        addBlock(pending.constData(), pending.size());
+        pending.clear();
+    }
+    return signature;
+}
+
+DeltaEncoder::DeltaEncoder(const DeltaSignature &signature) : signature(signature), filter(65536, false) {
+    // a short last block can only match at the end of the file, see finish()
+    for (int i = 0; i < signature.weak.size(); i++) {
+        if (i < signature.weak.size() - 1 || signature.fileSize % signature.blockSize == 0) {
+            blocks.insert(signature.weak.at(i), i);
+            filter[signature.weak.at(i) & 0xffff] = true;
+        }
+    }
+}
+
+// Returns the block with the content of window, the one after the last copied block if several do
+int DeltaEncoder::findBlock(const char *window, quint32 weak) const {
+    if (filter[weak & 0xffff] == false) {
+        return -1;
+    }
+    int found = -1;
+    bool hashed = false;
+    quint64 hash = 0;
+    for (auto it = blocks.constFind(weak); it != blocks.constEnd() && it.key() == weak; ++it) {
+        if (hashed == false) {
+            hash = blockHash(window, signature.blockSize);
+            hashed = true;
+        }
+        if (signature.strong.at(it.value()) == hash) {
+            found = it.value();
+            if (copyFirst >= 0 && found == copyFirst + copyCount) {
+                break;
+            }
+        }
+    }
+    return found;
+}
+
+QByteArray DeltaEncoder::encode(const QByteArray &data) {
+    if (start > 0) {
+        buffer.remove(0, static_cast<int>(start));
+        pos -= start;
+        start = 0;
+    }
+    buffer.append(data);
+    QByteArray out;
+    const qint64 blockSize = signature.blockSize;
+    const unsigned char *p = reinterpret_cast<const unsigned char *>(buffer.constData());
+    while (pos + blockSize <= buffer.size()) {
+        if (rolling == false) {
+            quint32 weak = DeltaSignature::weakChecksum(buffer.constData() + pos, blockSize);
+            sumA = weak & 0xffff;
+            sumB = weak >> 16;
+            rolling = true;
+        }
+        int block = findBlock(buffer.constData() + pos, sumA | (sumB << 16));
+        if (block >= 0) {
+            writeLiteral(out, pos);
+            writeCopy(out, block);
+            pos += blockSize;
+            start = pos;
+            rolling = false;
+            continue;
+        }
+        if (pos + blockSize == buffer.size()) {
+            // the next byte is needed to move the window
+            break;
+        }
+        // move the window by one byte
+        quint32 outByte = p[pos];
+        quint32 inByte = p[pos + blockSize];
+        sumA = (sumA - outByte + inByte) & 0xffff;
+        sumB = (sumB - static_cast<quint32>(blockSize) * outByte + sumA) & 0xffff;
+        pos++;
+        if (pos - start >= MAX_LITERAL_SIZE) {
+            writeLiteral(out, pos);
+        }
+    }
+    return out;
+}
+
+QByteArray DeltaEncoder::finish() {
+    QByteArray out;
+    const qint64 blockSize = signature.blockSize;
+    const int count = signature.weak.size();
+    qint64 tail = buffer.size() - pos;
+    // the end of the file may still be the short last block
+    if (count > 0 && tail > 0 && tail < blockSize && tail == signature.fileSize - (count - 1) * blockSize) {
+        const char *window = buffer.constData() + pos;
+        if (DeltaSignature::weakChecksum(window, tail) == signature.weak.last() && blockHash(window, tail) == signature.strong.last()) {
+            writeLiteral(out, pos);
+            writeCopy(out, count - 1);
+            pos = buffer.size();
+            start = pos;
+        }
+    }
+    writeLiteral(out, buffer.size());
+    flushCopy(out);
+    qint64 end = 0;
+    out.append(reinterpret_cast<char *>(&end), sizeof(end));
+    buffer.clear();
+    start = 0;
+    pos = 0;
+    rolling = false;
+    return out;
+}
+
+void DeltaEncoder::writeLiteral(QByteArray &out, qint64 end) {
+    if (end <= start) {
+        return;
+    }
+    flushCopy(out);
+    qint64 size = end - start;
+    out.append(reinterpret_cast<char *>(&size), sizeof(size));
+    out.append(buffer.constData() + start, static_cast<int>(size));
+    start = end;
+}
+
+void DeltaEncoder::writeCopy(QByteArray &out, qint64 block) {
+    if (copyFirst >= 0 && block == copyFirst + copyCount) {
+        copyCount++;
+        return;
+    }
+    flushCopy(out);
+    copyFirst = block;
+    copyCount = 1;
+}
+
+void DeltaEncoder::flushCopy(QByteArray &out) {
+    if (copyFirst < 0) {
+        return;
+    }
+    qint64 copy[2] = { -1 - copyFirst, copyCount };
+    out.append(reinterpret_cast<char *>(copy), sizeof(copy));
+    copyFirst = -1;
+    copyCount = 0;
+}
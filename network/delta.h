@@ -0,0 +1,107 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2021 Xu Zhen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+#ifndef DELTA_H
+#define DELTA_H
+
+#include <QByteArray>
+#include <QVector>
+#include <QMultiHash>
+#include <vector>
+
+/*
+ * rsync style delta encoding of a file against an older copy held by the
+ * receiver, see TransferOptions::FEATURE_DELTA
+ *
+ * The receiver describes its copy with a signature, a weak rolling checksum
+ * and an XXH64 hash of every block. The sender looks for these blocks at any
+ * offset of its file, and sends a sequence of instructions, all qint64
+ *   n > 0    literal, n bytes of data follow
+ *   n < 0    copy, followed by a block count: blocks -n - 1 and following
+ *            of the old copy, the last one may be shorter
+ *   0        end of the element
+ */
+class DeltaSignature
+{
+public:
+    static qint64 blockSizeFor(qint64 fileSize);
+    static quint32 weakChecksum(const char *data, qint64 size);
+
+    // serialized as block size, file size, block count, then the weak checksum (quint32)
+    // and the hash (quint64) of every block
+    QByteArray encode() const;
+    // returns false if data is not a valid signature, size is what it takes of data
+    bool decode(const char *data, qint64 available, qint64 &size);
+
+    qint64 blockSize = 0;
+    qint64 fileSize = 0;
+    QVector<quint32> weak;
+    QVector<quint64> strong;
+};
+
+// Builds the signature of a file, fed in any pieces
+class DeltaSignatureBuilder
+{
+public:
+    explicit DeltaSignatureBuilder(qint64 fileSize);
+
+    void update(const char *data, qint64 size);
+    DeltaSignature finish();
+
+private:
+    void addBlock(const char *data, qint64 size);
+
+    DeltaSignature signature;
+    QByteArray pending;
+};
+
+// Turns a file, fed in order in any pieces, into instructions against a signature
+class DeltaEncoder
+{
+public:
+    explicit DeltaEncoder(const DeltaSignature &signature);
+
+    QByteArray encode(const QByteArray &data);
+    // the instructions for the rest of the file and the end of the element
+    QByteArray finish();
+
+private:
+    int findBlock(const char *window, quint32 weak) const;
+    void writeLiteral(QByteArray &out, qint64 end);
+    void writeCopy(QByteArray &out, qint64 block);
+    void flushCopy(QByteArray &out);
+
+    DeltaSignature signature;
+    // full blocks by weak checksum, with a filter on its low 16 bits in front
+    QMultiHash<quint32, int> blocks;
+    std::vector<bool> filter;
+
+    // data not sent yet starts at start, the block sized window at pos
+    QByteArray buffer;
+    qint64 start = 0;
+    qint64 pos = 0;
+    bool rolling = false;
+    quint32 sumA = 0;
+    quint32 sumB = 0;
+    // consecutive blocks are sent as one copy
+    qint64 copyFirst = -1;
+    qint64 copyCount = 0;
+};
+
+#endif // DELTA_H
@@ -0,0 +1,193 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2021 Xu Zhen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+#include "diskwriter.h"
+#include <QFile>
+
+#if defined(Q_OS_LINUX) && !defined(Q_OS_ANDROID)
+#include <fcntl.h>
+#endif
+
+// files waiting in the queue are open, keep well below the descriptor limit
+static const int MAX_QUEUED_FILES = 64;
+
+DiskWriter::DiskWriter(qint64 maxQueued, QObject *parent) :
+    QThread(parent), maxQueued(maxQueued) {
+}
+
+DiskWriter::~DiskWriter() {
+    // what has been received is still written
+    mutex.lock();
+    stopping = true;
+    jobAdded.wakeAll();
+    mutex.unlock();
+    wait();
+}
+
+void DiskWriter::beginFile(QFile *file, qint64 size, bool extend) {
+    enqueue({JOB_BEGIN, file, QByteArray(), 0, size, extend, nullptr});
+}
+
+bool DiskWriter::write(QFile *file, const QByteArray &data) {
+    return enqueue({JOB_WRITE, file, data, 0, data.size(), false, nullptr});
+}
+
+bool DiskWriter::write(QFile *file, const QByteArray &buffer, int offset, int size) {
+    return enqueue({JOB_WRITE, file, buffer, offset, size, false, nullptr});
+}
+
+bool DiskWriter::closeFile(QFile *file) {
+    return enqueue({JOB_CLOSE, file, QByteArray(), 0, 0, false, nullptr});
+}
+
+void DiskWriter::addTask(const std::function<QString()> &task) {
+    enqueue({JOB_TASK, nullptr, QByteArray(), 0, 0, false, task});
+}
+
+void DiskWriter::addMarker() {
+    enqueue({JOB_MARKER, nullptr, QByteArray(), 0, 0, false, nullptr});
+}
+
+bool DiskWriter::enqueue(const Job &job) {
+    QMutexLocker locker(&mutex);
+    if (isRunning() == false) {
+        start();
+    }
+    jobs.enqueue(job);
+    if (job.type == JOB_BEGIN) {
+        queuedFiles++;
+    }
+    if (job.type == JOB_WRITE) {
+        queuedBytes += job.size;
+    }
+    jobAdded.wakeOne();
+    return errorMessage.isEmpty();
+}
+
+bool DiskWriter::isFull() {
+    QMutexLocker locker(&mutex);
+    if (queuedBytes < maxQueued && queuedFiles < MAX_QUEUED_FILES) {
+        return false;
+    }
+    waitingForDrain = true;
+    return true;
+}
+
+bool DiskWriter::notifyNextJob() {
+    QMutexLocker locker(&mutex);
+    if (jobs.isEmpty() && busy == false) {
+        return false;
+    }
+    waitingForJob = true;
+    return true;
+}
+
+QString DiskWriter::error() {
+    QMutexLocker locker(&mutex);
+    return errorMessage;
+}
+
+void DiskWriter::run() {
+    QMutexLocker locker(&mutex);
+    while (true) {
+        while (jobs.isEmpty() && stopping == false) {
+            jobAdded.wait(&mutex);
+        }
+        if (jobs.isEmpty()) {
+            break;
+        }
+        Job job = jobs.dequeue();
+        busy = true;
+        bool failed = (errorMessage.isEmpty() == false);
+        locker.unlock();
+
+        QString message;
+        if (failed && job.type != JOB_CLOSE && job.type != JOB_MARKER) {
+            // the session is being terminated, drop the data
+        } else if (job.type == JOB_TASK) {
+            message = job.task();
+        } else if (process(job) == false) {
+            message = QStringLiteral("Failed to write to %1").arg(job.file->fileName());
+        }
+        if (job.type == JOB_CLOSE) {
+            delete job.file;
+        }
+        // the caller may take the buffer again once notified
+        job.data = QByteArray();
+
+        locker.relock();
+        busy = false;
+        if (job.type == JOB_WRITE) {
+            queuedBytes -= job.size;
+        }
+        if (job.type == JOB_CLOSE) {
+            queuedFiles--;
+        }
+        bool notify = false;
+        if (message.isEmpty() == false && errorMessage.isEmpty()) {
+            errorMessage = message;
+            notify = true;
+        }
+        if (waitingForDrain && queuedBytes <= maxQueued / 2 && queuedFiles < MAX_QUEUED_FILES / 2) {
+            notify = true;
+        }
+        if (waitingForJob) {
+            notify = true;
+        }
+        if (notify) {
+            waitingForDrain = false;
+            waitingForJob = false;
+            emit drained();
+        }
+        if (job.type == JOB_MARKER) {
+            emit markerReached();
+        }
+    }
+}
+
+bool DiskWriter::process(Job &job) {
+    QFile *file = job.file;
+    switch (job.type) {
+        case JOB_BEGIN:
+#if defined(Q_OS_LINUX) && !defined(Q_OS_ANDROID)
+            if (job.size > 0) {
+                // reserve the blocks at once, it only helps, so failures are ignored
+                fallocate(file->handle(), job.extend ? 0 : FALLOC_FL_KEEP_SIZE, 0, job.size);
+            }
+#endif
+            if (job.extend) {
+                // other handles write at offsets beyond the current end
+                return file->resize(job.size);
+            }
+            return true;
+        case JOB_WRITE:
+            if (file->write(job.data.constData() + job.offset, job.size) < job.size) {
+                return false;
+            }
+            // nothing is left in the QFile buffer, so a checkpoint can be taken once the queue is empty
+            return file->flush();
+        case JOB_CLOSE:
+            file->close();
+            return file->error() == QFile::NoError;
+        case JOB_TASK:
+        case JOB_MARKER:
+            return true;
+    }
+    return true;
+}
@@ -0,0 +1,109 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2021 Xu Zhen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+#ifndef DISKWRITER_H
+#define DISKWRITER_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QQueue>
+#include <functional>
+
+class QFile;
+
+// Writes received files on a thread of its own, so that a slow disk does not
+// stop the socket from being read. Files are opened by the caller and handed
+// over, then their data and their closing are queued in order.
+class DiskWriter : public QThread
+{
+    Q_OBJECT
+public:
+    explicit DiskWriter(qint64 maxQueued, QObject *parent = nullptr);
+    ~DiskWriter();
+
+    // takes the opened file, its space is reserved for size bytes and
+    // it is extended to size if extend is true
+    void beginFile(QFile *file, qint64 size, bool extend);
+    // return false once writing has failed, see error()
+    bool write(QFile *file, const QByteArray &data);
+    // writes size bytes of buffer from offset on, the buffer is shared, not copied
+    bool write(QFile *file, const QByteArray &buffer, int offset, int size);
+    bool closeFile(QFile *file);
+    // runs task on the writer thread after what is queued before it, it is
+    // dropped like the data once writing has failed; the task returns an
+    // error message, or an empty string if it succeeded
+    void addTask(const std::function<QString()> &task);
+    // markerReached() is emitted once what is queued before the marker is written
+    void addMarker();
+
+    // the caller should wait for drained() before writing more
+    bool isFull();
+    // drained() is also emitted once the next job is done and its data
+    // released, returns false if nothing is queued
+    bool notifyNextJob();
+    QString error();
+
+signals:
+    // emitted from the writer thread when half of the queue is written, or writing has failed
+    void drained();
+    // emitted from the writer thread, error() tells whether writing has failed
+    void markerReached();
+
+protected:
+    void run() override;
+
+private:
+    enum JOB_TYPE {
+        JOB_BEGIN,
+        JOB_WRITE,
+        JOB_CLOSE,
+        JOB_TASK,
+        JOB_MARKER,
+    };
+    struct Job {
+        JOB_TYPE type;
+        QFile *file;
+        QByteArray data;
+        // the bytes written start at offset in data
+        int offset;
+        qint64 size;
+        bool extend;
+        std::function<QString()> task;
+    };
+
+    bool enqueue(const Job &job);
+    bool process(Job &job);
+
+    QMutex mutex;
+    QWaitCondition jobAdded;
+    QQueue<Job> jobs;
+    // bytes and open files in the queue
+    qint64 queuedBytes = 0;
+    int queuedFiles = 0;
+    qint64 maxQueued;
+    bool waitingForDrain = false;
+    bool waitingForJob = false;
+    // a job is taken out of the queue
+    bool busy = false;
+    bool stopping = false;
+    QString errorMessage;
+};
+
+#endif // DISKWRITER_H
@@ -21,15 +21,33 @@
 #ifndef Q_OS_ANDROID
 #include <QFile>
 #include <QFileInfo>
+#include <QDateTime>
 #include <QDir>
+#include <algorithm>
 #endif
 
 #ifdef Q_OS_ANDROID
 FileData::FileData(qint64 size, const QString &relPath, const QJniObject &fullPath)
+ : size(size), name(relPath), path(fullPath) {
+}
 #else
-FileData::FileData(qint64 size, const QString &relPath, const QString &fullPath)
+FileData::FileData(qint64 size, const QString &relPath, const QString &fullPath, qint64 modified)
+ : size(size), name(relPath), modified(modified), path(fullPath) {
+}
 #endif
- : size(size), name(relPath), path(fullPath) {
+
+FileData::FileData(const FileData &other) : size(other.size), name(other.name), modified(other.modified), path(other.path) {
+}
+
+FileData &FileData::operator=(const FileData &other) {
+    if (this != &other) {
+        close();
+        size = other.size;
+        name = other.name;
+        modified = other.modified;
+        path = other.path;
+    }
+    return *this;
 }
 
 FileData::~FileData() {
@@ -40,6 +58,10 @@ qint64 FileData::getSize() const {
     return size;
 }
 
+qint64 FileData::getModified() const {
+    return modified;
+}
+
 QString FileData::getName() const {
     return name;
 }
@@ -86,7 +108,22 @@ QByteArray FileData::read(qint64 size) {
     readBytes += d.size();
     return d;
 #else
-    return reader->read(size);
+    if (readBuffer.isDetached() == false) {
+        // the caller still holds the previous data, do not copy it over
+        readBuffer = QByteArray();
+    }
+    // the size is kept as capacity between reads, only the data is handed out
+    if (readBuffer.capacity() < size) {
+        readBuffer.reserve(static_cast<int>(size));
+    }
+    readBuffer.resize(static_cast<int>(size));
+    qint64 n = reader->read(readBuffer.data(), size);
+    if (n <= 0) {
+        readBuffer.resize(0);
+        return QByteArray();
+    }
+    readBuffer.resize(static_cast<int>(n));
+    return readBuffer;
 #endif
 }
 
@@ -106,9 +143,35 @@ void FileData::close() {
         reader->close();
         delete reader;
         reader = nullptr;
+#ifndef Q_OS_ANDROID
+        readBuffer.clear();
+#endif
     }
 }
 
+#ifndef Q_OS_ANDROID
+int FileData::handle() const {
+    if (reader == nullptr) {
+        return -1;
+    }
+    return reader->handle();
+}
+
+qint64 FileData::pos() const {
+    if (reader == nullptr) {
+        return 0;
+    }
+    return reader->pos();
+}
+
+bool FileData::seek(qint64 pos) {
+    if (reader == nullptr) {
+        return false;
+    }
+    return reader->seek(pos);
+}
+#endif
+
 QList<FileData> FileData::generateList(const QStringList &paths, qint64 &totalSize, QString &error) {
     QList<FileData> list;
     totalSize = 0;
@@ -181,7 +244,7 @@ bool FileData::processDir(const QString &relPath, const QString &fullPath, QList
             }
         }
     } else {
-        list.append(FileData(info.size(), relPath, fullPath));
+        list.append(FileData(info.size(), relPath, fullPath, info.lastModified().toMSecsSinceEpoch()));
         totalSize += info.size();
     }
     return true;
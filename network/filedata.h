@@ -32,10 +32,14 @@ class QFile;
 class FileData
 {
 public:
+    // a copy does not share the reader, it starts closed
+    FileData(const FileData &other);
+    FileData &operator=(const FileData &other);
     ~FileData();
 
     static QList<FileData> generateList(const QStringList &paths, qint64 &totalSize, QString &error);
     qint64 getSize() const;
+    qint64 getModified() const;
     QString getName() const;
     QString getPath() const;
     bool isDir() const;
@@ -43,13 +47,24 @@ public:
     void setName(const QString &newName);
 
     bool open();
+    // the data is read into one buffer kept by the FileData, it is only
+    // reallocated if the caller still holds the data of the previous read
     QByteArray read(qint64 size);
     bool eof();
     void close();
+#ifndef Q_OS_ANDROID
+    int handle() const;
+    qint64 pos() const;
+    bool seek(qint64 pos);
+#endif
 
 private:
+    friend class FileScanner;
+
     qint64 size;
     QString name;
+    // milliseconds since epoch, 0 if unknown
+    qint64 modified = 0;
 
 #ifdef Q_OS_ANDROID
     FileData(qint64 size, const QString &relPath, const QJniObject &fullPath);
@@ -58,10 +73,11 @@ private:
     QJniObject path;
     qint64 readBytes = 0;
 #else
-    FileData(qint64 size, const QString &relPath, const QString &fullPath);
+    FileData(qint64 size, const QString &relPath, const QString &fullPath, qint64 modified = 0);
     static bool processDir(const QString &relPath, const QString &fullPath, QList<FileData> &list, qint64 &totalSize, QString &error);
     QFile *reader = nullptr;
     QString path;
+    QByteArray readBuffer;
 #endif
 };
 
@@ -0,0 +1,115 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2021 Xu Zhen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+#include "filehasher.h"
+#include "checksum.h"
+#include "delta.h"
+#include <QFile>
+#include <QRunnable>
+
+class HashTask : public QRunnable
+{
+public:
+    HashTask(FileHasher *hasher, qint64 id, const QString &path, bool withSignature)
+        : hasher(hasher), id(id), path(path), withSignature(withSignature) {
+    }
+
+    void run() override {
+        QFile file(path);
+        if (hasher->cancelled.loadAcquire() == 0 && file.open(QFile::ReadOnly)) {
+            Checksum checksum;
+            DeltaSignatureBuilder builder(file.size());
+            QByteArray buffer(1024 * 1024, Qt::Uninitialized);
+            bool ok = true;
+            while (hasher->cancelled.loadAcquire() == 0) {
+                qint64 n = file.read(buffer.data(), buffer.size());
+                if (n < 0) {
+                    ok = false;
+                    break;
+                } else if (n == 0) {
+                    break;
+                }
+                checksum.update(buffer.constData(), n);
+                if (withSignature) {
+                    builder.update(buffer.constData(), n);
+                }
+            }
+            if (ok && hasher->cancelled.loadAcquire() == 0) {
+                hasher->addResult(id, checksum.digest(), withSignature ? builder.finish().encode() : QByteArray());
+            }
+        }
+        hasher->taskDone();
+    }
+
+private:
+    FileHasher *hasher;
+    qint64 id;
+    QString path;
+    bool withSignature;
+};
+
+FileHasher::FileHasher(QObject *parent) : QObject(parent) {
+    // the work is mostly waiting for the disk
+    pool.setMaxThreadCount(2);
+}
+
+FileHasher::~FileHasher() {
+    cancel();
+    pool.waitForDone();
+}
+
+void FileHasher::start(const QHash<qint64, QString> &files, const QSet<qint64> &signatureIds) {
+    if (files.isEmpty()) {
+        QMetaObject::invokeMethod(this, "finished", Qt::QueuedConnection);
+        return;
+    }
+    pendingTasks.storeRelease(files.size());
+    for (auto it = files.constBegin(); it != files.constEnd(); ++it) {
+        pool.start(new HashTask(this, it.key(), it.value(), signatureIds.contains(it.key())));
+    }
+}
+
+void FileHasher::cancel() {
+    cancelled.storeRelease(1);
+}
+
+QHash<qint64, quint64> FileHasher::results() {
+    QMutexLocker locker(&mutex);
+    return hashes;
+}
+
+QHash<qint64, QByteArray> FileHasher::signatures() {
+    QMutexLocker locker(&mutex);
+    return signatureData;
+}
+
+void FileHasher::addResult(qint64 id, quint64 hash, const QByteArray &signature) {
+    QMutexLocker locker(&mutex);
+    hashes.insert(id, hash);
+    if (signature.isEmpty() == false) {
+        signatureData.insert(id, signature);
+    }
+}
+
+void FileHasher::taskDone() {
+    if (pendingTasks.deref() == false) {
+        // the last file
+        emit finished();
+    }
+}
@@ -0,0 +1,67 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2021 Xu Zhen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+#ifndef FILEHASHER_H
+#define FILEHASHER_H
+
+#include <QObject>
+#include <QThreadPool>
+#include <QMutex>
+#include <QAtomicInt>
+#include <QHash>
+#include <QSet>
+
+// Hashes whole files with Checksum on a thread pool, so that both ends can
+// compare what they have without sending it. The delta signatures of some of
+// them may be built in the same pass
+class FileHasher : public QObject
+{
+    Q_OBJECT
+public:
+    explicit FileHasher(QObject *parent = nullptr);
+    ~FileHasher();
+
+    // the files by an id of the caller, which comes back with the results
+    void start(const QHash<qint64, QString> &files, const QSet<qint64> &signatureIds = QSet<qint64>());
+    void cancel();
+    // hashes by id, files which could not be read are left out
+    QHash<qint64, quint64> results();
+    // encoded DeltaSignature by id
+    QHash<qint64, QByteArray> signatures();
+
+signals:
+    // emitted from a hashing thread, or queued if there was nothing to hash
+    void finished();
+
+private:
+    friend class HashTask;
+
+    void addResult(qint64 id, quint64 hash, const QByteArray &signature);
+    void taskDone();
+
+    QThreadPool pool;
+    QAtomicInt pendingTasks;
+    QAtomicInt cancelled;
+
+    QMutex mutex;
+    QHash<qint64, quint64> hashes;
+    QHash<qint64, QByteArray> signatureData;
+};
+
+#endif // FILEHASHER_H
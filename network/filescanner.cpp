@@ -0,0 +1,265 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2021 Xu Zhen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "filescanner.h"
+#include <QRunnable>
+
+#ifdef Q_OS_ANDROID
+// content URIs are listed by FileData itself
+#elif defined(Q_OS_UNIX)
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QDir>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define USE_READDIR
+#else
+#include <QFileInfo>
+#include <QDateTime>
+#include <QDir>
+#endif
+
+class ScanTask : public QRunnable
+{
+public:
+    ScanTask(FileScanner *scanner, const QString &relPath = QString(), const QString &fullPath = QString())
+        : scanner(scanner), relPath(relPath), fullPath(fullPath) {
+    }
+
+    void run() override {
+        if (scanner->cancelled.loadAcquire() == 0) {
+            if (fullPath.isEmpty()) {
+                scanner->scanRoots();
+            } else {
+                scanner->scanDir(relPath, fullPath);
+            }
+        }
+        scanner->taskDone();
+    }
+
+private:
+    FileScanner *scanner;
+    QString relPath;
+    QString fullPath;
+};
+
+FileScanner::FileScanner(const QStringList &paths, QObject *parent) : QObject(parent), paths(paths) {
+    // the work is mostly waiting for the file system
+    pool.setMaxThreadCount(4);
+}
+
+FileScanner::~FileScanner() {
+    cancel();
+    pool.waitForDone();
+}
+
+void FileScanner::start() {
+    pendingTasks.ref();
+    pool.start(new ScanTask(this));
+}
+
+void FileScanner::cancel() {
+    cancelled.storeRelease(1);
+}
+
+void FileScanner::takeEntries(QList<FileData> &list, qint64 &totalSize) {
+    QMutexLocker locker(&mutex);
+    list.append(entries);
+    entries.clear();
+    totalSize += entriesSize;
+    entriesSize = 0;
+    notified.storeRelease(0);
+}
+
+QString FileScanner::error() {
+    QMutexLocker locker(&mutex);
+    return errorMessage;
+}
+
+void FileScanner::schedule(const QString &relPath, const QString &fullPath) {
+    pendingTasks.ref();
+    pool.start(new ScanTask(this, relPath, fullPath));
+}
+
+void FileScanner::publish(const QList<FileData> &found, qint64 size) {
+    if (found.isEmpty()) {
+        return;
+    }
+    {
+        QMutexLocker locker(&mutex);
+        entries.append(found);
+        entriesSize += size;
+    }
+    // one notification until the entries are taken
+    if (notified.testAndSetOrdered(0, 1)) {
+        emit entriesFound();
+    }
+}
+
+void FileScanner::fail(const QString &message) {
+    QMutexLocker locker(&mutex);
+    if (errorMessage.isEmpty()) {
+        errorMessage = message;
+    }
+    cancelled.storeRelease(1);
+}
+
+void FileScanner::taskDone() {
+    if (pendingTasks.deref() == false) {
+        // the last task, nothing more will be found
+        emit finished();
+    }
+}
+
+void FileScanner::scanRoots() {
+#ifdef Q_OS_ANDROID
+    qint64 size;
+    QString message;
+    QList<FileData> found = FileData::generateList(paths, size, message);
+    if (message.isEmpty() == false) {
+        fail(message);
+        return;
+    }
+    publish(found, size);
+#else
+    for (const QString &path : paths) {
+        QString cleanPath = QDir::cleanPath(path);
+        if (cleanPath.endsWith(QChar('/'))) {
+            cleanPath.chop(1);
+        }
+        QFileInfo info(cleanPath);
+        if (info.isReadable() == false) {
+            fail(QStringLiteral("Can not read %1").arg(cleanPath));
+            return;
+        }
+        QString name = info.fileName();
+        if (info.isDir()) {
+            publish(QList<FileData>() << FileData(-1, name, cleanPath), 0);
+            schedule(name, cleanPath);
+        } else {
+            publish(QList<FileData>() << FileData(info.size(), name, cleanPath, info.lastModified().toMSecsSinceEpoch()), info.size());
+        }
+    }
+#endif
+}
+
+#ifdef USE_READDIR
+
+void FileScanner::scanDir(const QString &relPath, const QString &fullPath) {
+    int fd = ::open(QFile::encodeName(fullPath).constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR *dir = (fd == -1 ? nullptr : fdopendir(fd));
+    if (dir == nullptr) {
+        if (fd != -1) {
+            ::close(fd);
+        }
+        fail(QStringLiteral("Can not read %1").arg(fullPath));
+        return;
+    }
+    QList<FileData> found;
+    qint64 size = 0;
+    QStringList subdirs;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != nullptr && cancelled.loadAcquire() == 0) {
+        const char *n = entry->d_name;
+        if (n[0] == '.' && (n[1] == '\0' || (n[1] == '.' && n[2] == '\0'))) {
+            continue;
+        }
+        QString name = QFile::decodeName(n);
+        // as QFileInfo::isReadable(), so that the scan fails instead of the transfer
+        if (faccessat(fd, n, R_OK, 0) != 0) {
+            closedir(dir);
+            fail(QStringLiteral("Can not read %1").arg(fullPath + "/" + name));
+            return;
+        }
+        bool isDir = false;
+        struct stat st;
+        if (entry->d_type == DT_DIR) {
+            // directories need no stat at all
+            isDir = true;
+        } else {
+            // follow symbolic links, as QFileInfo does
+            if (fstatat(fd, n, &st, 0) != 0) {
+                closedir(dir);
+                fail(QStringLiteral("Can not read %1").arg(fullPath + "/" + name));
+                return;
+            }
+            isDir = S_ISDIR(st.st_mode);
+        }
+        if (isDir) {
+            found.append(FileData(-1, relPath + "/" + name, fullPath + "/" + name));
+            subdirs.append(name);
+        } else {
+#if defined(Q_OS_MACOS) || defined(Q_OS_DARWIN)
+            qint64 modified = static_cast<qint64>(st.st_mtimespec.tv_sec) * 1000 + st.st_mtimespec.tv_nsec / 1000000;
+#else
+            qint64 modified = static_cast<qint64>(st.st_mtim.tv_sec) * 1000 + st.st_mtim.tv_nsec / 1000000;
+#endif
+            found.append(FileData(st.st_size, relPath + "/" + name, fullPath + "/" + name, modified));
+            size += st.st_size;
+        }
+    }
+    closedir(dir);
+    // publish a directory before anything below it can be found
+    publish(found, size);
+    for (const QString &name : subdirs) {
+        schedule(relPath + "/" + name, fullPath + "/" + name);
+    }
+}
+
+#elif !defined(Q_OS_ANDROID)
+
+void FileScanner::scanDir(const QString &relPath, const QString &fullPath) {
+    QList<FileData> found;
+    qint64 size = 0;
+    QStringList subdirs;
+    const QFileInfoList infos = QDir(fullPath).entryInfoList(QDir::AllEntries | QDir::Hidden | QDir::System | QDir::NoDotAndDotDot, QDir::NoSort);
+    for (const QFileInfo &info : infos) {
+        if (cancelled.loadAcquire()) {
+            return;
+        }
+        if (info.isReadable() == false) {
+            fail(QStringLiteral("Can not read %1").arg(info.filePath()));
+            return;
+        }
+        QString name = info.fileName();
+        if (info.isDir()) {
+            found.append(FileData(-1, relPath + "/" + name, fullPath + "/" + name));
+            subdirs.append(name);
+        } else {
+            found.append(FileData(info.size(), relPath + "/" + name, fullPath + "/" + name, info.lastModified().toMSecsSinceEpoch()));
+            size += info.size();
+        }
+    }
+    publish(found, size);
+    for (const QString &name : subdirs) {
+        schedule(relPath + "/" + name, fullPath + "/" + name);
+    }
+}
+
+#else
+
+void FileScanner::scanDir(const QString &relPath, const QString &fullPath) {
+    // not used, scanRoots() lists everything
+    Q_UNUSED(relPath)
+    Q_UNUSED(fullPath)
+}
+
+#endif
@@ -0,0 +1,71 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2021 Xu Zhen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef FILESCANNER_H
+#define FILESCANNER_H
+
+#include <QObject>
+#include <QThreadPool>
+#include <QMutex>
+#include <QAtomicInt>
+#include "filedata.h"
+
+// Lists the files and directories to send on a thread pool. Entries are
+// handed out while the scan goes on, a directory always comes before its content
+class FileScanner : public QObject
+{
+    Q_OBJECT
+public:
+    explicit FileScanner(const QStringList &paths, QObject *parent = nullptr);
+    ~FileScanner();
+
+    void start();
+    void cancel();
+
+    // Moves the entries found so far to the end of list and adds their sizes to totalSize
+    void takeEntries(QList<FileData> &list, qint64 &totalSize);
+    QString error();
+
+signals:
+    // emitted from the scanning threads
+    void entriesFound();
+    void finished();
+
+private:
+    friend class ScanTask;
+
+    void scanRoots();
+    void scanDir(const QString &relPath, const QString &fullPath);
+    void schedule(const QString &relPath, const QString &fullPath);
+    void publish(const QList<FileData> &entries, qint64 size);
+    void fail(const QString &message);
+    void taskDone();
+
+    QStringList paths;
+    QThreadPool pool;
+    QAtomicInt pendingTasks;
+    QAtomicInt cancelled;
+    QAtomicInt notified;
+
+    QMutex mutex;
+    QList<FileData> entries;
+    qint64 entriesSize = 0;
+    QString errorMessage;
+};
+
+#endif // FILESCANNER_H
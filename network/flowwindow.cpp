@@ -0,0 +1,102 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2021 Xu Zhen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "flowwindow.h"
+#include <algorithm>
+
+#if defined(Q_OS_LINUX)
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+
+// the rate is measured over at least this long, in ms
+#define SAMPLE_TIME 100
+// a longer pause means the connection has been idle, the sample is dropped
+#define IDLE_TIME 1000
+// time to be woken up by the event loop and refill the buffer, in us
+#define WAKEUP_TIME 4000
+
+FlowWindow::FlowWindow() {
+}
+
+void FlowWindow::setBounds(qint64 initial, qint64 minimum, qint64 maximum) {
+    this->minimum = std::max<qint64>(minimum, 4096);
+    this->maximum = std::max(this->minimum, maximum);
+    current = std::min(std::max(initial, this->minimum), this->maximum);
+}
+
+void FlowWindow::setSocket(QAbstractSocket *socket) {
+    this->socket = socket;
+    sampleBytes = 0;
+    rate = 0;
+    clock.start();
+    tuneSocket();
+}
+
+qint64 FlowWindow::chunkSize() const {
+    return std::min<qint64>(std::max<qint64>(current / 2, 16 * 1024), 4 * 1024 * 1024);
+}
+
+void FlowWindow::transferred(qint64 bytes) {
+    if (clock.isValid() == false) {
+        clock.start();
+    }
+    sampleBytes += bytes;
+    qint64 elapsed = clock.elapsed();
+    if (elapsed < SAMPLE_TIME) {
+        return;
+    }
+    if (elapsed < IDLE_TIME) {
+        double sample = sampleBytes * 1000.0 / elapsed;
+        rate = (rate == 0 ? sample : rate * 0.75 + sample * 0.25);
+        // twice the product, so that a window which limits the rate can grow
+        double target = 2 * rate * (roundTrip() + WAKEUP_TIME) / 1000000.0;
+        current = std::min(std::max(static_cast<qint64>(target), minimum), maximum);
+        tuneSocket();
+    }
+    sampleBytes = 0;
+    clock.restart();
+}
+
+// Smoothed round trip time of the connection in us, 0 if unknown
+qint64 FlowWindow::roundTrip() const {
+#if defined(Q_OS_LINUX)
+    if (socket != nullptr && socket->socketDescriptor() != -1) {
+        struct tcp_info info;
+        socklen_t size = sizeof(info);
+        if (getsockopt(static_cast<int>(socket->socketDescriptor()), IPPROTO_TCP, TCP_INFO, &info, &size) == 0) {
+            return info.tcpi_rtt;
+        }
+    }
+#endif
+    return 0;
+}
+
+void FlowWindow::tuneSocket() {
+#if defined(Q_OS_LINUX)
+    // autotuned by the kernel, only the data kept in flight follows the window
+#else
+    if (socket == nullptr || socket->socketDescriptor() == -1) {
+        return;
+    }
+    if (socket->socketOption(QAbstractSocket::SendBufferSizeSocketOption).toLongLong() < current) {
+        socket->setSocketOption(QAbstractSocket::SendBufferSizeSocketOption, static_cast<int>(current));
+    }
+#endif
+}
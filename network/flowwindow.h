@@ -0,0 +1,62 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2021 Xu Zhen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef FLOWWINDOW_H
+#define FLOWWINDOW_H
+
+#include <QAbstractSocket>
+#include <QElapsedTimer>
+
+// Sizes the data a sender keeps in flight on a connection, and the pieces the
+// file is read in, to about its bandwidth-delay product. The rate is measured
+// from the bytes that drain, the delay is the round trip time of the
+// connection plus the time it takes to be woken up again. Linux sizes the
+// kernel buffer of the socket by itself, setting it would turn that off and
+// cap it at wmem_max; elsewhere it is raised along with the window, never
+// lowered, so that the system's own tuning is only overridden where it falls short
+class FlowWindow
+{
+public:
+    FlowWindow();
+
+    void setBounds(qint64 initial, qint64 minimum, qint64 maximum);
+    void setSocket(QAbstractSocket *socket);
+    // bytes that have left the socket buffer, or been handed to the kernel
+    void transferred(qint64 bytes);
+
+    qint64 window() const {
+        return current;
+    }
+    qint64 chunkSize() const;
+
+private:
+    qint64 roundTrip() const;
+    void tuneSocket();
+
+    QAbstractSocket *socket = nullptr;
+    qint64 minimum = 64 * 1024;
+    qint64 maximum = 16 * 1024 * 1024;
+    qint64 current = 1024 * 1024;
+
+    QElapsedTimer clock;
+    qint64 sampleBytes = 0;
+    // bytes per second
+    double rate = 0;
+};
+
+#endif // FLOWWINDOW_H
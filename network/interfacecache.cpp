@@ -0,0 +1,181 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2021 Xu Zhen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+#include "interfacecache.h"
+
+#include <QCoreApplication>
+#include <QNetworkInterface>
+#include <QSocketNotifier>
+#include <QTimer>
+#include <QDebug>
+
+#ifdef USE_NETLINK
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+// how long notifications are gathered
+static const int SETTLE_INTERVAL = 200;
+// where there are no notifications the list is enumerated again when read
+// after this long; the messenger reads it once per hello, so this is never
+// more often than before the cache, when every hello enumerated
+static const int MAX_AGE = 5000;
+
+bool InterfaceCache::Entry::operator==(const Entry &other) const {
+    return name == other.name && ip == other.ip && broadcast == other.broadcast && up == other.up;
+}
+
+InterfaceCache& InterfaceCache::instance() {
+    static InterfaceCache theOne;
+    return theOne;
+}
+
+InterfaceCache::InterfaceCache() {
+    settleTimer = new QTimer(this);
+    settleTimer->setSingleShot(true);
+    settleTimer->setInterval(SETTLE_INTERVAL);
+    connect(settleTimer, &QTimer::timeout, this, &InterfaceCache::settle);
+    startWatching();
+    // the instance outlives the application object, the timers and the
+    // notifier must not
+    if (QCoreApplication::instance() != nullptr) {
+        connect(QCoreApplication::instance(), &QCoreApplication::aboutToQuit, this, &InterfaceCache::stopWatching);
+    }
+}
+
+InterfaceCache::~InterfaceCache() {
+#ifdef USE_NETLINK
+    if (netlinkFd >= 0) {
+        ::close(netlinkFd);
+    }
+#endif
+}
+
+void InterfaceCache::startWatching() {
+#ifdef USE_NETLINK
+    netlinkFd = ::socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_ROUTE);
+    if (netlinkFd >= 0) {
+        struct sockaddr_nl addr = {};
+        addr.nl_family = AF_NETLINK;
+        addr.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR;
+        if (::bind(netlinkFd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) == 0) {
+            notifier = new QSocketNotifier(netlinkFd, QSocketNotifier::Read, this);
+            connect(notifier, &QSocketNotifier::activated, this, &InterfaceCache::readNetlink);
+            return;
+        }
+        ::close(netlinkFd);
+        netlinkFd = -1;
+    }
+    qDebug() << "netlink not available, enumerating network interfaces when read";
+#endif
+    polling = true;
+}
+
+void InterfaceCache::stopWatching() {
+    settleTimer->stop();
+#ifdef USE_NETLINK
+    if (notifier != nullptr) {
+        notifier->setEnabled(false);
+    }
+#endif
+}
+
+#ifdef USE_NETLINK
+void InterfaceCache::readNetlink() {
+    // the messages themselves do not matter, only that something changed.
+    // ENOBUFS means some were lost, which is a change too
+    char buf[8192];
+    bool seen = false;
+    for (;;) {
+        ssize_t len = ::recv(netlinkFd, buf, sizeof(buf), 0);
+        if (len > 0) {
+            seen = true;
+            continue;
+        }
+        if (len < 0 && errno == EINTR) {
+            continue;
+        }
+        if (len < 0 && errno == ENOBUFS) {
+            seen = true;
+            continue;
+        }
+        break;
+    }
+    if (seen) {
+        invalidate();
+    }
+}
+#endif
+
+QList<InterfaceCache::Entry> InterfaceCache::entries() {
+    if (dirty || (polling && age.hasExpired(MAX_AGE))) {
+        enumerate();
+    }
+    return list;
+}
+
+void InterfaceCache::invalidate() {
+    dirty = true;
+    settleTimer->start();
+}
+
+void InterfaceCache::settle() {
+    if (dirty) {
+        enumerate();
+    }
+    if (changePending) {
+        changePending = false;
+        emit changed();
+    }
+}
+
+// changed() is not emitted from here, readers may be in the middle of
+// something when they call entries()
+void InterfaceCache::enumerate() {
+    dirty = false;
+    age.start();
+    QList<Entry> fresh;
+    const QList<QNetworkInterface> ifaces = QNetworkInterface::allInterfaces();
+    for (const QNetworkInterface &iface: ifaces) {
+        bool up = iface.flags().testFlag(QNetworkInterface::IsUp);
+        const QList<QNetworkAddressEntry> addrs = iface.addressEntries();
+        for (const QNetworkAddressEntry &addr: addrs) {
+            QHostAddress ipAddr = addr.ip();
+            if (ipAddr.protocol() == QAbstractSocket::IPv4Protocol && !ipAddr.isLoopback()) {
+                Entry entry;
+                entry.name = iface.name();
+                entry.ip = ipAddr;
+                entry.broadcast = addr.broadcast();
+                entry.up = up;
+                fresh.append(entry);
+            }
+        }
+    }
+    if (fresh != list) {
+        list = fresh;
+        changePending = listed;
+        if (changePending && settleTimer->isActive() == false) {
+            settleTimer->start();
+        }
+    }
+    listed = true;
+}
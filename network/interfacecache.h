@@ -0,0 +1,96 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2021 Xu Zhen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+#ifndef INTERFACECACHE_H
+#define INTERFACECACHE_H
+
+#include <QObject>
+#include <QList>
+#include <QHostAddress>
+#include <QElapsedTimer>
+
+#if defined(Q_OS_LINUX) && !defined(Q_OS_ANDROID)
+// learn about address and link changes from the kernel instead of polling
+#define USE_NETLINK
+#endif
+
+class QTimer;
+class QSocketNotifier;
+
+// The IPv4 addresses of the local interfaces, enumerated once and again only
+// when they may have changed: on netlink notifications where available,
+// elsewhere when a reader asks and the list has grown old. Used from the
+// thread of the application object
+class InterfaceCache : public QObject
+{
+    Q_OBJECT
+public:
+    struct Entry {
+        QString name;
+        QHostAddress ip;
+        QHostAddress broadcast;
+        bool up;
+
+        bool operator==(const Entry &other) const;
+        bool operator!=(const Entry &other) const { return !(*this == other); }
+    };
+
+    Q_DISABLE_COPY(InterfaceCache)
+    static InterfaceCache& instance();
+
+    // loopback addresses are left out
+    QList<Entry> entries();
+    // the next read enumerates the interfaces again
+    void invalidate();
+
+signals:
+    // the list differs from the one before, emitted from the event loop
+    void changed();
+
+private slots:
+    void settle();
+    void stopWatching();
+#ifdef USE_NETLINK
+    void readNetlink();
+#endif
+
+private:
+    InterfaceCache();
+    ~InterfaceCache();
+
+    void startWatching();
+    void enumerate();
+
+    QList<Entry> list;
+    bool dirty = true;
+    // the first enumeration is not a change
+    bool listed = false;
+    bool changePending = false;
+    // gathers a burst of notifications into a single enumeration
+    QTimer *settleTimer;
+    // without notifications the list expires, see entries()
+    bool polling = false;
+    QElapsedTimer age;
+#ifdef USE_NETLINK
+    int netlinkFd = -1;
+    QSocketNotifier *notifier = nullptr;
+#endif
+};
+
+#endif // INTERFACECACHE_H
@@ -19,18 +19,31 @@
 #include "messenger.h"
 
 #include <QUdpSocket>
-#include <QNetworkInterface>
+#include <QTimer>
 #include <QDebug>
 
 #include "platform.h"
 #include "buddymessage.h"
+#include "interfacecache.h"
 
 #ifdef Q_OS_ANDROID
 #include "androidutils.h"
 #endif
 
-Messenger::Messenger(quint16 defaultPort, QObject *parent) : QObject(parent), protocolDefaultPort(defaultPort) {
+// hello intervals, a buddy is dropped when not heard of for PEER_TTL, long
+// enough for a few of the slowest hellos (or their replies) to get lost
+static const qint64 HELLO_MIN_INTERVAL = 5000;
+static const qint64 HELLO_MAX_INTERVAL = 160000;
+static const qint64 PEER_TTL = 3 * HELLO_MAX_INTERVAL;
+
+Messenger::Messenger(quint16 defaultPort, QObject *parent) : QObject(parent), protocolDefaultPort(defaultPort),
+    helloInterval(HELLO_MIN_INTERVAL) {
     socket = new QUdpSocket(this);
+    tickTimer = new QTimer(this);
+    tickTimer->setInterval(HELLO_MIN_INTERVAL);
+    connect(tickTimer, &QTimer::timeout, this, &Messenger::tick);
+    connect(&InterfaceCache::instance(), &InterfaceCache::changed, this, &Messenger::interfacesChanged);
+    clock.start();
 }
 
 Messenger::~Messenger() {
@@ -72,10 +85,13 @@ bool Messenger::start(quint16 listenPort, QString &error) {
         }
         return false;
     }
+    resetBackoff();
+    tickTimer->start();
     return true;
 }
 
 void Messenger::stop() {
+    tickTimer->stop();
     sayGoodbye();
     socket->disconnect(this);
     socket->close();
@@ -101,8 +117,9 @@ void Messenger::processDatagram() {
         }
         if (localAddrs.contains(sender)) {
             // sent by self, ignore
+            // a hello and a feature list per port are expected back
             int count = localAddrs.value(sender) + 1;
-            if (count > 5) {
+            if (count > 10) {
                 qDebug() << "detected broadcast storm from" << sender.toString();
                 badAddrs.append(sender);
             }
@@ -121,7 +138,7 @@ void Messenger::processMessage(const BuddyMessage &message, const QHostAddress &
         case BuddyMessage::MSG_HELLO_BROADCAST:
         case BuddyMessage::MSG_HELLO_UNICAST: {
             Peer peer(sender, message.getSignature(), protocolDefaultPort);
-            peers[sender] = peer;
+            updatePeer(peer);
             if (message.getType() == BuddyMessage::MSG_HELLO_BROADCAST) {
                 sayHello(sender, protocolDefaultPort);
             }
@@ -134,29 +151,94 @@ void Messenger::processMessage(const BuddyMessage &message, const QHostAddress &
                 Peer peer = peers[sender];
                 emit buddyGone(peer);
                 peers.remove(sender);
+                lastSeen.remove(sender);
+                resetBackoff();
             }
             break;
 
         case BuddyMessage::MSG_HELLO_PORT_BROADCAST:
         case BuddyMessage::MSG_HELLO_PORT_UNICAST: {
             Peer peer = Peer(sender, message.getSignature(), message.getPort());
+            updatePeer(peer);
             if (message.getType() == BuddyMessage::MSG_HELLO_PORT_BROADCAST) {
                 sayHello(sender, message.getPort());
             }
             emit buddyFound(peer);
             break;
         }
+
+        case BuddyMessage::MSG_FEATURES:
+            emit buddyFeatures(sender.toString(), message.getFeatures());
+            break;
+
         case BuddyMessage::MSG_INVALID:
             break;
     }
 }
 
+void Messenger::updatePeer(const Peer &peer) {
+    auto it = peers.find(peer.address);
+    if (it == peers.end()) {
+        // someone new; it learns about us from the reply to its broadcast, so
+        // the interval is kept, or every join would make everyone chatty
+        peers.insert(peer.address, peer);
+    } else {
+        *it = peer;
+    }
+    lastSeen.insert(peer.address, clock.elapsed());
+}
+
+// Drop the buddies which have not been heard of for a while, they may have
+// crashed or left without a goodbye
+void Messenger::expirePeers() {
+    qint64 now = clock.elapsed();
+    bool expired = false;
+    for (auto it = peers.begin(); it != peers.end();) {
+        if (now - lastSeen.value(it.key()) < PEER_TTL) {
+            ++it;
+            continue;
+        }
+        qDebug() << "buddy expired" << it.key().toString();
+        emit buddyGone(it.value());
+        lastSeen.remove(it.key());
+        it = peers.erase(it);
+        expired = true;
+    }
+    if (expired) {
+        resetBackoff();
+    }
+}
+
+void Messenger::resetBackoff() {
+    helloInterval = HELLO_MIN_INTERVAL;
+}
+
+void Messenger::tick() {
+    expirePeers();
+    if (clock.elapsed() - lastHello >= helloInterval) {
+        sayHello();
+        helloInterval = qMin(helloInterval * 2, HELLO_MAX_INTERVAL);
+    }
+}
+
+// Joined another network or got a new address, announce at once
+void Messenger::interfacesChanged() {
+    if (tickTimer->isActive() == false) {
+        return;
+    }
+    resetBackoff();
+    sayHello();
+}
 
 void Messenger::sayHello() {
     if (socket->state() != QUdpSocket::BoundState) {
         return;
     }
+    lastHello = clock.elapsed();
     broadcastMessage(BuddyMessage(BuddyMessage::broadcastType(socket->localPort() == protocolDefaultPort), socket->localPort(), getSystemSignature()));
+    if (features != 0) {
+        broadcastMessage(BuddyMessage::featureList(features));
+    }
 }
 
 void Messenger::sayHello(const QHostAddress &target, quint16 port) {
@@ -165,6 +247,13 @@ void Messenger::sayHello(const QHostAddress &target, quint16 port) {
     }
     BuddyMessage message(BuddyMessage::unicastType(socket->localPort() == protocolDefaultPort), socket->localPort(), getSystemSignature());
     sendPacket(message.serialize(), target, port);
+    if (features != 0) {
+        sendPacket(BuddyMessage::featureList(features).serialize(), target, port);
+    }
+}
+
+void Messenger::setFeatures(qint64 features) {
+    this->features = features;
 }
 
 void Messenger::sayGoodbye() {
@@ -191,24 +280,18 @@ void Messenger::broadcastMessage(const BuddyMessage &message) {
     localAddrs.clear();
 
     // broadcast to all interfaces
-    const QList<QNetworkInterface> ifaces = QNetworkInterface::allInterfaces();
-    for (const QNetworkInterface &iface: ifaces) {
-        if (iface.flags().testFlag(QNetworkInterface::IsUp) == false) {
+    const QList<InterfaceCache::Entry> entries = InterfaceCache::instance().entries();
+    for (const InterfaceCache::Entry &entry: entries) {
+        if (entry.up == false) {
             continue;
         }
-        const QList<QNetworkAddressEntry> addrs = iface.addressEntries();
-        for (const QNetworkAddressEntry &addr: addrs) {
-            QHostAddress ipAddr = addr.ip();
-            if (ipAddr.protocol() == QAbstractSocket::IPv4Protocol && !ipAddr.isLoopback()) {
-                if (badAddrs.contains(ipAddr)) {
-                    qDebug() << "skip bad addr" << ipAddr.toString() << " of " << iface.name();
-                    continue;
-                }
-                localAddrs.insert(ipAddr, 0);
-                for (quint16 port: ports) {
-                    sendPacket(packet, addr.broadcast(), port);
-                }
-            }
+        if (badAddrs.contains(entry.ip)) {
+            qDebug() << "skip bad addr" << entry.ip.toString() << " of " << entry.name;
+            continue;
+        }
+        localAddrs.insert(entry.ip, 0);
+        for (quint16 port: ports) {
+            sendPacket(packet, entry.broadcast, port);
         }
     }
 }
@@ -21,13 +21,14 @@
 
 #include <QObject>
 #include <QHash>
+#include <QElapsedTimer>
 
 #include "peer.h"
 
 class QUdpSocket;
+class QTimer;
 class QHostAddress;
 class BuddyMessage;
-class QNetworkInterface;
 
 #ifdef Q_OS_ANDROID
 class AndroidMulticastLock;
@@ -42,30 +43,51 @@ public:
 
     bool start(quint16 listenPort, QString &error);
     void stop();
+    // broadcasts a hello now, it is also done by the messenger itself, less
+    // and less often while the buddies stay the same
     void sayHello();
     void sayHello(const QHostAddress &target, quint16 port);
     void sayGoodbye();
+    // protocol extensions announced along with every hello, 0 for none
+    void setFeatures(qint64 features);
 
 signals:
     void buddyFound(Peer peer);
     void buddyGone(Peer peer);
+    // a buddy told which protocol extensions it accepts
+    void buddyFeatures(QString address, qint64 features);
 
 private slots:
     void processDatagram();
+    void tick();
+    void interfacesChanged();
 
 private:
     void processMessage(const BuddyMessage &message, const QHostAddress &sender);
+    void updatePeer(const Peer &peer);
+    void expirePeers();
+    void resetBackoff();
     void broadcastMessage(const BuddyMessage &message);
     void sendPacket(const QByteArray &data, const QHostAddress &target, quint16 port);
     QString getSystemSignature();
 
     QUdpSocket *socket;
     quint16 localPort = 0;
+    qint64 features = 0;
     const quint16 protocolDefaultPort;
 
     QHash<QHostAddress, Peer> peers;
+    // when each buddy was last heard of, on the clock below
+    QHash<QHostAddress, qint64> lastSeen;
+    QElapsedTimer clock;
+
+    // hellos are broadcast when helloInterval has passed since the last one,
+    // the interval doubles up to HELLO_MAX_INTERVAL, it starts over when a
+    // buddy leaves or the interfaces change, not when one joins
+    QTimer *tickTimer;
+    qint64 lastHello = 0;
+    qint64 helloInterval;
     QHash<QHostAddress, int> localAddrs;
-    QHash<QHostAddress, QNetworkInterface> localIfaces;
 
     // on Android, an interface created by some VPN apps may cause broadcast storm
     QList<QHostAddress> badAddrs;
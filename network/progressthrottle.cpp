@@ -0,0 +1,41 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2021 Xu Zhen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "progressthrottle.h"
+#include <algorithm>
+
+void ProgressThrottle::setRate(int updatesPerSecond) {
+    interval = (updatesPerSecond > 0 ? 1000 / updatesPerSecond : 0);
+}
+
+bool ProgressThrottle::pass(bool final) {
+    if (final || interval == 0 || clock.isValid() == false || clock.elapsed() >= interval) {
+        clock.start();
+        passedCount++;
+        return true;
+    }
+    heldCount++;
+    return false;
+}
+
+qint64 ProgressThrottle::remaining() const {
+    if (interval == 0 || clock.isValid() == false) {
+        return 0;
+    }
+    return std::max<qint64>(interval - clock.elapsed(), 0);
+}
@@ -0,0 +1,51 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2021 Xu Zhen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef PROGRESSTHROTTLE_H
+#define PROGRESSTHROTTLE_H
+
+#include <QElapsedTimer>
+
+// Lets the progress of a session through at most a number of times per
+// second. What is held back is only an older value of the same counters, so
+// nothing is lost as long as the last update is let through with final set,
+// or the owner asks again after remaining() when an update has been held
+class ProgressThrottle
+{
+public:
+    // 0 lets every update through
+    void setRate(int updatesPerSecond);
+    bool pass(bool final = false);
+    // milliseconds until an update is let through again
+    qint64 remaining() const;
+
+    qint64 passed() const {
+        return passedCount;
+    }
+    qint64 held() const {
+        return heldCount;
+    }
+
+private:
+    QElapsedTimer clock;
+    qint64 interval = 100;
+    qint64 passedCount = 0;
+    qint64 heldCount = 0;
+};
+
+#endif // PROGRESSTHROTTLE_H
@@ -0,0 +1,166 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2021 Xu Zhen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "rangereceiver.h"
+#include "ratelimiter.h"
+#include "diskwriter.h"
+#include <QTcpSocket>
+#include <QFile>
+#include <QTimer>
+#include <algorithm>
+
+RangeReceiver::RangeReceiver(QTcpSocket *socket, DiskWriter *writer, const QString &path, qint64 offset, qint64 length, QObject *parent) :
+    QObject(parent), socket(socket), writer(writer), path(path), offset(offset), remaining(length), paceTimer(new QTimer(this)) {
+    socket->setParent(this);
+    paceTimer->setSingleShot(true);
+    connect(paceTimer, &QTimer::timeout, this, &RangeReceiver::processData);
+    // the queue is shared with the session connection and the other ranges
+    connect(writer, &DiskWriter::drained, this, &RangeReceiver::processData);
+    connect(socket, &QTcpSocket::readyRead, this, &RangeReceiver::processData);
+#if QT_VERSION >= QT_VERSION_CHECK(5, 15, 0)
+    connect(socket, &QTcpSocket::errorOccurred, this, &RangeReceiver::connectionError);
+#else
+    connect(socket, static_cast<void (QTcpSocket::*)(QAbstractSocket::SocketError)>(&QTcpSocket::error), this, &RangeReceiver::connectionError);
+#endif
+}
+
+RangeReceiver::~RangeReceiver() {
+    if (socket != nullptr) {
+        socket->disconnect(this);
+        socket->abort();
+    }
+}
+
+void RangeReceiver::setChecksum(bool enabled) {
+    checksumEnabled = enabled;
+}
+
+void RangeReceiver::setRateLimiter(RateLimiter *limiter, const void *consumer) {
+    this->limiter = limiter;
+    this->consumer = consumer;
+    // data left unread stays with the sender, so that it slows down
+    socket->setReadBufferSize(1024 * 1024);
+}
+
+void RangeReceiver::start() {
+    // the file has been created by the session connection, do not truncate it
+    file = new QFile(path);
+    if (file->open(QFile::ReadWrite) == false || file->seek(offset) == false) {
+        delete file;
+        file = nullptr;
+        terminateSession(QStringLiteral("Can not write to %1").arg(path));
+        return;
+    }
+    // the space has been reserved with the file already
+    writer->beginFile(file, 0, false);
+    processData();
+}
+
+void RangeReceiver::stop() {
+    if (file != nullptr) {
+        writer->closeFile(file);
+        file = nullptr;
+    }
+    terminateConnection();
+}
+
+void RangeReceiver::processData() {
+    while (socket != nullptr && socket->bytesAvailable() > 0 && remaining > 0) {
+        if (writer->isFull()) {
+            // leave the data in the socket until drained(), the sender slows down
+            return;
+        }
+        qint64 allowance = 1024 * 1024;
+        // what is left once the sender has closed the connection is taken at once
+        if (limiter != nullptr && socket->state() == QAbstractSocket::ConnectedState) {
+            int waitMs = 0;
+            allowance = std::min(allowance, limiter->acquire(consumer, waitMs));
+            if (allowance == 0) {
+                // over the rate of the session, go on once it allows more
+                if (paceTimer->isActive() == false) {
+                    paceTimer->start(waitMs);
+                }
+                return;
+            }
+        }
+        QByteArray d = socket->read(std::min<qint64>(remaining, allowance));
+        if (writer->write(file, d) == false) {
+            terminateSession(writer->error());
+            return;
+        }
+        if (checksumEnabled) {
+            checksum.update(d.constData(), d.size());
+        }
+        if (limiter != nullptr) {
+            limiter->consume(consumer, d.size());
+        }
+        remaining -= d.size();
+        emit progress(d.size());
+    }
+    if (socket != nullptr && remaining == 0 && checksumEnabled) {
+        quint64 hash;
+        if (socket->bytesAvailable() < static_cast<qint64>(sizeof(hash))) {
+            // wait for the hash
+            if (peerClosed) {
+                terminateSession(socket->errorString());
+            }
+            return;
+        }
+        socket->read(reinterpret_cast<char *>(&hash), sizeof(hash));
+        if (hash != checksum.digest()) {
+            terminateSession(QStringLiteral("%1 has been corrupted in transit").arg(path));
+            return;
+        }
+        checksumEnabled = false;
+    }
+    if (socket != nullptr && remaining == 0) {
+        // the data is on disk once the session has reached its end marker
+        stop();
+        emit completed();
+    }
+    if (socket != nullptr && peerClosed && (socket->bytesAvailable() == 0 || writer->isFull() == false)) {
+        // closed before the whole range has arrived
+        terminateSession(socket->errorString());
+    }
+}
+
+void RangeReceiver::connectionError(QAbstractSocket::SocketError error) {
+    Q_UNUSED(error)
+    if (socket == nullptr || peerClosed) {
+        return;
+    }
+    // the sender closes the connection right after the last byte, what is
+    // left may still wait for drained()
+    peerClosed = true;
+    processData();
+}
+
+void RangeReceiver::terminateSession(const QString &error) {
+    stop();
+    emit aborted(error);
+}
+
+void RangeReceiver::terminateConnection() {
+    paceTimer->stop();
+    if (socket != nullptr) {
+        socket->disconnect(this);
+        socket->close();
+        socket->deleteLater();
+        socket = nullptr;
+    }
+}
@@ -0,0 +1,78 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2021 Xu Zhen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef RANGERECEIVER_H
+#define RANGERECEIVER_H
+
+#include <QObject>
+#include <QAbstractSocket>
+#include "checksum.h"
+
+class QTcpSocket;
+class QTimer;
+class QFile;
+class RateLimiter;
+class DiskWriter;
+
+// Receives one range of a file from an extra connection of a multi-stream
+// session, its data is queued to the writer of the session with a file
+// handle of its own that starts at the offset of the range
+class RangeReceiver : public QObject
+{
+    Q_OBJECT
+public:
+    RangeReceiver(QTcpSocket *socket, DiskWriter *writer, const QString &path, qint64 offset, qint64 length, QObject *parent = nullptr);
+    ~RangeReceiver();
+
+    // expect the hash of the range after its data, see TransferOptions::FEATURE_CHECKSUM
+    void setChecksum(bool enabled);
+    // paces the reads as a part of consumer, see RateLimiter
+    void setRateLimiter(RateLimiter *limiter, const void *consumer);
+    void start();
+    // hands the file back to the writer and closes the connection
+    void stop();
+
+signals:
+    void progress(qint64 bytes);
+    void completed();
+    void aborted(QString error);
+
+private slots:
+    void processData();
+    void connectionError(QAbstractSocket::SocketError error);
+
+private:
+    void terminateSession(const QString &error);
+    void terminateConnection();
+
+    QTcpSocket *socket;
+    DiskWriter *writer;
+    QString path;
+    // owned by the writer once opened
+    QFile *file = nullptr;
+    qint64 offset;
+    qint64 remaining;
+    bool checksumEnabled = false;
+    Checksum checksum;
+    RateLimiter *limiter = nullptr;
+    const void *consumer = nullptr;
+    QTimer *paceTimer;
+    bool peerClosed = false;
+};
+
+#endif // RANGERECEIVER_H
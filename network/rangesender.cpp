@@ -0,0 +1,141 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2021 Xu Zhen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "rangesender.h"
+#include "ratelimiter.h"
+#include <QTcpSocket>
+#include <QTimer>
+#include <algorithm>
+
+RangeSender::RangeSender(const QString &dest, quint16 port, const QByteArray &header, const QString &path, qint64 offset, qint64 length, QObject *parent) :
+    QObject(parent), socket(new QTcpSocket(this)), dest(dest), port(port), header(header), file(path), offset(offset), remaining(length), paceTimer(new QTimer(this)) {
+    paceTimer->setSingleShot(true);
+    connect(paceTimer, &QTimer::timeout, this, &RangeSender::sendData);
+    connect(socket, &QTcpSocket::connected, this, [this]() {
+        flow.setSocket(socket);
+    });
+    connect(socket, &QTcpSocket::connected, this, &RangeSender::sendData);
+#if QT_VERSION >= QT_VERSION_CHECK(5, 15, 0)
+    connect(socket, &QTcpSocket::errorOccurred, this, &RangeSender::connectionError);
+#else
+    connect(socket, static_cast<void (QTcpSocket::*)(QAbstractSocket::SocketError)>(&QTcpSocket::error), this, &RangeSender::connectionError);
+#endif
+    connect(socket, &QTcpSocket::bytesWritten, this, [this](qint64 bytes) {
+        flow.transferred(bytes);
+    });
+    connect(socket, &QTcpSocket::bytesWritten, this, &RangeSender::sendData);
+}
+
+RangeSender::~RangeSender() {
+    abort();
+}
+
+void RangeSender::setChecksum(bool enabled) {
+    checksumEnabled = enabled;
+}
+
+void RangeSender::setRateLimiter(RateLimiter *limiter, const void *consumer) {
+    this->limiter = limiter;
+    this->consumer = consumer;
+}
+
+void RangeSender::setWindow(qint64 initial, qint64 minimum, qint64 maximum) {
+    flow.setBounds(initial, minimum, maximum);
+}
+
+void RangeSender::start() {
+    if (file.open(QFile::ReadOnly) == false || file.seek(offset) == false) {
+        reportError(QStringLiteral("Can not read %1").arg(file.fileName()));
+        return;
+    }
+    socket->connectToHost(dest, port, QTcpSocket::WriteOnly);
+}
+
+void RangeSender::abort() {
+    paceTimer->stop();
+    if (socket != nullptr) {
+        socket->disconnect(this);
+        socket->abort();
+        socket->deleteLater();
+        socket = nullptr;
+    }
+    file.close();
+}
+
+void RangeSender::sendData() {
+    if (socket == nullptr) {
+        return;
+    }
+    if (header.isEmpty() == false) {
+        socket->write(header);
+        header.clear();
+    }
+    while (remaining > 0 && socket->bytesToWrite() < flow.window()) {
+        qint64 allowance = flow.chunkSize();
+        if (limiter != nullptr) {
+            int waitMs = 0;
+            allowance = std::min(allowance, limiter->acquire(consumer, waitMs));
+            if (allowance == 0) {
+                // over the rate of the session, go on once it allows more
+                if (paceTimer->isActive() == false) {
+                    paceTimer->start(waitMs);
+                }
+                return;
+            }
+        }
+        QByteArray d = file.read(std::min<qint64>(remaining, allowance));
+        if (d.isEmpty()) {
+            reportError(QStringLiteral("%1 has been changed while sending").arg(file.fileName()));
+            return;
+        }
+        if (checksumEnabled) {
+            checksum.update(d.constData(), d.size());
+        }
+        socket->write(d);
+        if (limiter != nullptr) {
+            limiter->consume(consumer, d.size());
+        }
+        remaining -= d.size();
+        emit progress(d.size());
+    }
+    if (remaining == 0 && checksumEnabled) {
+        // once, after the last byte of the range
+        quint64 hash = checksum.digest();
+        socket->write(reinterpret_cast<char *>(&hash), sizeof(hash));
+        checksumEnabled = false;
+    }
+    if (remaining == 0 && socket->bytesToWrite() == 0) {
+        // end connection until all data sent
+        file.close();
+        socket->disconnect(this);
+        socket->disconnectFromHost();
+        socket->deleteLater();
+        socket = nullptr;
+        emit completed();
+    }
+}
+
+void RangeSender::connectionError(QAbstractSocket::SocketError error) {
+    Q_UNUSED(error)
+    reportError(socket->errorString());
+}
+
+void RangeSender::reportError(const QString &error) {
+    emit aborted(error);
+    abort();
+}
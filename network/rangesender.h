@@ -0,0 +1,76 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2021 Xu Zhen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef RANGESENDER_H
+#define RANGESENDER_H
+
+#include <QObject>
+#include <QAbstractSocket>
+#include <QFile>
+#include "checksum.h"
+#include "flowwindow.h"
+
+class QTcpSocket;
+class QTimer;
+class RateLimiter;
+
+// Sends one range of a file over an extra connection of a multi-stream session
+class RangeSender : public QObject
+{
+    Q_OBJECT
+public:
+    RangeSender(const QString &dest, quint16 port, const QByteArray &header, const QString &path, qint64 offset, qint64 length, QObject *parent = nullptr);
+    ~RangeSender();
+
+    // follow the range with its hash, see TransferOptions::FEATURE_CHECKSUM
+    void setChecksum(bool enabled);
+    // paces the data as a part of consumer, see RateLimiter
+    void setRateLimiter(RateLimiter *limiter, const void *consumer);
+    // bounds of the data kept in flight, see FlowWindow
+    void setWindow(qint64 initial, qint64 minimum, qint64 maximum);
+    void start();
+    void abort();
+
+signals:
+    void progress(qint64 bytes);
+    void completed();
+    void aborted(QString error);
+
+private slots:
+    void sendData();
+    void connectionError(QAbstractSocket::SocketError error);
+
+private:
+    void reportError(const QString &error);
+
+    QTcpSocket *socket;
+    QString dest;
+    quint16 port;
+    QByteArray header;
+    QFile file;
+    qint64 offset;
+    qint64 remaining;
+    bool checksumEnabled = false;
+    Checksum checksum;
+    RateLimiter *limiter = nullptr;
+    const void *consumer = nullptr;
+    QTimer *paceTimer;
+    FlowWindow flow;
+};
+
+#endif // RANGESENDER_H
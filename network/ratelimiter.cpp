@@ -0,0 +1,116 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2021 Xu Zhen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "ratelimiter.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+const qint64 RateLimiter::UNLIMITED = std::numeric_limits<qint64>::max();
+
+// a consumer which has not asked for this long does not take a share
+#define IDLE_TIME 1000
+// tokens are collected for no more than this, the largest burst
+#define BURST_TIME 100
+#define MIN_BURST (16 * 1024)
+
+RateLimiter::RateLimiter() {
+    clock.start();
+}
+
+void RateLimiter::setRates(qint64 globalRate, const QHash<QString, qint64> &peerRates) {
+    QMutexLocker locker(&mutex);
+    this->globalRate = std::max<qint64>(globalRate, 0);
+    this->peerRates = peerRates;
+}
+
+void RateLimiter::addConsumer(const void *consumer, const QString &peer) {
+    QMutexLocker locker(&mutex);
+    qint64 now = clock.elapsed();
+    Consumer c;
+    c.peer = peer;
+    c.tokens = MIN_BURST;
+    c.lastRefill = now;
+    c.lastActive = now;
+    consumers.insert(consumer, c);
+}
+
+void RateLimiter::removeConsumer(const void *consumer) {
+    QMutexLocker locker(&mutex);
+    consumers.remove(consumer);
+}
+
+// The rate of a consumer, 0 if it is not limited
+qint64 RateLimiter::shareOf(const Consumer &consumer, qint64 now) const {
+    qint64 peerRate = peerRates.value(consumer.peer, 0);
+    if (globalRate <= 0 && peerRate <= 0) {
+        return 0;
+    }
+    int active = 0;
+    int peerActive = 0;
+    for (const Consumer &other : consumers) {
+        if (now - other.lastActive < IDLE_TIME) {
+            active++;
+            if (other.peer == consumer.peer) {
+                peerActive++;
+            }
+        }
+    }
+    qint64 share = std::numeric_limits<qint64>::max();
+    if (globalRate > 0) {
+        share = globalRate / std::max(active, 1);
+    }
+    if (peerRate > 0) {
+        share = std::min(share, peerRate / std::max(peerActive, 1));
+    }
+    return std::max<qint64>(share, 1);
+}
+
+qint64 RateLimiter::acquire(const void *consumer, int &waitMs) {
+    QMutexLocker locker(&mutex);
+    auto it = consumers.find(consumer);
+    if (it == consumers.end()) {
+        return UNLIMITED;
+    }
+    qint64 now = clock.elapsed();
+    it->lastActive = now;
+    qint64 share = shareOf(*it, now);
+    if (share == 0) {
+        it->tokens = MIN_BURST;
+        it->lastRefill = now;
+        return UNLIMITED;
+    }
+    double burst = std::max<double>(share * BURST_TIME / 1000.0, MIN_BURST);
+    it->tokens = std::min(it->tokens + (now - it->lastRefill) * share / 1000.0, burst);
+    it->lastRefill = now;
+    if (it->tokens >= 1) {
+        return static_cast<qint64>(it->tokens);
+    }
+    // in debt after a large write, or just out of tokens
+    waitMs = static_cast<int>(std::min<double>(std::ceil((1 - it->tokens) * 1000 / share), IDLE_TIME / 2));
+    waitMs = std::max(waitMs, 1);
+    return 0;
+}
+
+void RateLimiter::consume(const void *consumer, qint64 bytes) {
+    QMutexLocker locker(&mutex);
+    auto it = consumers.find(consumer);
+    if (it != consumers.end()) {
+        it->tokens -= bytes;
+    }
+}
@@ -0,0 +1,67 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2021 Xu Zhen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef RATELIMITER_H
+#define RATELIMITER_H
+
+#include <QtGlobal>
+#include <QHash>
+#include <QString>
+#include <QMutex>
+#include <QElapsedTimer>
+
+// Token buckets which keep transfers under a rate for all of them and a rate
+// for every buddy. A rate is shared evenly by the sessions which use it at the
+// moment, a session counts as a consumer whatever the number of its connections.
+// The rates may be changed while transfers are going on
+class RateLimiter
+{
+public:
+    static const qint64 UNLIMITED;
+
+    RateLimiter();
+
+    // bytes per second, 0 for no limit. the buddies are identified by address
+    void setRates(qint64 globalRate, const QHash<QString, qint64> &peerRates);
+
+    void addConsumer(const void *consumer, const QString &peer);
+    void removeConsumer(const void *consumer);
+    // bytes the consumer may transfer now, UNLIMITED if no limit applies, or 0 with
+    // the milliseconds to wait before asking again
+    qint64 acquire(const void *consumer, int &waitMs);
+    // charges what the consumer has transferred, it may take more than acquired
+    void consume(const void *consumer, qint64 bytes);
+
+private:
+    struct Consumer {
+        QString peer;
+        double tokens;
+        qint64 lastRefill;
+        qint64 lastActive;
+    };
+
+    qint64 shareOf(const Consumer &consumer, qint64 now) const;
+
+    QMutex mutex;
+    QElapsedTimer clock;
+    qint64 globalRate = 0;
+    QHash<QString, qint64> peerRates;
+    QHash<const void *, Consumer> consumers;
+};
+
+#endif // RATELIMITER_H
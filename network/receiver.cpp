@@ -17,19 +17,88 @@
  */
 
 #include "receiver.h"
+#include "rangereceiver.h"
+#include "resumejournal.h"
+#include "compression.h"
+#include "filehasher.h"
+#include "delta.h"
+#include "ratelimiter.h"
+#ifndef Q_OS_ANDROID
+#include "diskwriter.h"
+#endif
 #include <QHostAddress>
+#include <QTimer>
 #include <algorithm>
+#include <string.h>
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 10, 0)
+#include <QRandomGenerator>
+#else
+#include <QDateTime>
+#endif
 
 #ifdef Q_OS_ANDROID
 #include "androidutils.h"
 #else
 #include <QDir>
 #include <QFile>
+#include <QFileInfo>
+#endif
+
+#if defined(Q_OS_LINUX) && !defined(Q_OS_ANDROID)
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+#if defined(Q_OS_UNIX) && !defined(Q_OS_ANDROID)
+#include <unistd.h>
 #endif
 
 QString Receiver::textElementName = QStringLiteral("___DUKTO___TEXT___");
+QString Receiver::totalsElementName = QStringLiteral("___DUKTO___TOTALS___");
+
+// longest element name accepted
+#define MAX_NAME_SIZE (64 * 1024)
+// bytes taken from the socket at a time, enough for a name or a compressed frame
+#define MAX_BUFFER_SIZE (4 * 1024 * 1024)
+// the unparsed bytes are moved to the front of inBuffer when less space than this is left behind them
+#define MIN_FREE_SPACE (64 * 1024)
+
+#ifndef Q_OS_ANDROID
+// Gives path the content of a file which is in the destination directory
+// already, as a hard link, else as a copy-on-write clone where the file
+// system supports it, else as a plain copy
+static bool linkLocalFile(const QString &existing, const QString &path) {
+#if defined(Q_OS_UNIX)
+    if (link(QFile::encodeName(existing).constData(), QFile::encodeName(path).constData()) == 0) {
+        return true;
+    }
+#endif
+#if defined(Q_OS_LINUX) && defined(FICLONE)
+    QFile source(existing);
+    QFile target(path);
+    if (source.open(QFile::ReadOnly) && target.open(QFile::WriteOnly)) {
+        if (ioctl(target.handle(), FICLONE, source.handle()) == 0) {
+            return true;
+        }
+        target.remove();
+    }
+#endif
+    return QFile::copy(existing, path);
+}
+#endif
 
-Receiver::Receiver(QTcpSocket *socket, const QString &destDir, QObject *parent) : QObject(parent), socket(socket), destDir(destDir) {
+Receiver::Receiver(QTcpSocket *socket, const QString &destDir, QObject *parent) : QObject(parent), socket(socket), destDir(destDir), paceTimer(new QTimer(this)), progressTimer(new QTimer(this)) {
+    // keep the socket in the same thread as the receiver
+    socket->setParent(this);
+    // data the receiver does not take, while the disk or the rate limit holds
+    // it back, stays in the kernel buffer so that the sender slows down
+    socket->setReadBufferSize(MAX_BUFFER_SIZE);
+    paceTimer->setSingleShot(true);
+    connect(paceTimer, &QTimer::timeout, this, &Receiver::processData);
+    progressTimer->setSingleShot(true);
+    connect(progressTimer, &QTimer::timeout, this, [this]() {
+        reportProgress();
+    });
     connect(socket, &QTcpSocket::readyRead, this, &Receiver::processData);
 #if QT_VERSION >= QT_VERSION_CHECK(5, 15, 0)
     connect(socket, &QTcpSocket::errorOccurred, this, &Receiver::connectionError);
@@ -40,19 +109,63 @@ Receiver::Receiver(QTcpSocket *socket, const QString &destDir, QObject *parent)
 #ifdef Q_OS_ANDROID
     screenOn = new AndroidScreenOn();
 #endif
+    // the connection is there already, what is timed is the handshake
+    stats.start(false, socket->peerAddress().toString());
+    stats.enter(TransferStats::PHASE_CONNECT);
+}
+
+void Receiver::setOptions(const TransferOptions &options) {
+    this->options = options;
+    progressThrottle.setRate(options.progressRate);
+}
+
+qint64 Receiver::newSessionToken() {
+#if QT_VERSION >= QT_VERSION_CHECK(5, 10, 0)
+    return static_cast<qint64>(QRandomGenerator::global()->generate64());
+#else
+    return (static_cast<qint64>(qrand()) << 32) ^ qrand() ^ QDateTime::currentMSecsSinceEpoch();
+#endif
+}
 
-    if (socket->bytesAvailable()) {
+void Receiver::setSessionToken(qint64 token) {
+    sessionToken = token;
+}
+
+void Receiver::setRateLimiter(RateLimiter *limiter) {
+    this->limiter = limiter;
+    limiter->addConsumer(this, socket->peerAddress().toString());
+}
+
+void Receiver::hold() {
+    held = true;
+}
+
+void Receiver::release() {
+    held = false;
+    if (socket != nullptr) {
+        processData();
+    }
+}
+
+void Receiver::start() {
+    if (socket != nullptr && socket->bytesAvailable()) {
         processData();
     }
 }
 
 
 Receiver::~Receiver() {
-    if (socket != nullptr) {
-        socket->disconnect(this);
-        socket->deleteLater();
-    }
+    abort();
+#ifdef Q_OS_ANDROID
     delete currentFile;
+#else
+    if (currentFile != nullptr) {
+        writer->closeFile(currentFile);
+    }
+    // waits for the queued data
+    delete writer;
+    delete currentDeltaBase;
+#endif
 #ifdef Q_OS_ANDROID
     delete screenOn;
 #endif
@@ -63,18 +176,19 @@ void Receiver::abort() {
     if (socket != nullptr) {
         socket->disconnect(this);
         socket->abort();
-        socket->deleteLater();
-        socket = nullptr;
     }
+    terminateConnection();
 }
 
 void Receiver::processData() {
     /*
+     * [extension handshake, see transferoptions.h]
      * total element count
      * total element size
      * first element {
      *   element name
      *   element size
+     *   [element flags]
      *   element data
      * }
      * second element {
@@ -82,15 +196,24 @@ void Receiver::processData() {
      * }
      * ...
      */
-    while (socket->bytesAvailable() > 0) {
+    // headers are parsed from inBuffer in place, so that thousands of small
+    // elements do not cost thousands of calls into QTcpSocket
+    while (socket != nullptr && fillBuffer()) {
+        if (held && recvStatus == PHASE_ELEMENT_NAME) {
+            // queued, the elements follow after release()
+            return;
+        }
         switch (recvStatus) {
             case PHASE_TOTAL_ELEMENTS: {
-                if (socket->bytesAvailable() < static_cast<qint64>(sizeof(sessionElements))) {
+                if (take(&sessionElements, sizeof(sessionElements)) == false) {
                     // wait for more data
                     return;
                 }
-                socket->read(reinterpret_cast<char*>(&sessionElements), sizeof(sessionElements));
-                if (sessionElements <= 0) {
+                if (sessionElements == TransferOptions::HANDSHAKE_MAGIC && handshakeDone == false) {
+                    recvStatus = PHASE_HANDSHAKE;
+                    break;
+                }
+                if (sessionElements <= 0 && (sessionElements != -1 || (sessionFeatures & TransferOptions::FEATURE_STREAMED_LIST) == 0)) {
                     // invalid data
                     terminateConnection();
                     return;
@@ -98,13 +221,54 @@ void Receiver::processData() {
                 recvStatus = PHASE_TOTAL_SIZE;
                 break;
             }
+            case PHASE_HANDSHAKE: {
+                // offered features, [transfer id]
+                qint64 request[2];
+                if (buffered() < static_cast<qint64>(sizeof(qint64))) {
+                    // wait for more data
+                    return;
+                }
+                memcpy(request, inBuffer.constData() + inPos, sizeof(qint64));
+                qint64 requestSize = (request[0] & TransferOptions::FEATURE_RESUME) ? sizeof(qint64) * 2 : sizeof(qint64);
+                if (take(request, requestSize) == false) {
+                    // wait for more data
+                    return;
+                }
+                sessionFeatures = request[0] & options.receiveFeatures & TransferOptions::supportedFeatures();
+                if (sessionToken == 0) {
+                    sessionToken = newSessionToken();
+                }
+                QByteArray reply(reinterpret_cast<char*>(&sessionFeatures), sizeof(sessionFeatures));
+                reply.append(reinterpret_cast<char*>(&sessionToken), sizeof(sessionToken));
+                if (sessionFeatures & TransferOptions::FEATURE_RESUME) {
+                    loadCheckpoint(request[1]);
+                    reply.append(reinterpret_cast<char*>(&resumeElements), sizeof(resumeElements));
+                    reply.append(reinterpret_cast<char*>(&resumeOffset), sizeof(resumeOffset));
+                }
+                socket->write(reply);
+                handshakeDone = true;
+                recvStatus = (sessionFeatures & (TransferOptions::FEATURE_DEDUP | TransferOptions::FEATURE_DELTA)) ? PHASE_DEDUP_MANIFEST : PHASE_TOTAL_ELEMENTS;
+                break;
+            }
+            case PHASE_DEDUP_MANIFEST:
+                if (readDedupManifest() == false) {
+                    return;
+                }
+                break;
+            case PHASE_DEDUP_HASHING:
+                // wait for dedupHashed()
+                return;
+            case PHASE_DEDUP_ELEMENTS:
+                if (readDedupElements() == false) {
+                    return;
+                }
+                break;
             case PHASE_TOTAL_SIZE: {
-                if (socket->bytesAvailable() < static_cast<qint64>(sizeof(sessionBytes))) {
+                if (take(&sessionBytes, sizeof(sessionBytes)) == false) {
                     // wait for more data
                     return;
                 }
-                socket->read(reinterpret_cast<char*>(&sessionBytes), sizeof(sessionBytes));
-                if (sessionBytes < 0) {
+                if (sessionBytes < 0 && (sessionBytes != -1 || sessionElements != -1)) {
                     // invalid data
                     terminateConnection();
                     return;
@@ -114,140 +278,966 @@ void Receiver::processData() {
                 break;
             }
             case PHASE_ELEMENT_NAME: {
-                char c;
-                while (true) {
-                    if (socket->read(&c, sizeof(c)) < static_cast<qint64>(sizeof(c))) {
-                        // wait for more data
+                stats.enter(TransferStats::PHASE_HEADER);
+                const char *name = inBuffer.constData() + inPos;
+                const char *end = static_cast<const char*>(memchr(name, '\0', buffered()));
+                if (end == nullptr) {
+                    if (buffered() > MAX_NAME_SIZE) {
+                        // invalid data;
+                        terminateSession(QStringLiteral("received invalid data from %1").arg(socket->peerAddress().toString()));
                         return;
                     }
-                    if (c == '\0') {
-                        currentElementName = QString::fromUtf8(readBuffer);
-                        readBuffer.clear();
-                        if (currentElementName.isEmpty()) {
-                            // invalid data;
-                            terminateSession(QStringLiteral("received invalid data from %1").arg(socket->peerAddress().toString()));
-                            return;
-                        }
-                        recvStatus = PHASE_ELEMENT_SIZE;
-                        break;
-                    } else {
-                        readBuffer.append(c);
-                    }
+                    // wait for more data
+                    return;
+                }
+                currentElementName = QString::fromUtf8(name, static_cast<int>(end - name));
+                inPos += static_cast<int>(end - name) + 1;
+                if (currentElementName.isEmpty()) {
+                    // invalid data;
+                    terminateSession(QStringLiteral("received invalid data from %1").arg(socket->peerAddress().toString()));
+                    return;
+                }
+                recvStatus = PHASE_ELEMENT_SIZE;
+                if (currentElementName != totalsElementName) {
+                    reportItem(sessionElements, sessionElementsReceived + 1, (currentElementName == textElementName ? QStringLiteral("Text snippet") : currentElementName));
                 }
-                emit itemProgress(sessionElements, sessionElementsReceived + 1, (currentElementName == textElementName ? QStringLiteral("Text snippet") : currentElementName));
                 break;
             }
             case PHASE_ELEMENT_SIZE: {
-                if (socket->bytesAvailable() < static_cast<qint64>(sizeof(currentElementBytes))) {
+                if (take(&currentElementBytes, sizeof(currentElementBytes)) == false) {
                     // wait for more data
                     return;
                 }
-                socket->read(reinterpret_cast<char*>(&currentElementBytes), sizeof(qint64));
                 if (currentElementBytes < -1) {
                     // invalid data;
                     terminateSession(QStringLiteral("received invalid data from %1").arg(socket->peerAddress().toString()));
                     return;
                 }
-
-                if (currentElementName == textElementName) {
-                    // text
-                    currentElementType = TEXT_ELEMENT;
-                    currentElementReceived = 0;
-                    recvStatus = PHASE_ELEMENT_DATA;
-                } else if (currentElementBytes == -1) {
-                    // directory
-                    currentElementType = DIR_ELEMENT;
-                    if (prepareFilesystem() == false) {
+                currentElementStreams = 1;
+                currentElementCompressed = false;
+                currentElementDelta = false;
+                if ((sessionFeatures & TransferOptions::elementFlagFeatures()) && currentElementBytes >= 0) {
+                    recvStatus = PHASE_ELEMENT_FLAGS;
+                    break;
+                }
+                if (beginElement() == false) {
+                    return;
+                }
+                break;
+            }
+            case PHASE_ELEMENT_FLAGS: {
+                qint64 flags;
+                if (take(&flags, sizeof(flags)) == false) {
+                    // wait for more data
+                    return;
+                }
+                currentElementStreams = std::max<int>(1, flags & TransferOptions::ELEMENT_STREAMS_MASK);
+                currentElementCompressed = (flags & TransferOptions::ELEMENT_COMPRESSED) != 0;
+                currentElementDelta = (flags & TransferOptions::ELEMENT_DELTA) != 0;
+                if ((currentElementStreams > 1 && (currentElementName == textElementName || (sessionFeatures & TransferOptions::FEATURE_MULTI_STREAM) == 0))
+                        || (currentElementCompressed && (currentElementStreams > 1 || (sessionFeatures & TransferOptions::FEATURE_COMPRESSION) == 0))
+                        || (currentElementDelta && (currentElementStreams > 1 || currentElementCompressed || currentElementBytes == 0
+                                                    || (sessionFeatures & TransferOptions::FEATURE_DELTA) == 0
+                                                    || currentElementName == textElementName || currentElementName == totalsElementName
+                                                    || deltaBases.contains(sessionElementsReceived) == false
+                                                    || dedupCopies.contains(sessionElementsReceived)))) {
+                    // invalid data;
+                    terminateSession(QStringLiteral("received invalid data from %1").arg(socket->peerAddress().toString()));
+                    return;
+                }
+                if (beginElement() == false) {
+                    return;
+                }
+                break;
+            }
+            case PHASE_ELEMENT_DATA: {
+                stats.enter(TransferStats::PHASE_DATA);
+#ifndef Q_OS_ANDROID
+                if (currentElementType == FILE_ELEMENT && writer->isFull()) {
+                    // leave the data in the socket until diskDrained(), the sender slows down
+                    stats.setBlocked(true);
+                    return;
+                }
+                stats.setBlocked(false);
+                if (currentElementDelta) {
+                    if (readDelta() == false) {
                         return;
                     }
-                    if (currentElementName.contains(QChar('/')) == false) {
-                        emit dirReceived(currentTopElementName, currentTopElementPath);
+                    break;
+                }
+#endif
+                const char *d;
+                int size;
+                QByteArray decoded;
+                if (currentElementCompressed) {
+                    if (buffered() < Compression::HEADER_SIZE) {
+                        // wait for more data
+                        return;
                     }
-                    sessionElementsReceived++;
-                    if (sessionElementsReceived < sessionElements) {
-                        recvStatus = PHASE_ELEMENT_NAME;
-                        break;
-                    } else {
-                        endSession();
+                    qint64 frameSize = Compression::frameSize(inBuffer.constData() + inPos);
+                    if (frameSize < 0) {
+                        terminateSession(QStringLiteral("received invalid data from %1").arg(socket->peerAddress().toString()));
                         return;
                     }
-                } else {
-                    // file
-                    currentElementType = FILE_ELEMENT;
-                    if (prepareFilesystem() == false) {
+                    if (buffered() < frameSize) {
+                        // wait for the whole frame
                         return;
                     }
-                    currentElementReceived = 0;
-                    recvStatus = PHASE_ELEMENT_DATA;
+                    QByteArray frame = inBuffer.mid(inPos, static_cast<int>(frameSize));
+                    inPos += static_cast<int>(frameSize);
+                    if (Compression::decodeFrame(frame, decoded) == false || decoded.size() > currentElementDataBytes - currentElementReceived) {
+                        terminateSession(QStringLiteral("received invalid data from %1").arg(socket->peerAddress().toString()));
+                        return;
+                    }
+                    sessionBytesSaved += decoded.size() - frame.size();
+                    d = decoded.constData();
+                    size = decoded.size();
+                } else {
+                    // small elements are written straight from the buffer
+                    d = inBuffer.constData() + inPos;
+                    size = static_cast<int>(std::min<qint64>(currentElementDataBytes - currentElementReceived, buffered()));
+                    inPos += size;
                 }
-                if (currentElementBytes > 0) {
-                    break;
+                currentElementReceived += size;
+                if (currentElementType != TOTALS_ELEMENT) {
+                    currentElementChecksum.update(d, size);
+                    sessionBytesReceived += size;
+                    reportProgress();
                 }
-                // an empty file, go to PHASE_ELEMENT_DATA
-            }
-            // fall through
-            case PHASE_ELEMENT_DATA: {
-                if (currentElementBytes > 0) {
-                    QByteArray d = socket->read(std::min<qint64>(currentElementBytes - currentElementReceived, 1024 * 1024));
-                    currentElementReceived += d.size();
-                    sessionBytesReceived += d.size();
-                    emit progress(sessionBytes, sessionBytesReceived);
-
-                    if (currentElementType == TEXT_ELEMENT) {
-                        readBuffer.append(d);
-                    } else {
+
+                if (currentElementType != FILE_ELEMENT) {
+                    readBuffer.append(d, size);
+                } else {
 #ifdef Q_OS_ANDROID
-                        if (currentFile->write(d) == false) {
+                    if (currentFile->write(d, size) == false) {
+                        terminateSession(QStringLiteral("Failed to write to %1").arg(currentElementName));
+                        return;
+                    }
 #else
-                        if (currentFile->write(d) < d.size()) {
-#endif
-                            terminateSession(QStringLiteral("Failed to write to %1").arg(currentElementName));
-                            return;
-                        }
+                    bool queued;
+                    if (currentElementCompressed) {
+                        queued = writer->write(currentFile, decoded);
+                    } else {
+                        // the writer shares inBuffer instead of copying the data
+                        queued = writer->write(currentFile, inBuffer, static_cast<int>(d - inBuffer.constData()), size);
                     }
+                    if (queued == false) {
+                        terminateSession(writer->error());
+                        return;
+                    }
+#endif
                 }
 
-                if (currentElementReceived == currentElementBytes) {
-                    // received all bytes
-                    sessionElementsReceived++;
-                    if (currentElementType == TEXT_ELEMENT) {
-                        // text
-                        emit textReceived(QString::fromUtf8(readBuffer));
-                        readBuffer.clear();
-                    } else {
-                        // file
-                        if (currentElementName.contains(QChar('/')) == false) {
-                            emit fileReceived(currentTopElementName, currentTopElementPath, currentElementBytes);
-                        }
-                        currentFile->close();
-                        delete currentFile;
-                        currentFile = nullptr;
-                    }
-                    if (sessionElementsReceived < sessionElements) {
-                        recvStatus = PHASE_ELEMENT_NAME;
-                    } else {
-                        endSession();
+                if (currentElementReceived == currentElementDataBytes) {
+                    if (endElementData() == false) {
                         return;
                     }
+                } else if (journal != nullptr && sessionBytesReceived - checkpointBytes >= 64 * 1024 * 1024) {
+                    // limit the loss if the process itself dies
+                    saveCheckpoint();
                 }
                 break;
             }
+            case PHASE_ELEMENT_CHECKSUM: {
+                quint64 hash;
+                if (take(&hash, sizeof(hash)) == false) {
+                    // wait for more data
+                    return;
+                }
+                if (hash != currentElementChecksum.digest()) {
+                    // what has been written can not be trusted, a resume starts the element over
+                    currentElementReceived = 0;
+                    terminateSession(QStringLiteral("%1 has been corrupted in transit").arg(currentElementName));
+                    return;
+                }
+                if (completeElement() == false) {
+                    return;
+                }
+                break;
+            }
+            case PHASE_WAIT_STREAMS:
+                // the session connection goes on after all ranges are received
+                return;
+            case PHASE_WAIT_DISK:
+                // finished by diskMarkerReached()
+                return;
+        }
+    }
+}
+
+qint64 Receiver::buffered() const {
+    return inEnd - inPos;
+}
+
+// Reads what the socket has received into the free space of inBuffer, returns
+// false if nothing is left to parse
+bool Receiver::fillBuffer() {
+    qint64 available = socket->bytesAvailable();
+    if (available > 0 && buffered() < MAX_BUFFER_SIZE) {
+        if (inBuffer.size() < MAX_BUFFER_SIZE || inBuffer.isDetached() == false) {
+            // the writer still holds slices of inBuffer, which must not change
+            // under it, so reading goes on in another buffer
+            if (switchBuffer() == false) {
+                return buffered() > 0;
+            }
+        }
+        if (inPos == inEnd) {
+            inPos = 0;
+            inEnd = 0;
+        } else if (MAX_BUFFER_SIZE - inEnd < MIN_FREE_SPACE && inPos > 0) {
+            // the unparsed tail, part of a header or a frame, is moved
+            memmove(inBuffer.data(), inBuffer.constData() + inPos, buffered());
+            inEnd -= inPos;
+            inPos = 0;
+        }
+        qint64 wanted = std::min<qint64>(available, MAX_BUFFER_SIZE - inEnd);
+        // what is left once the sender has closed the connection is taken at once
+        if (limiter != nullptr && handshakeDone && socket->state() == QAbstractSocket::ConnectedState) {
+            int waitMs = 0;
+            wanted = std::min(wanted, limiter->acquire(this, waitMs));
+            if (wanted == 0 && paceTimer->isActive() == false) {
+                // over the rate, go on once it allows more
+                paceTimer->start(waitMs);
+            }
+        }
+        qint64 read = (wanted > 0 ? socket->read(inBuffer.data() + inEnd, wanted) : 0);
+        if (read > 0) {
+            if (limiter != nullptr) {
+                limiter->consume(this, read);
+            }
+            inEnd += static_cast<int>(read);
+        }
+    }
+    return buffered() > 0;
+}
+
+// Moves the unparsed bytes to a buffer no slice of the writer refers to, the
+// buffers it has written are taken again; returns false if all of them are
+// still queued, diskDrained() goes on once one is free
+bool Receiver::switchBuffer() {
+    QByteArray next;
+    for (int i = 0; i < spareBuffers.size(); i++) {
+        if (spareBuffers.at(i).isDetached()) {
+            next = spareBuffers.takeAt(i);
+            break;
+        }
+    }
+    if (next.isNull()) {
+        // about as much memory as the writer queue is allowed
+        int maxBuffers = static_cast<int>(std::max<qint64>(2, options.writeBufferSize / MAX_BUFFER_SIZE + 1));
+        if (spareBuffers.size() + 1 >= maxBuffers) {
+#ifndef Q_OS_ANDROID
+            if (writer != nullptr && writer->notifyNextJob()) {
+                waitingForBuffer = true;
+                return false;
+            }
+#endif
+            // the writer is done with all of them
+            next = spareBuffers.takeFirst();
+        } else {
+            next = QByteArray(MAX_BUFFER_SIZE, Qt::Uninitialized);
+        }
+    }
+    if (buffered() > 0) {
+        memcpy(next.data(), inBuffer.constData() + inPos, buffered());
+    }
+    inEnd -= inPos;
+    inPos = 0;
+    if (inBuffer.size() == MAX_BUFFER_SIZE) {
+        spareBuffers.append(inBuffer);
+    }
+    inBuffer.swap(next);
+    waitingForBuffer = false;
+    return true;
+}
+
+// Tells the progress and the timings now and then, final tells it in any case
+void Receiver::reportProgress(bool final) {
+    stats.progress(sessionBytes, sessionBytesReceived, sessionBytesReceived - sessionBytesSaved);
+    if (progressThrottle.pass(final)) {
+        progressTimer->stop();
+        if (itemPending) {
+            itemPending = false;
+            emit itemProgress(itemTotal, itemCurrent, itemName);
+        }
+        emit progress(sessionBytes, sessionBytesReceived, sessionBytesReceived - sessionBytesSaved);
+    } else if (progressTimer->isActive() == false) {
+        // the held value is let through later if nothing else comes
+        progressTimer->start(static_cast<int>(progressThrottle.remaining()));
+    }
+    stats.setUpdates(progressThrottle.passed(), progressThrottle.held());
+    if (final == false && stats.due()) {
+        emit statsUpdated(stats);
+    }
+}
+
+// Tells the element being received along with the progress, only the last
+// one of those held back by the throttle is let through
+void Receiver::reportItem(qint64 total, qint64 current, const QString &name) {
+    itemPending = true;
+    itemTotal = total;
+    itemCurrent = current;
+    itemName = name;
+    reportProgress();
+}
+
+bool Receiver::take(void *dest, qint64 size) {
+    if (buffered() < size) {
+        return false;
+    }
+    memcpy(dest, inBuffer.constData() + inPos, size);
+    inPos += static_cast<int>(size);
+    return true;
+}
+
+#ifndef Q_OS_ANDROID
+void Receiver::diskDrained() {
+    if (socket == nullptr) {
+        return;
+    }
+    QString error = writer->error();
+    if (error.isEmpty() == false) {
+        terminateSession(error);
+        return;
+    }
+    processData();
+    if (peerClosed) {
+        connectionClosed();
+    }
+}
+
+void Receiver::diskMarkerReached() {
+    if (socket == nullptr || recvStatus != PHASE_WAIT_DISK) {
+        return;
+    }
+    QString error = writer->error();
+    if (error.isEmpty() == false) {
+        terminateSession(error);
+        return;
+    }
+    finishSession();
+}
+#endif
+
+// Returns false if processData() should stop
+bool Receiver::beginElement() {
+    if (currentElementName == totalsElementName && sessionElements < 0) {
+        // the totals of a streamed list
+        if (currentElementBytes != static_cast<qint64>(sizeof(qint64) * 2) || currentElementStreams > 1 || currentElementCompressed) {
+            terminateSession(QStringLiteral("received invalid data from %1").arg(socket->peerAddress().toString()));
+            return false;
+        }
+        currentElementType = TOTALS_ELEMENT;
+        currentElementReceived = 0;
+        currentElementDataBytes = currentElementBytes;
+        currentRangesPending = 0;
+        recvStatus = PHASE_ELEMENT_DATA;
+        return true;
+    }
+    if (sessionElementsReceived < resumeElements) {
+        // received in an earlier session, the sender skips its data
+        if (currentElementBytes > 0) {
+            sessionBytesReceived += currentElementBytes;
+            reportProgress();
+        }
+        sessionElementsReceived++;
+        return nextElement();
+    }
+    if (currentElementName == textElementName) {
+        // text
+        currentElementType = TEXT_ELEMENT;
+    } else if (currentElementBytes == -1) {
+        // directory
+        currentElementType = DIR_ELEMENT;
+        if (prepareFilesystem() == false) {
+            return false;
+        }
+        if (currentElementName.contains(QChar('/')) == false) {
+            emit dirReceived(currentTopElementName, currentTopElementPath);
+        }
+        sessionElementsReceived++;
+        return nextElement();
+    } else {
+        // file
+        currentElementType = FILE_ELEMENT;
+        currentElementCopied = false;
+        if (prepareFilesystem() == false) {
+            return false;
+        }
+        if (currentElementCopied) {
+            // the sender skips the data, it has been taken from the local copy
+            sessionBytesReceived += currentElementBytes;
+            sessionBytesSaved += currentElementBytes;
+            reportProgress();
+            sessionElementsReceived++;
+            if (currentElementName.contains(QChar('/')) == false) {
+                emit fileReceived(currentTopElementName, currentTopElementPath, currentElementBytes);
+            }
+            return nextElement();
+        }
+    }
+    currentElementReceived = 0;
+    currentElementChecksum.reset();
+    if (currentElementType == FILE_ELEMENT && sessionElementsReceived == resumeElements && resumeOffset > 0) {
+        // the sender continues from the checkpoint
+        if (currentElementStreams > 1 || resumeOffset > currentElementBytes) {
+            terminateSession(QStringLiteral("received invalid data from %1").arg(socket->peerAddress().toString()));
+            return false;
+        }
+        currentElementReceived = resumeOffset;
+        sessionBytesReceived += resumeOffset;
+        reportProgress();
+    }
+    currentElementDataBytes = currentElementBytes / currentElementStreams;
+    currentRangesPending = currentElementStreams - 1;
+    currentRangesStarted.clear();
+    recvStatus = PHASE_ELEMENT_DATA;
+#ifndef Q_OS_ANDROID
+    if (currentElementStreams > 1) {
+        processStreams();
+        if (socket == nullptr) {
+            return false;
+        }
+    }
+#endif
+    if (currentElementReceived == currentElementDataBytes) {
+        // an empty element, or nothing left of it
+        return endElementData();
+    }
+    return true;
+}
+
+// Returns false if processData() should stop
+bool Receiver::endElementData() {
+    if ((sessionFeatures & TransferOptions::FEATURE_CHECKSUM) && currentElementType != TOTALS_ELEMENT) {
+        // the hash of the data follows
+        recvStatus = PHASE_ELEMENT_CHECKSUM;
+        return true;
+    }
+    return completeElement();
+}
+
+// Returns false if processData() should stop
+bool Receiver::completeElement() {
+    if (currentRangesPending > 0) {
+        recvStatus = PHASE_WAIT_STREAMS;
+        return false;
+    }
+    // received all bytes
+    if (currentElementType == TOTALS_ELEMENT) {
+        // the end of a streamed list
+        qint64 totals[2];
+        memcpy(totals, readBuffer.constData(), sizeof(totals));
+        readBuffer.clear();
+        if (totals[0] < sessionElementsReceived || totals[1] < sessionBytesReceived) {
+            terminateSession(QStringLiteral("received invalid data from %1").arg(socket->peerAddress().toString()));
+            return false;
+        }
+        sessionElements = totals[0];
+        sessionBytes = totals[1];
+        emit started(sessionBytes);
+        reportProgress();
+    } else if (currentElementType == TEXT_ELEMENT) {
+        // text
+        sessionElementsReceived++;
+        emit textReceived(QString::fromUtf8(readBuffer));
+        readBuffer.clear();
+    } else {
+        // file
+        sessionElementsReceived++;
+        if (currentElementName.contains(QChar('/')) == false) {
+            emit fileReceived(currentTopElementName, currentTopElementPath, currentElementBytes);
+        }
+#ifdef Q_OS_ANDROID
+        currentFile->close();
+        delete currentFile;
+#else
+        delete currentDeltaBase;
+        currentDeltaBase = nullptr;
+        // closed by the writer once its data is written
+        if (writer->closeFile(currentFile) == false) {
+            currentFile = nullptr;
+            terminateSession(writer->error());
+            return false;
+        }
+#endif
+        currentFile = nullptr;
+    }
+    currentElementStreams = 1;
+    return nextElement();
+}
+
+// Returns false if processData() should stop
+bool Receiver::nextElement() {
+    if (sessionElements < 0 || sessionElementsReceived < sessionElements) {
+        // more elements, or the totals are not known yet
+        recvStatus = PHASE_ELEMENT_NAME;
+        return true;
+    }
+    endSession();
+    return false;
+}
+
+// Reads the element count or one entry of the manifest of the sender,
+// returns false if processData() should stop
+bool Receiver::readDedupManifest() {
+    if (dedupEntries < 0) {
+        if (take(&dedupEntries, sizeof(dedupEntries)) == false) {
+            // wait for more data
+            return false;
+        }
+        if (dedupEntries < 0) {
+            terminateSession(QStringLiteral("received invalid data from %1").arg(socket->peerAddress().toString()));
+            return false;
+        }
+    } else {
+        // element index, size, name
+        qint64 entry[2];
+        const qint64 entrySize = sizeof(entry);
+        if (buffered() <= entrySize) {
+            // wait for more data
+            return false;
+        }
+        const char *name = inBuffer.constData() + inPos + entrySize;
+        const char *end = static_cast<const char*>(memchr(name, '\0', buffered() - entrySize));
+        if (end == nullptr) {
+            if (buffered() > MAX_NAME_SIZE + entrySize) {
+                // invalid data
+                terminateSession(QStringLiteral("received invalid data from %1").arg(socket->peerAddress().toString()));
+                return false;
+            }
+            // wait for more data
+            return false;
+        }
+        memcpy(entry, inBuffer.constData() + inPos, sizeof(entry));
+        QString elementName = QString::fromUtf8(name, static_cast<int>(end - name));
+        inPos += static_cast<int>(entrySize + (end - name) + 1);
+        dedupEntries--;
+#ifndef Q_OS_ANDROID
+        // only plain relative names, of elements not started in an earlier session
+        QString cleanName = QDir::cleanPath(elementName);
+        bool resumed = entry[0] < resumeElements || (entry[0] == resumeElements && resumePath.isEmpty() == false);
+        if (resumed == false && entry[1] > 0 && cleanName == elementName && QDir::isRelativePath(cleanName)
+                && cleanName != QStringLiteral("..") && cleanName.startsWith(QStringLiteral("../")) == false) {
+            // with FEATURE_DELTA, an older copy of another size is of use too
+            QFileInfo local(QDir(destDir).filePath(elementName));
+            bool sameSize = (local.size() == entry[1]) && (sessionFeatures & TransferOptions::FEATURE_DEDUP);
+            if (local.isFile() && local.size() > 0 && (sameSize || (sessionFeatures & TransferOptions::FEATURE_DELTA))) {
+                dedupCandidates.insert(entry[0], local.absoluteFilePath());
+                if (sameSize) {
+                    dedupSameSize.insert(entry[0]);
+                }
+            }
+        }
+#endif
+    }
+    if (dedupEntries == 0) {
+        // the sender waits for the answer now, the candidates are hashed away from the transfer thread
+        recvStatus = PHASE_DEDUP_HASHING;
+        stats.begin(TransferStats::PHASE_SCAN);
+        hasher = new FileHasher(this);
+        connect(hasher, &FileHasher::finished, this, &Receiver::dedupHashed);
+        QSet<qint64> signatureIds;
+        if (sessionFeatures & TransferOptions::FEATURE_DELTA) {
+            const QList<qint64> ids = dedupCandidates.keys();
+            for (qint64 id : ids) {
+                signatureIds.insert(id);
+            }
+        }
+        hasher->start(dedupCandidates, signatureIds);
+        return false;
+    }
+    return true;
+}
+
+void Receiver::dedupHashed() {
+    if (hasher == nullptr || socket == nullptr) {
+        return;
+    }
+    QHash<qint64, quint64> hashes = hasher->results();
+    QHash<qint64, QByteArray> signatures = hasher->signatures();
+    hasher->deleteLater();
+    stats.end(TransferStats::PHASE_SCAN);
+    hasher = nullptr;
+    QByteArray reply;
+    if (sessionFeatures & TransferOptions::FEATURE_DEDUP) {
+        QByteArray entries;
+        qint64 count = 0;
+        for (auto it = hashes.constBegin(); it != hashes.constEnd(); ++it) {
+            if (dedupSameSize.contains(it.key())) {
+                qint64 entry[2] = { it.key(), static_cast<qint64>(it.value()) };
+                entries.append(reinterpret_cast<char*>(entry), sizeof(entry));
+                count++;
+            }
+        }
+        reply.append(reinterpret_cast<char*>(&count), sizeof(count));
+        reply.append(entries);
+    }
+    if (sessionFeatures & TransferOptions::FEATURE_DELTA) {
+        qint64 count = signatures.size();
+        QByteArray entries(reinterpret_cast<char*>(&count), sizeof(count));
+        for (auto it = signatures.constBegin(); it != signatures.constEnd(); ++it) {
+            qint64 index = it.key();
+            entries.append(reinterpret_cast<char*>(&index), sizeof(index));
+            entries.append(it.value());
+            deltaBases.insert(index, dedupCandidates.value(index));
+        }
+        qint64 bytes = entries.size();
+        reply.append(reinterpret_cast<char*>(&bytes), sizeof(bytes));
+        reply.append(entries);
+    }
+    socket->write(reply);
+    // only the files of the same size which could be read are offered for skipping
+    for (auto it = dedupCandidates.begin(); it != dedupCandidates.end();) {
+        if (hashes.contains(it.key()) && dedupSameSize.contains(it.key())) {
+            ++it;
+        } else {
+            it = dedupCandidates.erase(it);
+        }
+    }
+    dedupSameSize.clear();
+    dedupEntries = -1;
+    recvStatus = (sessionFeatures & TransferOptions::FEATURE_DEDUP) ? PHASE_DEDUP_ELEMENTS : PHASE_TOTAL_ELEMENTS;
+    processData();
+}
+
+// Reads the count or one of the elements the sender skips, returns false if processData() should stop
+bool Receiver::readDedupElements() {
+    if (dedupEntries < 0) {
+        if (take(&dedupEntries, sizeof(dedupEntries)) == false) {
+            // wait for more data
+            return false;
+        }
+        if (dedupEntries < 0 || dedupEntries > dedupCandidates.size()) {
+            terminateSession(QStringLiteral("received invalid data from %1").arg(socket->peerAddress().toString()));
+            return false;
+        }
+    } else {
+        qint64 index;
+        if (take(&index, sizeof(index)) == false) {
+            // wait for more data
+            return false;
+        }
+        if (dedupCandidates.contains(index) == false) {
+            terminateSession(QStringLiteral("received invalid data from %1").arg(socket->peerAddress().toString()));
+            return false;
+        }
+        dedupCopies.insert(index, dedupCandidates.value(index));
+        dedupEntries--;
+    }
+    if (dedupEntries == 0) {
+        dedupCandidates.clear();
+        recvStatus = PHASE_TOTAL_ELEMENTS;
+    }
+    return true;
+}
+
+#ifndef Q_OS_ANDROID
+// Applies a piece of the delta instructions of the current element,
+// returns false if processData() should stop
+bool Receiver::readDelta() {
+    QByteArray data;
+    if (currentDeltaCopyLeft > 0) {
+        // a piece of the blocks taken from the older copy
+        if (currentDeltaBase->seek(currentDeltaCopyPos)) {
+            data = currentDeltaBase->read(std::min<qint64>(currentDeltaCopyLeft, 1024 * 1024));
+        }
+        if (data.isEmpty()) {
+            terminateSession(QStringLiteral("Can not read %1").arg(currentDeltaBase->fileName()));
+            return false;
+        }
+        currentDeltaCopyPos += data.size();
+        currentDeltaCopyLeft -= data.size();
+        sessionBytesSaved += data.size();
+    } else if (currentDeltaLiteral > 0) {
+        int size = static_cast<int>(std::min<qint64>(currentDeltaLiteral, buffered()));
+        data = inBuffer.mid(inPos, size);
+        inPos += size;
+        currentDeltaLiteral -= size;
+    } else {
+        qint64 op;
+        if (buffered() < static_cast<qint64>(sizeof(op))) {
+            // wait for more data
+            return false;
+        }
+        memcpy(&op, inBuffer.constData() + inPos, sizeof(op));
+        qint64 left = currentElementBytes - currentElementReceived;
+        if (op == 0) {
+            // end of the element
+            inPos += sizeof(op);
+            if (left != 0) {
+                terminateSession(QStringLiteral("received invalid data from %1").arg(socket->peerAddress().toString()));
+                return false;
+            }
+            return endElementData();
+        } else if (op > 0) {
+            // literal
+            inPos += sizeof(op);
+            if (op > left) {
+                terminateSession(QStringLiteral("received invalid data from %1").arg(socket->peerAddress().toString()));
+                return false;
+            }
+            currentDeltaLiteral = op;
+            return true;
+        }
+        // copy of blocks
+        qint64 copy[2];
+        if (take(copy, sizeof(copy)) == false) {
+            // wait for more data
+            return false;
+        }
+        qint64 baseSize = currentDeltaBase->size();
+        qint64 blockSize = DeltaSignature::blockSizeFor(baseSize);
+        qint64 first = -(copy[0] + 1);
+        if (first < 0 || copy[1] <= 0 || first >= (baseSize + blockSize - 1) / blockSize
+                || copy[1] > (baseSize + blockSize - 1) / blockSize - first) {
+            terminateSession(QStringLiteral("received invalid data from %1").arg(socket->peerAddress().toString()));
+            return false;
         }
+        currentDeltaCopyPos = first * blockSize;
+        currentDeltaCopyLeft = std::min(copy[1] * blockSize, baseSize - currentDeltaCopyPos);
+        if (currentDeltaCopyLeft > left) {
+            terminateSession(QStringLiteral("received invalid data from %1").arg(socket->peerAddress().toString()));
+            return false;
+        }
+        return true;
+    }
+    currentElementReceived += data.size();
+    currentElementChecksum.update(data.constData(), data.size());
+    sessionBytesReceived += data.size();
+    reportProgress();
+    if (writer->write(currentFile, data) == false) {
+        terminateSession(writer->error());
+        return false;
+    }
+    return true;
+}
+#endif
+
+void Receiver::addStream(QTcpSocket *stream) {
+    stream->setParent(this);
+    if (socket == nullptr || (sessionFeatures & TransferOptions::FEATURE_MULTI_STREAM) == 0) {
+        dropStream(stream);
+        return;
     }
+    pendingStreams.append(stream);
+    connect(stream, &QTcpSocket::readyRead, this, &Receiver::processStreams);
+    processStreams();
+}
+
+void Receiver::processStreams() {
+    const QList<QTcpSocket*> streams = pendingStreams;
+    for (QTcpSocket *stream : streams) {
+        if (pendingStreams.contains(stream) == false) {
+            // dropped while handling a previous stream
+            continue;
+        }
+        qint64 header[4];
+        qint64 available = stream->bytesAvailable();
+        if (available >= static_cast<qint64>(sizeof(qint64))) {
+            stream->peek(reinterpret_cast<char*>(header), sizeof(qint64));
+            if (header[0] != TransferOptions::STREAM_MAGIC) {
+                // not a stream of this session
+                dropStream(stream);
+                continue;
+            }
+        }
+        if (available < static_cast<qint64>(sizeof(header))) {
+            // wait for more data
+            continue;
+        }
+        stream->peek(reinterpret_cast<char*>(header), sizeof(header));
+        qint64 elementIndex = header[2];
+        qint64 rangeIndex = header[3];
+        if (header[1] != sessionToken || elementIndex < sessionElementsReceived || (sessionElements >= 0 && elementIndex >= sessionElements)) {
+            dropStream(stream);
+            continue;
+        }
+        if (elementIndex > sessionElementsReceived || (recvStatus != PHASE_ELEMENT_DATA && recvStatus != PHASE_ELEMENT_CHECKSUM && recvStatus != PHASE_WAIT_STREAMS)) {
+            // the session connection has not reached this element yet
+            continue;
+        }
+        if (rangeIndex < 1 || rangeIndex >= currentElementStreams || currentRangesStarted.contains(rangeIndex)) {
+            dropStream(stream);
+            continue;
+        }
+        stream->read(reinterpret_cast<char*>(header), sizeof(header));
+        stream->disconnect(this);
+        pendingStreams.removeOne(stream);
+        currentRangesStarted.append(rangeIndex);
+
+#ifdef Q_OS_ANDROID
+        // not supported, see TransferOptions::supportedFeatures()
+        stream->deleteLater();
+#else
+        qint64 offset = currentElementBytes * rangeIndex / currentElementStreams;
+        qint64 length = currentElementBytes * (rangeIndex + 1) / currentElementStreams - offset;
+        prepareWriter();
+        RangeReceiver *range = new RangeReceiver(stream, writer, currentElementPath, offset, length, this);
+        range->setChecksum(sessionFeatures & TransferOptions::FEATURE_CHECKSUM);
+        if (limiter != nullptr) {
+            // the ranges take from the rate of the session
+            range->setRateLimiter(limiter, this);
+        }
+        rangeReceivers.append(range);
+        connect(range, &RangeReceiver::progress, this, [this](qint64 bytes) {
+            sessionBytesReceived += bytes;
+            reportProgress();
+        });
+        connect(range, &RangeReceiver::completed, this, [this, range]() {
+            rangeReceivers.removeOne(range);
+            range->deleteLater();
+            currentRangesPending--;
+            if (currentRangesPending == 0 && recvStatus == PHASE_WAIT_STREAMS) {
+                if (completeElement()) {
+                    processData();
+                }
+            }
+        });
+        connect(range, &RangeReceiver::aborted, this, &Receiver::terminateSession);
+        range->start();
+        if (socket == nullptr) {
+            // session terminated
+            return;
+        }
+#endif
+    }
+}
+
+void Receiver::dropStream(QTcpSocket *stream) {
+    pendingStreams.removeOne(stream);
+    stream->disconnect(this);
+    stream->abort();
+    stream->deleteLater();
+}
+
+void Receiver::loadCheckpoint(qint64 transferId) {
+#ifdef Q_OS_ANDROID
+    // not supported, see TransferOptions::supportedFeatures()
+    Q_UNUSED(transferId)
+#else
+    journal = new ResumeJournal(transferId, destDir);
+    if (journal->load() == false) {
+        return;
+    }
+    resumeElements = journal->elements();
+    resumeOffset = journal->offset();
+    resumePath = journal->path();
+    dirNameMap = journal->dirNameMap();
+    QFileInfo partial(QDir(destDir).filePath(resumePath));
+    if (resumePath.isEmpty() || partial.isFile() == false) {
+        // the partial file is gone, receive the element again
+        resumeOffset = 0;
+        resumePath.clear();
+    } else if (partial.size() < resumeOffset) {
+        resumeOffset = 0;
+    }
+#endif
+}
+
+void Receiver::saveCheckpoint() {
+#ifndef Q_OS_ANDROID
+    qint64 offset = 0;
+    QString path;
+    if (currentFile != nullptr && currentElementType == FILE_ELEMENT) {
+        if (currentElementStreams == 1 && currentElementDelta == false) {
+            // ranges of a multi-stream element are not tracked, neither is the
+            // position of a delta element in its instructions, they start over
+            offset = currentElementReceived;
+        }
+        path = QDir(destDir).relativeFilePath(currentElementPath);
+    }
+    checkpointBytes = sessionBytesReceived;
+    if (writer == nullptr) {
+        journal->save(sessionElementsReceived, offset, path, dirNameMap);
+        return;
+    }
+    // saved once the data received so far is on disk, a copy of the journal is
+    // taken as the receiver may be gone by then; if writing fails the previous
+    // checkpoint is kept
+    ResumeJournal checkpoint = *journal;
+    qint64 elements = sessionElementsReceived;
+    QMap<QString,QString> dirNames = dirNameMap;
+    writer->addTask([checkpoint, elements, offset, path, dirNames]() mutable -> QString {
+        checkpoint.save(elements, offset, path, dirNames);
+        return QString();
+    });
+#endif
 }
 
 void Receiver::endSession() {
+    stats.enter(TransferStats::PHASE_FINALIZATION);
+#ifndef Q_OS_ANDROID
+    if (writer != nullptr) {
+        // completed by diskMarkerReached() once the queued data is on disk
+        recvStatus = PHASE_WAIT_DISK;
+        writer->addMarker();
+        return;
+    }
+#endif
+    finishSession();
+}
+
+void Receiver::finishSession() {
+    if (journal != nullptr) {
+        journal->remove();
+        delete journal;
+        journal = nullptr;
+    }
+    reportProgress(true);
+    stats.finish();
+    emit statsUpdated(stats);
     emit completed();
     terminateConnection();
 }
 
 
 void Receiver::terminateSession(const QString &error) {
+    reportProgress(true);
+    stats.finish();
+    emit statsUpdated(stats);
     emit aborted(error);
     terminateConnection();
 }
 
 void Receiver::terminateConnection() {
+    paceTimer->stop();
+    progressTimer->stop();
+    if (limiter != nullptr) {
+        limiter->removeConsumer(this);
+        limiter = nullptr;
+    }
+    if (journal != nullptr) {
+        // the session is broken, keep what has been received for a retry
+        if (socket != nullptr) {
+            saveCheckpoint();
+        }
+        delete journal;
+        journal = nullptr;
+    }
+    if (hasher != nullptr) {
+        // may block until the running hash tasks stop
+        hasher->disconnect(this);
+        delete hasher;
+        hasher = nullptr;
+    }
+    const QList<QTcpSocket*> streams = pendingStreams;
+    for (QTcpSocket *stream : streams) {
+        dropStream(stream);
+    }
+    const QList<RangeReceiver*> ranges = rangeReceivers;
+    rangeReceivers.clear();
+    for (RangeReceiver *range : ranges) {
+        range->disconnect(this);
+        // the writer keeps what has been queued
+        range->stop();
+        range->deleteLater();
+    }
+    inBuffer.clear();
+    spareBuffers.clear();
+    waitingForBuffer = false;
+    inPos = 0;
+    inEnd = 0;
     if (socket != nullptr) {
         socket->disconnect(this);
         socket->close();
@@ -336,7 +1326,14 @@ bool Receiver::prepareFilesystem() {
         // a file
         QString filePath;
         int index = currentElementName.lastIndexOf(QChar('/'));
-        if (index >= 0) {
+        bool resumed = (sessionElementsReceived == resumeElements && resumePath.isEmpty() == false);
+        if (resumed) {
+            // the file left by an interrupted session
+            filePath = resumePath;
+            if (index < 0) {
+                currentTopElementName = filePath;
+            }
+        } else if (index >= 0) {
             QString dirPath = getNewPath(currentElementName.left(index));
             filePath = dirPath + currentElementName.mid(index);
             QDir d(destDir);
@@ -358,13 +1355,64 @@ bool Receiver::prepareFilesystem() {
             }
         }
         filePath = QDir(destDir).filePath(filePath);
+        currentElementPath = filePath;
+        if (dedupCopies.contains(sessionElementsReceived)) {
+            // the content is here already, under the name the sender uses
+            QString localPath = dedupCopies.take(sessionElementsReceived);
+            if (index < 0) {
+                // a single file is the one in place, nothing is written
+                currentTopElementName = currentElementName;
+                currentTopElementPath = localPath;
+                currentElementPath = localPath;
+            } else if (localPath != filePath) {
+                // the folder has been given a new name, the file is linked
+                // into it. should that fall back to a copy, it may take long,
+                // so it is made by the writer, in order with the other files;
+                // a failure ends the session through diskDrained()
+                prepareWriter();
+                writer->addTask([localPath, filePath]() -> QString {
+                    if (linkLocalFile(localPath, filePath) == false) {
+                        return QStringLiteral("Can not write to %1").arg(filePath);
+                    }
+                    return QString();
+                });
+            }
+            currentElementCopied = true;
+            return true;
+        }
+        if (currentElementDelta) {
+            // rebuilt from the older copy, which stays as it is
+            QString basePath = deltaBases.take(sessionElementsReceived);
+            if (QFileInfo(basePath) == QFileInfo(filePath)) {
+                terminateSession(QStringLiteral("Can not write to %1").arg(filePath));
+                return false;
+            }
+            currentDeltaBase = new QFile(basePath);
+            if (currentDeltaBase->open(QFile::ReadOnly) == false) {
+                delete currentDeltaBase;
+                currentDeltaBase = nullptr;
+                terminateSession(QStringLiteral("Can not read %1").arg(basePath));
+                return false;
+            }
+            currentDeltaLiteral = 0;
+            currentDeltaCopyLeft = 0;
+        }
         currentFile = new QFile(filePath);
-        if (currentFile->open(QFile::WriteOnly) == false) {
+        bool opened;
+        if (resumed && resumeOffset > 0) {
+            opened = currentFile->open(QFile::ReadWrite) && currentFile->seek(resumeOffset);
+        } else {
+            opened = currentFile->open(QFile::WriteOnly);
+        }
+        if (opened == false) {
             delete currentFile;
             currentFile = nullptr;
             terminateSession(QStringLiteral("Can not write to %1").arg(filePath));
             return false;
         }
+        prepareWriter();
+        // ranges of a multi-stream element are written at their offsets by other handles
+        writer->beginFile(currentFile, currentElementBytes, currentElementStreams > 1);
         if (index < 0) {
             currentTopElementPath = filePath;
         }
@@ -373,6 +1421,16 @@ bool Receiver::prepareFilesystem() {
     return true;
 }
 
+#ifndef Q_OS_ANDROID
+void Receiver::prepareWriter() {
+    if (writer == nullptr) {
+        writer = new DiskWriter(options.writeBufferSize, this);
+        connect(writer, &DiskWriter::drained, this, &Receiver::diskDrained);
+        connect(writer, &DiskWriter::markerReached, this, &Receiver::diskMarkerReached);
+    }
+}
+#endif
+
 QString Receiver::getNewPath(const QString &originalPath) {
     QString rootDir = originalPath.section(QChar('/'), 0, 0);
     if (dirNameMap.contains(rootDir)) {
@@ -417,8 +1475,37 @@ QString Receiver::getNewFileName(const QString &parentDir, const QString &origin
 
 void Receiver::connectionError(QAbstractSocket::SocketError error) {
     Q_UNUSED(error)
-    if (socket != nullptr) {
-        emit aborted(socket->errorString());
-        terminateConnection();
+    if (socket == nullptr || peerClosed) {
+        return;
+    }
+    peerClosed = true;
+#ifndef Q_OS_ANDROID
+    // the sender may close the connection while received data still waits for the disk
+    processData();
+#endif
+    connectionClosed();
+}
+
+// Aborts the session of a closed connection, unless the data left is still
+// being handled and diskDrained() or diskMarkerReached() go on with it
+void Receiver::connectionClosed() {
+    if (socket == nullptr) {
+        return;
     }
+#ifndef Q_OS_ANDROID
+    if (recvStatus == PHASE_WAIT_DISK) {
+        return;
+    }
+    if (recvStatus == PHASE_ELEMENT_DATA && currentElementType == FILE_ELEMENT && buffered() + socket->bytesAvailable() > 0 && writer->isFull()) {
+        return;
+    }
+    if (waitingForBuffer && socket->bytesAvailable() > 0) {
+        return;
+    }
+#endif
+    reportProgress(true);
+    stats.finish();
+    emit statsUpdated(stats);
+    emit aborted(socket->errorString());
+    terminateConnection();
 }
@@ -21,13 +21,25 @@
 
 #include <QTcpSocket>
 #include <QMap>
+#include <QHash>
+#include <QSet>
+#include "transferoptions.h"
+#include "checksum.h"
+#include "transferstats.h"
+#include "progressthrottle.h"
 
 #ifdef Q_OS_ANDROID
 class AndroidContentWriter;
 class AndroidScreenOn;
 #else
 class QFile;
+class DiskWriter;
 #endif
+class RangeReceiver;
+class FileHasher;
+class ResumeJournal;
+class RateLimiter;
+class QTimer;
 
 class Receiver : public QObject
 {
@@ -36,12 +48,27 @@ public:
     explicit Receiver(QTcpSocket *socket, const QString &destDir, QObject *parent = nullptr);
     ~Receiver();
 
-    void abort();
+    void setOptions(const TransferOptions &options);
+    // the token extra connections of the session have to present, by default a random one
+    void setSessionToken(qint64 token);
+    // paces the reads, shared with other sessions
+    void setRateLimiter(RateLimiter *limiter);
+    static qint64 newSessionToken();
+    // stops before the first element until release(), the handshake is still answered
+    void hold();
+
+    Q_INVOKABLE void start();
+    Q_INVOKABLE void release();
+    Q_INVOKABLE void abort();
+    Q_INVOKABLE void addStream(QTcpSocket *stream);
 
 signals:
     void started(qint64 totalSize);
-    void progress(qint64 total, qint64 received);
+    // wire counts the bytes actually received, less than received when data is compressed
+    void progress(qint64 total, qint64 received, qint64 wire);
     void itemProgress(qint64 total, qint64 current, QString name);
+    // now and then along with progress, and once more before completed or aborted
+    void statsUpdated(TransferStats stats);
     void completed();
     void aborted(QString error);
     void dirReceived(QString name, QString path);
@@ -50,13 +77,42 @@ signals:
 
 private slots:
     void processData();
+    void processStreams();
     void connectionError(QAbstractSocket::SocketError error);
+#ifndef Q_OS_ANDROID
+    void diskDrained();
+    void diskMarkerReached();
+#endif
+    void dedupHashed();
 
 private:
+    qint64 buffered() const;
+    bool fillBuffer();
+    bool switchBuffer();
+    void reportProgress(bool final = false);
+    void reportItem(qint64 total, qint64 current, const QString &name);
+    bool take(void *dest, qint64 size);
+    bool beginElement();
+    bool endElementData();
+    bool completeElement();
+    bool nextElement();
+    bool readDedupManifest();
+    bool readDedupElements();
+#ifndef Q_OS_ANDROID
+    bool readDelta();
+#endif
+    void dropStream(QTcpSocket *stream);
+    void loadCheckpoint(qint64 transferId);
+    void saveCheckpoint();
     void endSession();
+    void finishSession();
+    void connectionClosed();
     void terminateSession(const QString &error);
     void terminateConnection();
     bool prepareFilesystem();
+#ifndef Q_OS_ANDROID
+    void prepareWriter();
+#endif
     QString getNewPath(const QString &originaPath);
     QString getNewFileName(const QString &parentDir, const QString &originalName);
 
@@ -64,21 +120,89 @@ private:
 
     QString destDir;
 
+    TransferOptions options;
+    bool handshakeDone = false;
+    bool held = false;
+    // set once the sender has closed the connection, the data left is still handled
+    bool peerClosed = false;
+    qint64 sessionFeatures = 0;
+    qint64 sessionToken = 0;
+    RateLimiter *limiter = nullptr;
+    // wakes processData() up once the rate allows more data
+    QTimer *paceTimer;
+    // lets a held progress update through
+    QTimer *progressTimer;
+
+    // extra connections of a multi-stream session
+    QList<QTcpSocket*> pendingStreams;
+    QList<RangeReceiver*> rangeReceivers;
+    int currentElementStreams = 1;
+    int currentRangesPending = 0;
+    QList<int> currentRangesStarted;
+
+    // checkpoint of a resumable session
+    ResumeJournal *journal = nullptr;
+    qint64 resumeElements = 0;
+    qint64 resumeOffset = 0;
+    QString resumePath;
+    qint64 checkpointBytes = 0;
+
+    // files of the destination directory the sender may skip, by element index,
+    // and the ones it does skip
+    qint64 dedupEntries = -1;
+    FileHasher *hasher = nullptr;
+    QHash<qint64, QString> dedupCandidates;
+    QSet<qint64> dedupSameSize;
+    QHash<qint64, QString> dedupCopies;
+    // older copies the sender may send differences from, by element index
+    QHash<qint64, QString> deltaBases;
+
     qint64 sessionElements = 0;
     qint64 sessionBytes = 0;
 
     qint64 sessionElementsReceived = 0;
     qint64 sessionBytesReceived = 0;
+    // bytes saved by compression so far
+    qint64 sessionBytesSaved = 0;
+    // timings of the session
+    TransferStats stats;
+    // keeps the progress signal to TransferOptions::progressRate
+    ProgressThrottle progressThrottle;
+    // the element of the last itemProgress not let through yet
+    bool itemPending = false;
+    qint64 itemTotal = 0;
+    qint64 itemCurrent = 0;
+    QString itemName;
+
+    // received bytes not parsed yet are between inPos and inEnd, the space
+    // behind inEnd is filled by fillBuffer()
+    QByteArray inBuffer;
+    // earlier buffers, taken again once the writer has released their slices
+    QList<QByteArray> spareBuffers;
+    bool waitingForBuffer = false;
+    int inPos = 0;
+    int inEnd = 0;
 
     QByteArray readBuffer;
 
     QString currentElementName;
+    QString currentElementPath;
     qint64 currentElementBytes = 0;
+    // bytes carried by the session connection, less than the element size in multi-stream mode
+    qint64 currentElementDataBytes = 0;
     qint64 currentElementReceived = 0;
+    bool currentElementCompressed = false;
+    // the content has been taken from a local copy
+    bool currentElementCopied = false;
+    // the data is a sequence of delta instructions against an older copy
+    bool currentElementDelta = false;
+    // hash of the element data received over the session connection
+    Checksum currentElementChecksum;
     enum ELEMENT_TYPE {
         FILE_ELEMENT,
         DIR_ELEMENT,
-        TEXT_ELEMENT
+        TEXT_ELEMENT,
+        TOTALS_ELEMENT
     } currentElementType = FILE_ELEMENT;
 
     QString currentTopElementName;
@@ -88,18 +212,36 @@ private:
 #ifdef Q_OS_ANDROID
     AndroidContentWriter *currentFile = nullptr;
 #else
+    // handed to the writer once opened
     QFile *currentFile = nullptr;
+    DiskWriter *writer = nullptr;
+    // the older copy of a delta element, the rest of the literal being received
+    // and the part of the older copy still to be copied
+    QFile *currentDeltaBase = nullptr;
+    qint64 currentDeltaLiteral = 0;
+    qint64 currentDeltaCopyPos = 0;
+    qint64 currentDeltaCopyLeft = 0;
 #endif
 
     enum RECV_PHASE {
         PHASE_TOTAL_ELEMENTS,
+        PHASE_HANDSHAKE,
+        PHASE_DEDUP_MANIFEST,
+        PHASE_DEDUP_HASHING,
+        PHASE_DEDUP_ELEMENTS,
         PHASE_TOTAL_SIZE,
         PHASE_ELEMENT_NAME,
         PHASE_ELEMENT_SIZE,
-        PHASE_ELEMENT_DATA
+        PHASE_ELEMENT_FLAGS,
+        PHASE_ELEMENT_DATA,
+        PHASE_ELEMENT_CHECKSUM,
+        PHASE_WAIT_STREAMS,
+        // all elements are received, what is queued for the disk is being written
+        PHASE_WAIT_DISK
     } recvStatus = PHASE_TOTAL_ELEMENTS;
 
     static QString textElementName;
+    static QString totalsElementName;
 
 #ifdef Q_OS_ANDROID
     AndroidScreenOn *screenOn;
@@ -0,0 +1,125 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2021 Xu Zhen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "resumejournal.h"
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QSettings>
+#include <QStandardPaths>
+
+// journals of transfers which are never retried are dropped after a week
+#define JOURNAL_MAX_AGE (7 * 24 * 3600)
+
+ResumeJournal::ResumeJournal(qint64 transferId, const QString &destDir) {
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(reinterpret_cast<const char *>(&transferId), sizeof(transferId));
+    hash.addData(QDir::cleanPath(destDir).toUtf8());
+    fileName = QDir(journalDir()).filePath(QString::fromLatin1(hash.result().toHex()) + QStringLiteral(".ini"));
+}
+
+QString ResumeJournal::journalDir() {
+#if QT_VERSION >= QT_VERSION_CHECK(5, 4, 0)
+    QDir dir(QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation));
+#else
+    QDir dir(QStandardPaths::writableLocation(QStandardPaths::DataLocation));
+#endif
+    return dir.filePath(QStringLiteral("resume"));
+}
+
+void ResumeJournal::removeStale(const QString &dir) {
+    QDateTime now = QDateTime::currentDateTime();
+    const QFileInfoList entries = QDir(dir).entryInfoList(QStringList() << QStringLiteral("*.ini"), QDir::Files);
+    for (const QFileInfo &entry : entries) {
+        if (entry.lastModified().secsTo(now) > JOURNAL_MAX_AGE) {
+            QFile::remove(entry.filePath());
+        }
+    }
+}
+
+bool ResumeJournal::load() {
+    if (QFile::exists(fileName) == false) {
+        return false;
+    }
+    QSettings journal(fileName, QSettings::IniFormat);
+    mElements = journal.value(QStringLiteral("Elements"), 0).toLongLong();
+    mOffset = journal.value(QStringLiteral("Offset"), 0).toLongLong();
+    mPath = journal.value(QStringLiteral("Path")).toString();
+    mDirNameMap.clear();
+    int size = journal.beginReadArray(QStringLiteral("DirNames"));
+    for (int i = 0; i < size; i++) {
+        journal.setArrayIndex(i);
+        mDirNameMap.insert(journal.value(QStringLiteral("From")).toString(), journal.value(QStringLiteral("To")).toString());
+    }
+    journal.endArray();
+    if (mElements < 0 || mOffset < 0) {
+        // damaged journal
+        remove();
+        return false;
+    }
+    return true;
+}
+
+void ResumeJournal::save(qint64 elements, qint64 offset, const QString &path, const QMap<QString,QString> &dirNameMap) {
+    mElements = elements;
+    mOffset = offset;
+    mPath = path;
+    mDirNameMap = dirNameMap;
+
+    QString dir = journalDir();
+    if (QDir().mkpath(dir) == false) {
+        return;
+    }
+    removeStale(dir);
+    QSettings journal(fileName, QSettings::IniFormat);
+    journal.clear();
+    journal.setValue(QStringLiteral("Elements"), elements);
+    journal.setValue(QStringLiteral("Offset"), offset);
+    journal.setValue(QStringLiteral("Path"), path);
+    // QSettings keys are case insensitive on some platforms, keep names as values
+    journal.beginWriteArray(QStringLiteral("DirNames"), dirNameMap.size());
+    int i = 0;
+    for (QMap<QString,QString>::const_iterator it = dirNameMap.constBegin(); it != dirNameMap.constEnd(); ++it) {
+        journal.setArrayIndex(i++);
+        journal.setValue(QStringLiteral("From"), it.key());
+        journal.setValue(QStringLiteral("To"), it.value());
+    }
+    journal.endArray();
+    journal.sync();
+}
+
+void ResumeJournal::remove() {
+    QFile::remove(fileName);
+}
+
+qint64 ResumeJournal::elements() const {
+    return mElements;
+}
+
+qint64 ResumeJournal::offset() const {
+    return mOffset;
+}
+
+QString ResumeJournal::path() const {
+    return mPath;
+}
+
+QMap<QString,QString> ResumeJournal::dirNameMap() const {
+    return mDirNameMap;
+}
@@ -0,0 +1,55 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2021 Xu Zhen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef RESUMEJOURNAL_H
+#define RESUMEJOURNAL_H
+
+#include <QString>
+#include <QMap>
+
+// Checkpoint of an interrupted receiving session, kept on disk so that a
+// retry of the same transfer only needs the missing bytes
+class ResumeJournal
+{
+public:
+    ResumeJournal(qint64 transferId, const QString &destDir);
+
+    bool load();
+    void save(qint64 elements, qint64 offset, const QString &path, const QMap<QString,QString> &dirNameMap);
+    void remove();
+
+    // number of completed elements
+    qint64 elements() const;
+    // bytes of the next element already written
+    qint64 offset() const;
+    // file of the next element, relative to the destination directory
+    QString path() const;
+    QMap<QString,QString> dirNameMap() const;
+
+private:
+    static QString journalDir();
+    static void removeStale(const QString &dir);
+
+    QString fileName;
+    qint64 mElements = 0;
+    qint64 mOffset = 0;
+    QString mPath;
+    QMap<QString,QString> mDirNameMap;
+};
+
+#endif // RESUMEJOURNAL_H
@@ -17,38 +17,192 @@
  */
 
 #include "sender.h"
+#include "rangesender.h"
+#include "compression.h"
+#include "filescanner.h"
+#include "sharedsource.h"
+#include "filehasher.h"
+#include "ratelimiter.h"
 #include <QTcpSocket>
 #include <QTimer>
+#include <QSet>
+#include <QCryptographicHash>
+#include <algorithm>
+#include <limits>
+#include <string.h>
+
+#ifdef USE_SENDFILE
+#include <sys/sendfile.h>
+#include <errno.h>
+#endif
 
 QByteArray Sender::textElementName = QStringLiteral("___DUKTO___TEXT___").toUtf8();
+QByteArray Sender::totalsElementName = QStringLiteral("___DUKTO___TOTALS___").toUtf8();
+
+
+Sender::Sender(const QString &dest, quint16 port, QObject *parent) : QObject(parent), socket(new QTcpSocket(this)), dest(dest), port(port), handshakeTimer(new QTimer(this)), paceTimer(new QTimer(this)), progressTimer(new QTimer(this)) {
+    setupSocket();
+    handshakeTimer->setSingleShot(true);
+    handshakeTimer->setInterval(5000);
+    connect(handshakeTimer, &QTimer::timeout, this, [this]() {
+        reportError(QStringLiteral("%1 did not answer the handshake").arg(dest));
+    });
+    paceTimer->setSingleShot(true);
+    connect(paceTimer, &QTimer::timeout, this, &Sender::sendData);
+    progressTimer->setSingleShot(true);
+    connect(progressTimer, &QTimer::timeout, this, [this]() {
+        reportProgress();
+    });
+    stats.start(true, dest);
+}
+
+Sender::~Sender() {
+    abort();
+    delete currentFile;
+    delete currentDelta;
+}
+
+void Sender::setOptions(const TransferOptions &options) {
+    this->options = options;
+    flow.setBounds(options.batchSize, options.minWindow, options.maxWindow);
+    progressThrottle.setRate(options.progressRate);
+#ifdef USE_SENDFILE
+    if (options.zeroCopy == false) {
+        zeroCopy = false;
+    }
+#endif
+}
+
+void Sender::setPeerFeatures(qint64 features) {
+    peerFeatures = features;
+}
 
+void Sender::setSource(SharedSource *source) {
+    this->source = source;
+#ifdef USE_SENDFILE
+    // the data comes from the shared chunks, not from a file of its own
+    zeroCopy = false;
+#endif
+}
 
-Sender::Sender(const QString &dest, quint16 port, QObject *parent) : QObject(parent), socket(new QTcpSocket()), dest(dest), port(port) {
+void Sender::setRateLimiter(RateLimiter *limiter) {
+    this->limiter = limiter;
+    limiter->addConsumer(this, dest);
+}
+
+void Sender::setupSocket() {
+    connect(socket, &QTcpSocket::connected, this, [this]() {
+        flow.setSocket(socket);
+    });
     connect(socket, &QTcpSocket::connected, this, &Sender::sendData);
 #if QT_VERSION >= QT_VERSION_CHECK(5, 15, 0)
     connect(socket, &QTcpSocket::errorOccurred, this, &Sender::connectionError);
 #else
     connect(socket, static_cast<void (QTcpSocket::*)(QAbstractSocket::SocketError)>(&QTcpSocket::error), this, &Sender::connectionError);
 #endif
+    connect(socket, &QTcpSocket::bytesWritten, this, [this](qint64 bytes) {
+        flow.transferred(bytes);
+    });
     connect(socket, &QTcpSocket::bytesWritten, this, &Sender::sendData);
+    connect(socket, &QTcpSocket::readyRead, this, &Sender::readHandshake);
 }
 
-Sender::~Sender() {
-    abort();
+qint64 Sender::offeredFeatures() const {
+    qint64 features = options.sendFeatures & TransferOptions::supportedFeatures() & peerFeatures;
+    if (sendingText) {
+        // nothing to resume, list or skip in a text snippet
+        features &= ~(TransferOptions::FEATURE_RESUME | TransferOptions::FEATURE_STREAMED_LIST | TransferOptions::FEATURE_DEDUP | TransferOptions::FEATURE_DELTA);
+    }
+    if (source != nullptr) {
+        // every receiver gets the same bytes in the same order
+        features &= ~(TransferOptions::FEATURE_MULTI_STREAM | TransferOptions::FEATURE_COMPRESSION | TransferOptions::FEATURE_DELTA);
+    }
+    return features;
+}
+
+// Identifies a transfer of the same files across sessions
+qint64 Sender::transferId() const {
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    for (const FileData &file : filesToSend) {
+        qint64 values[2] = { file.getSize(), file.getModified() };
+        hash.addData(file.getName().toUtf8());
+        hash.addData(reinterpret_cast<const char *>(values), sizeof(values));
+    }
+    qint64 id;
+    memcpy(&id, hash.result().constData(), sizeof(id));
+    return id;
+}
+
+void Sender::connectToReceiver() {
+    stats.enter(TransferStats::PHASE_CONNECT);
+    qint64 features = offeredFeatures();
+    if (features != 0) {
+        sendStatus = PHASE_HANDSHAKE;
+        socket->connectToHost(dest, port, QTcpSocket::ReadWrite);
+    } else {
+        sendStatus = PHASE_TOTAL_ELEMENTS_AND_SIZE;
+        socket->connectToHost(dest, port, QTcpSocket::WriteOnly);
+    }
 }
 
 void Sender::sendFiles(const QStringList &paths) {
     if (socket == nullptr) {
         return;
     }
-    QString error;
-    filesToSend = FileData::generateList(paths, totalBytes, error);
+    filesToSend.clear();
+    totalBytes = 0;
+    scanning = true;
+    stats.begin(TransferStats::PHASE_SCAN);
+    scanner = new FileScanner(paths, this);
+    connect(scanner, &FileScanner::entriesFound, this, &Sender::collectEntries);
+    connect(scanner, &FileScanner::finished, this, &Sender::scanFinished);
+    scanner->start();
+    // with extensions, the handshake overlaps the scan. a classic receiver
+    // needs the totals first, connect to it when they are known
+    if (offeredFeatures() != 0) {
+        connectToReceiver();
+    }
+}
+
+void Sender::collectEntries() {
+    if (scanner == nullptr) {
+        return;
+    }
+    scanner->takeEntries(filesToSend, totalBytes);
+    if (waitingForScanner) {
+        waitingForScanner = false;
+        sendData();
+    }
+}
+
+void Sender::scanFinished() {
+    if (scanner == nullptr) {
+        return;
+    }
+    QString error = scanner->error();
     if (error.isEmpty() == false) {
         reportError(error);
         return;
     }
+    scanner->takeEntries(filesToSend, totalBytes);
+    if (streamedList == false) {
+        // nothing sent yet. a stable order, which the transfer id and resume rely on.
+        // a directory name sorts before the names below it
+        std::sort(filesToSend.begin(), filesToSend.end(), [](const FileData &a, const FileData &b) {
+            return a.getName() < b.getName();
+        });
+    }
+    scanner->deleteLater();
+    scanner = nullptr;
+    scanning = false;
+    stats.end(TransferStats::PHASE_SCAN);
     emit started(totalBytes);
-    socket->connectToHost(dest, port, QTcpSocket::WriteOnly);
+    if (sendStatus == PHASE_NOT_CONNECTED) {
+        connectToReceiver();
+    } else if (waitingForScanner) {
+        waitingForScanner = false;
+        sendData();
+    }
 }
 
 void Sender::sendFile(const QString &path, const QString &name) {
@@ -56,7 +210,9 @@ void Sender::sendFile(const QString &path, const QString &name) {
         return;
     }
     QString error;
+    stats.begin(TransferStats::PHASE_SCAN);
     filesToSend = FileData::generateList(QStringList() << path, totalBytes, error);
+    stats.end(TransferStats::PHASE_SCAN);
     if (error.isEmpty() == false) {
         reportError(error);
         return;
@@ -65,22 +221,92 @@ void Sender::sendFile(const QString &path, const QString &name) {
         filesToSend[0].setName(name);
     }
     emit started(totalBytes);
-    socket->connectToHost(dest, port, QTcpSocket::WriteOnly);
+    connectToReceiver();
+}
+
+
+void Sender::sendShared() {
+    if (socket == nullptr || source == nullptr) {
+        return;
+    }
+    source->addConsumer(this);
+    stats.begin(TransferStats::PHASE_SCAN);
+    connect(source, &SharedSource::advanced, this, &Sender::sourceAdvanced, Qt::QueuedConnection);
+    if (source->isReady()) {
+        sourceReady();
+    } else {
+        connect(source, &SharedSource::ready, this, &Sender::sourceReady);
+    }
+}
+
+void Sender::sourceReady() {
+    if (socket == nullptr) {
+        return;
+    }
+    stats.end(TransferStats::PHASE_SCAN);
+    QString error = source->error();
+    if (error.isEmpty() == false) {
+        reportError(error);
+        return;
+    }
+    filesToSend = source->files();
+    totalBytes = source->totalSize();
+    emit started(totalBytes);
+    connectToReceiver();
 }
 
+void Sender::sourceAdvanced() {
+    if (waitingForSource) {
+        waitingForSource = false;
+        sendData();
+    }
+}
 
 void Sender::sendText(const QString &text) {
     if (socket == nullptr) {
         return;
     }
     filesToSend.clear();
+    sendingText = true;
     textToSend = text.toUtf8();
     totalBytes = textToSend.size();
     emit started(totalBytes);
-    socket->connectToHost(dest, port, QTcpSocket::WriteOnly);
+    connectToReceiver();
 }
 
 void Sender::abort() {
+    handshakeTimer->stop();
+    paceTimer->stop();
+    progressTimer->stop();
+    if (limiter != nullptr) {
+        limiter->removeConsumer(this);
+        limiter = nullptr;
+    }
+    batch.clear();
+    if (scanner != nullptr) {
+        // may block until the running scan tasks stop
+        scanner->disconnect(this);
+        delete scanner;
+        scanner = nullptr;
+    }
+    if (source != nullptr) {
+        source->disconnect(this);
+        source->removeConsumer(this);
+        source = nullptr;
+    }
+    if (hasher != nullptr) {
+        // may block until the running hash tasks stop
+        hasher->disconnect(this);
+        delete hasher;
+        hasher = nullptr;
+    }
+    const QList<RangeSender*> ranges = rangeSenders;
+    rangeSenders.clear();
+    for (RangeSender *range : ranges) {
+        // may be called from a signal of the range sender
+        range->abort();
+        range->deleteLater();
+    }
     if (socket != nullptr) {
         socket->disconnect(this);
         socket->abort();
@@ -90,116 +316,432 @@ void Sender::abort() {
 }
 
 void Sender::sendData() {
+    fillBatch();
+    flushBatch();
+}
+
+// Queues data for the socket, small writes are merged into one
+void Sender::writeBatched(const QByteArray &data) {
+    batch.append(data);
+    if (batch.size() >= options.batchSize) {
+        flushBatch();
+    }
+}
+
+// Ends the data of the current element with its hash, if the receiver wants it
+void Sender::writeChecksum() {
+    if (sessionFeatures & TransferOptions::FEATURE_CHECKSUM) {
+        quint64 hash = currentChecksum.digest();
+        writeBatched(QByteArray(reinterpret_cast<char *>(&hash), sizeof(hash)));
+    }
+}
+
+// Tells the progress and the timings now and then, final tells it in any case
+void Sender::reportProgress(bool final) {
+    stats.progress(totalBytes, totalBytesSent, totalBytesSent - totalBytesSaved);
+    if (progressThrottle.pass(final)) {
+        progressTimer->stop();
+        if (itemPending) {
+            itemPending = false;
+            emit itemProgress(itemTotal, itemCurrent, itemName);
+        }
+        emit progress(totalBytes, totalBytesSent, totalBytesSent - totalBytesSaved);
+    } else if (progressTimer->isActive() == false) {
+        // the held value is let through later if nothing else comes
+        progressTimer->start(static_cast<int>(progressThrottle.remaining()));
+    }
+    stats.setUpdates(progressThrottle.passed(), progressThrottle.held());
+    if (final == false && stats.due()) {
+        emit statsUpdated(stats);
+    }
+}
+
+// Tells the element being sent along with the progress, only the last one
+// of those held back by the throttle is let through
+void Sender::reportItem(qint64 total, qint64 current, const QString &name) {
+    itemPending = true;
+    itemTotal = total;
+    itemCurrent = current;
+    itemName = name;
+    reportProgress();
+}
+
+// Tells the rate limiter what the file data has taken on the wire
+void Sender::chargeRate(qint64 bytes) {
+    if (limiter != nullptr) {
+        limiter->consume(this, bytes);
+    }
+}
+
+void Sender::flushBatch() {
+    if (socket != nullptr && batch.isEmpty() == false) {
+        socket->write(batch);
+    }
+    batch.clear();
+}
+
+// Writes elements until the batch limit is reached, so that many small files
+// need one wakeup by bytesWritten instead of two each
+void Sender::fillBatch() {
     while (socket != nullptr) {
         switch (sendStatus) {
+            case PHASE_NOT_CONNECTED:
+                return;
+            case PHASE_HANDSHAKE: {
+                qint64 magic = TransferOptions::HANDSHAKE_MAGIC;
+                qint64 features = offeredFeatures();
+                if ((features & (TransferOptions::FEATURE_RESUME | TransferOptions::FEATURE_DEDUP | TransferOptions::FEATURE_DELTA)) && scanning) {
+                    // the transfer id and the manifest cover the whole list
+                    waitingForScanner = true;
+                    return;
+                }
+                QByteArray bytes(reinterpret_cast<char *>(&magic), sizeof(magic));
+                bytes.append(reinterpret_cast<char *>(&features), sizeof(features));
+                if (features & TransferOptions::FEATURE_RESUME) {
+                    qint64 id = transferId();
+                    bytes.append(reinterpret_cast<char *>(&id), sizeof(id));
+                }
+                socket->write(bytes);
+                sendStatus = PHASE_HANDSHAKE_REPLY;
+                handshakeTimer->start();
+                return;
+            }
+            case PHASE_HANDSHAKE_REPLY:
+            case PHASE_DEDUP_REPLY:
+                // wait for readHandshake()
+                return;
+            case PHASE_DEDUP_HASHING:
+                // wait for dedupHashed()
+                return;
             case PHASE_TOTAL_ELEMENTS_AND_SIZE: {
-                if (filesToSend.size() == 0) {
+                qint64 headerBytes = totalBytes;
+                if (sendingText) {
                     // text
                     totalElements = 1;
-                } else {
+                } else if (scanning == false) {
                     // file / directory
                     totalElements = filesToSend.size();
+                } else if (sessionFeatures & TransferOptions::FEATURE_STREAMED_LIST) {
+                    // still scanning, the totals follow in a control element
+                    totalElements = -1;
+                    headerBytes = -1;
+                    streamedList = true;
+                } else {
+                    waitingForScanner = true;
+                    return;
                 }
                 QByteArray bytes(reinterpret_cast<char *>(&totalElements), sizeof(totalElements));
-                bytes.append(reinterpret_cast<char *>(&totalBytes), sizeof(totalBytes));
-                socket->write(bytes);
+                bytes.append(reinterpret_cast<char *>(&headerBytes), sizeof(headerBytes));
+                writeBatched(bytes);
                 currentFileIndex = 0;
                 sendStatus = PHASE_ELEMENT_NAME_AND_SIZE;
-                return;
+                break;
             }
             case PHASE_ELEMENT_NAME_AND_SIZE: {
+                stats.enter(TransferStats::PHASE_HEADER);
                 QString fileName;
                 qint64 size;
-                if (filesToSend.size() == 0) {
+                int streams = 1;
+                if (sendingText == false) {
+                    if (streamedList && scanning == false) {
+                        // the list is complete, tell the totals
+                        qint64 totals[2] = { filesToSend.size(), totalBytes };
+                        size = sizeof(totals);
+                        QByteArray bytes = totalsElementName;
+                        bytes.append('\0');
+                        bytes.append(reinterpret_cast<char *>(&size), sizeof(size));
+                        if (sessionFeatures & TransferOptions::elementFlagFeatures()) {
+                            qint64 flags = 1;
+                            bytes.append(reinterpret_cast<char *>(&flags), sizeof(flags));
+                        }
+                        bytes.append(reinterpret_cast<char *>(totals), sizeof(totals));
+                        writeBatched(bytes);
+                        streamedList = false;
+                        break;
+                    }
+                    if (currentFileIndex >= filesToSend.size()) {
+                        if (scanning) {
+                            // wait for collectEntries()
+                            waitingForScanner = true;
+                            return;
+                        }
+                        // all files written
+                        sendStatus = PHASE_FINALIZATION;
+                        break;
+                    }
+                }
+                if (sendingText) {
                     // text
                     fileName = textElementName;
                     size = textToSend.size();
-                    emit itemProgress(totalElements, currentFileIndex + 1, QStringLiteral("Text snippet"));
+                    currentChecksum.reset();
+                    reportItem(totalElements, currentFileIndex + 1, QStringLiteral("Text snippet"));
                 } else {
                     // file / directory
-                    currentFile = &(filesToSend[currentFileIndex]);
+                    // a copy, filesToSend may grow while it is being sent
+                    delete currentFile;
+                    currentFile = new FileData(filesToSend.at(currentFileIndex));
+                    delete currentDelta;
+                    currentDelta = nullptr;
                     fileName = currentFile->getName();
                     size = currentFile->getSize();
-                    if (currentFile->isDir() == false) {
+                    currentChecksum.reset();
+                    if (isSkipped(currentFileIndex)) {
+                        // received in an earlier session or there already, only the header is needed
+                        currentCompressed = false;
+                        if (currentFile->isDir() == false) {
+                            totalBytesSent += size;
+                        }
+                        if (dedupElements.contains(currentFileIndex)) {
+                            totalBytesSaved += size;
+                        }
+                    } else if (source != nullptr) {
+                        // read through the source, from the resume point if any
+                        currentFileSent = 0;
+                        currentCompressed = false;
+                        if (currentFileIndex == resumeElements && resumeOffset > 0) {
+                            currentFileSent = resumeOffset;
+                            totalBytesSent += resumeOffset;
+                        }
+                        currentDataEnd = std::max<qint64>(size, 0);
+                    } else if (currentFile->isDir() == false) {
                         if (currentFile->open() == false) {
                             reportError(QStringLiteral("Can not read %1").arg(currentFile->getPath()));
                             return;
                         }
+                        currentFileSent = 0;
+                        currentCompressed = false;
+#ifndef Q_OS_ANDROID
+                        if (currentFileIndex == resumeElements && resumeOffset > 0) {
+                            if (currentFile->seek(resumeOffset) == false) {
+                                reportError(QStringLiteral("Can not read %1").arg(currentFile->getPath()));
+                                return;
+                            }
+                            currentFileSent = resumeOffset;
+                            totalBytesSent += resumeOffset;
+                        }
+                        if (currentFileSent == 0 && size >= options.deltaThreshold && deltaSignatures.contains(currentFileIndex)) {
+                            // only the blocks the receiver does not have
+                            currentDelta = new DeltaEncoder(deltaSignatures.take(currentFileIndex));
+                        }
+                        if ((sessionFeatures & TransferOptions::FEATURE_COMPRESSION) && currentDelta == nullptr && size - currentFileSent >= options.compressionThreshold) {
+                            // look at the head of the file, then rewind
+                            qint64 pos = currentFile->pos();
+                            QByteArray sample = currentFile->read(64 * 1024);
+                            if (currentFile->seek(pos) == false) {
+                                reportError(QStringLiteral("Can not read %1").arg(currentFile->getPath()));
+                                return;
+                            }
+                            currentCompressed = Compression::worthCompressing(sample);
+                            currentTryCompress = currentCompressed;
+                        }
+#endif
+                        if ((sessionFeatures & TransferOptions::FEATURE_MULTI_STREAM) && options.streams > 1 && size >= options.multiStreamThreshold
+                                && currentFileSent == 0 && currentCompressed == false && currentDelta == nullptr) {
+                            streams = std::min(options.streams, static_cast<int>(TransferOptions::ELEMENT_STREAMS_MASK));
+                        }
+                        currentDataEnd = size / streams;
                     }
-                    emit itemProgress(totalElements, currentFileIndex + 1, fileName);
+                    if (source != nullptr) {
+                        // nothing before this point is needed any more
+                        source->advance(this, currentFileIndex, isSkipped(currentFileIndex) ? std::max<qint64>(size, 0) : currentFileSent);
+                    }
+                    reportItem(filesToSend.size(), currentFileIndex + 1, fileName);
                 }
 
                 QByteArray bytes = fileName.toUtf8();
                 bytes.append('\0');
                 bytes.append(reinterpret_cast<char *>(&size), sizeof(size));
-                socket->write(bytes);
+                if ((sessionFeatures & TransferOptions::elementFlagFeatures()) && size >= 0) {
+                    qint64 flags = streams;
+                    if (sendingText == false && isSkipped(currentFileIndex) == false && currentCompressed) {
+                        flags |= TransferOptions::ELEMENT_COMPRESSED;
+                    }
+                    if (sendingText == false && isSkipped(currentFileIndex) == false && currentDelta != nullptr) {
+                        flags |= TransferOptions::ELEMENT_DELTA;
+                    }
+                    bytes.append(reinterpret_cast<char *>(&flags), sizeof(flags));
+                }
+                writeBatched(bytes);
+                if (streams > 1) {
+                    startRanges(size, streams);
+                }
                 sendStatus = PHASE_ELEMENT_DATA;
-                return;
+                break;
             }
             case PHASE_ELEMENT_DATA: {
-                if (socket->bytesToWrite() >= 1024 * 1024) {
+                stats.enter(TransferStats::PHASE_DATA);
+                if (socket->bytesToWrite() + batch.size() >= flow.window()) {
                     // do not leave too much data in sending buffer
+                    stats.setBlocked(true);
                     return;
                 }
+                stats.setBlocked(false);
                 bool waitBytesWritten = false;
-                if (filesToSend.size() == 0) {
+                // file data this round may read, less when a rate limit applies
+                qint64 allowance = flow.chunkSize();
+                bool paced = false;
+                if (limiter != nullptr && sendingText == false && currentFile->isDir() == false && isSkipped(currentFileIndex) == false) {
+                    int waitMs = 0;
+                    qint64 tokens = limiter->acquire(this, waitMs);
+                    if (tokens == 0) {
+                        // over the rate, go on once it allows more
+                        flushBatch();
+                        if (paceTimer->isActive() == false) {
+                            paceTimer->start(waitMs);
+                        }
+                        return;
+                    }
+                    paced = (tokens != RateLimiter::UNLIMITED);
+                    allowance = std::min(allowance, tokens);
+                }
+                if (sendingText) {
                     // text
-                    socket->write(textToSend);
+                    currentChecksum.update(textToSend.constData(), textToSend.size());
+                    writeBatched(textToSend);
                     totalBytesSent += textToSend.size();
-                    waitBytesWritten = true;
-                } else if (currentFile->isDir() == false) {
+                } else if (currentFile->isDir() == false && isSkipped(currentFileIndex) == false) {
                     // file
-                    if (currentFile->getSize() > 0)  {
-                        QByteArray d = currentFile->read(1024 * 1024);
+                    if (source != nullptr) {
+                        QByteArray d;
+                        SharedSource::READ_RESULT result = source->read(this, currentFileIndex, currentFileSent, allowance, d);
+                        if (result == SharedSource::READ_WAIT) {
+                            // the slowest receiver of the group is too far behind
+                            flushBatch();
+                            waitingForSource = true;
+                            return;
+                        } else if (result == SharedSource::READ_ERROR) {
+                            reportError(QStringLiteral("Can not read %1").arg(currentFile->getPath()));
+                            return;
+                        } else if (d.size() > 0) {
+                            currentChecksum.update(d.constData(), d.size());
+                            writeBatched(d);
+                            chargeRate(d.size());
+                            currentFileSent += d.size();
+                            totalBytesSent += d.size();
+                        } else if (currentFileSent < currentDataEnd) {
+                            reportError(QStringLiteral("%1 has been changed while sending").arg(currentFile->getPath()));
+                            return;
+                        }
+                    } else if (currentDelta != nullptr) {
+                        QByteArray d = currentFile->read(std::min<qint64>(currentDataEnd - currentFileSent, allowance));
+                        if (d.size() > 0) {
+                            currentChecksum.update(d.constData(), d.size());
+                            QByteArray instructions = currentDelta->encode(d);
+                            writeBatched(instructions);
+                            chargeRate(instructions.size());
+                            currentFileSent += d.size();
+                            totalBytesSent += d.size();
+                            totalBytesSaved += d.size() - instructions.size();
+                        } else if (currentFileSent < currentDataEnd) {
+                            reportError(QStringLiteral("%1 has been changed while sending").arg(currentFile->getPath()));
+                            return;
+                        }
+                    } else if (currentCompressed) {
+                        QByteArray d = currentFile->read(std::min<qint64>(currentDataEnd - currentFileSent, std::min<qint64>(Compression::FRAME_SIZE, allowance)));
                         if (d.size() > 0) {
-                            socket->write(d);
+                            currentChecksum.update(d.constData(), d.size());
+                            QByteArray frame = Compression::encodeFrame(d, currentTryCompress);
+                            writeBatched(frame);
+                            chargeRate(frame.size());
+                            currentFileSent += d.size();
                             totalBytesSent += d.size();
+                            totalBytesSaved += d.size() - frame.size();
+                        } else if (currentFileSent < currentDataEnd) {
+                            reportError(QStringLiteral("%1 has been changed while sending").arg(currentFile->getPath()));
+                            return;
+                        }
+                    } else if (currentFileSent < currentDataEnd)  {
+#ifdef USE_SENDFILE
+                        ZERO_COPY_RESULT result = ZC_FALLBACK;
+                        // small files go through the batch, along with their headers
+                        // the data has to pass through here to be hashed, or to be paced
+                        if (zeroCopy && paced == false && (sessionFeatures & TransferOptions::FEATURE_CHECKSUM) == 0
+                                && currentDataEnd - currentFileSent >= options.batchSize) {
+                            flushBatch();
+                            if (socket->bytesToWrite() > 0) {
+                                // the element header must reach the socket before the file data
+                                return;
+                            }
+                            result = sendFileZeroCopy();
+                        }
+                        if (result == ZC_ERROR) {
+                            return;
+                        } else if (result == ZC_WAIT) {
                             waitBytesWritten = true;
+                        } else if (result == ZC_FALLBACK) {
+#endif
+                        QByteArray d = currentFile->read(std::min<qint64>(currentDataEnd - currentFileSent, allowance));
+                        if (d.size() > 0) {
+                            currentChecksum.update(d.constData(), d.size());
+                            writeBatched(d);
+                            chargeRate(d.size());
+                            currentFileSent += d.size();
+                            totalBytesSent += d.size();
+                        } else {
+                            // shorter than announced, the receiver would wait for the rest
+                            reportError(QStringLiteral("%1 has been changed while sending").arg(currentFile->getPath()));
+                            return;
+                        }
+#ifdef USE_SENDFILE
                         }
+#endif
                     }
                 } else {
                      // no data for directory
                 }
 
-                emit progress(totalBytes, totalBytesSent);
+                reportProgress();
 
-                if (filesToSend.size() == 0 || currentFile->isDir()) {
-                    // text or directory
-                    currentFileIndex++;
+                if (sendingText) {
+                    // the only element
+                    writeChecksum();
                     textToSend.clear();
+                    sendStatus = PHASE_FINALIZATION;
+                } else if (currentFile->isDir() || isSkipped(currentFileIndex)) {
+                    // directory or an element the receiver has
+                    currentFileIndex++;
                     sendStatus = PHASE_ELEMENT_NAME_AND_SIZE;
-                } else if (currentFile->eof()) {
-                    // whole file sent
+                } else if (currentFileSent >= currentDataEnd) {
+                    // whole file (or its first range) sent
+                    if (currentDelta != nullptr) {
+                        QByteArray instructions = currentDelta->finish();
+                        writeBatched(instructions);
+                        totalBytesSaved -= instructions.size();
+                        delete currentDelta;
+                        currentDelta = nullptr;
+                    }
+                    writeChecksum();
                     currentFileIndex++;
                     sendStatus = PHASE_ELEMENT_NAME_AND_SIZE;
                     currentFile->close();
-                    currentFile = nullptr;
                 }
 
-                if (currentFileIndex < filesToSend.size()) {
-                    if (waitBytesWritten) {
-                        return;
-                    } else {
-                        break;
-                    }
-                }
-
-                // all files written
-                sendStatus = PHASE_FINALIZATION;
                 if (waitBytesWritten) {
                     return;
                 }
-                // nothing written, go to PHASE_FINALIZATION directly
+                // go on until the batch is full
+                break;
             }
-            // fall through
             case PHASE_FINALIZATION: {
-                if (socket->bytesToWrite() == 0) {
+                stats.enter(TransferStats::PHASE_FINALIZATION);
+                if (source != nullptr) {
+                    // all read, do not hold the group back
+                    source->disconnect(this);
+                    source->removeConsumer(this);
+                    source = nullptr;
+                }
+                flushBatch();
+                if (socket->bytesToWrite() == 0 && rangeSenders.isEmpty()) {
                     // end connection until all data sent
                     filesToSend.clear();
                     socket->disconnect(this);
                     socket->disconnectFromHost();
                     socket->deleteLater();
                     socket = nullptr;
+                    reportProgress(true);
+                    stats.finish();
+                    emit statsUpdated(stats);
                     emit completed();
                 }
                 return;
@@ -209,6 +751,230 @@ void Sender::sendData() {
 
 }
 
+void Sender::readHandshake() {
+    if (sendStatus == PHASE_DEDUP_REPLY) {
+        readDedupReply();
+        return;
+    }
+    if (sendStatus != PHASE_HANDSHAKE_REPLY) {
+        return;
+    }
+    // accepted features, session token, [resume point]
+    qint64 reply[4];
+    if (socket->bytesAvailable() < static_cast<qint64>(sizeof(qint64))) {
+        // wait for more data
+        return;
+    }
+    socket->peek(reinterpret_cast<char *>(reply), sizeof(qint64));
+    qint64 replySize = (reply[0] & TransferOptions::FEATURE_RESUME) ? sizeof(qint64) * 4 : sizeof(qint64) * 2;
+    if (socket->bytesAvailable() < replySize) {
+        // wait for more data
+        return;
+    }
+    handshakeTimer->stop();
+    socket->read(reinterpret_cast<char *>(reply), replySize);
+    sessionFeatures = reply[0] & offeredFeatures();
+    sessionToken = reply[1];
+    if (sessionFeatures & TransferOptions::FEATURE_RESUME) {
+        resumeElements = reply[2];
+        resumeOffset = reply[3];
+        if (resumeElements < 0 || resumeElements > filesToSend.size() || resumeOffset < 0
+                || (resumeElements < filesToSend.size() && resumeOffset > std::max<qint64>(filesToSend.at(resumeElements).getSize(), 0))) {
+            reportError(QStringLiteral("Received invalid data from %1").arg(dest));
+            return;
+        }
+    }
+    if (sessionFeatures & (TransferOptions::FEATURE_DEDUP | TransferOptions::FEATURE_DELTA)) {
+        socket->write(dedupManifest());
+        sendStatus = PHASE_DEDUP_REPLY;
+        readDedupReply();
+        return;
+    }
+    sendStatus = PHASE_TOTAL_ELEMENTS_AND_SIZE;
+    sendData();
+}
+
+bool Sender::isSkipped(int index) const {
+    return index < resumeElements || dedupElements.contains(index);
+}
+
+// The files worth skipping if the receiver has them, or worth sending as
+// differences from an older copy, see TransferOptions::FEATURE_DEDUP and FEATURE_DELTA
+QByteArray Sender::dedupManifest() const {
+    qint64 threshold = std::numeric_limits<qint64>::max();
+    if (sessionFeatures & TransferOptions::FEATURE_DEDUP) {
+        threshold = std::min(threshold, options.dedupThreshold);
+    }
+    if (sessionFeatures & TransferOptions::FEATURE_DELTA) {
+        threshold = std::min(threshold, options.deltaThreshold);
+    }
+    QByteArray entries;
+    qint64 count = 0;
+    for (int i = 0; i < filesToSend.size(); i++) {
+        const FileData &file = filesToSend.at(i);
+        if (file.isDir() || file.getSize() < threshold || i < resumeElements || (i == resumeElements && resumeOffset > 0)) {
+            continue;
+        }
+        qint64 entry[2] = { i, file.getSize() };
+        entries.append(reinterpret_cast<char *>(entry), sizeof(entry));
+        entries.append(file.getName().toUtf8());
+        entries.append('\0');
+        count++;
+    }
+    QByteArray bytes(reinterpret_cast<char *>(&count), sizeof(count));
+    bytes.append(entries);
+    return bytes;
+}
+
+void Sender::readDedupReply() {
+    // [entry count, entries of element index and hash]
+    // [byte count, entry count, entries of element index and signature]
+    qint64 replySize = 0;
+    if (sessionFeatures & TransferOptions::FEATURE_DEDUP) {
+        qint64 count;
+        if (socket->bytesAvailable() < static_cast<qint64>(sizeof(count))) {
+            // wait for more data
+            return;
+        }
+        socket->peek(reinterpret_cast<char *>(&count), sizeof(count));
+        if (count < 0 || count > filesToSend.size()) {
+            reportError(QStringLiteral("Received invalid data from %1").arg(dest));
+            return;
+        }
+        replySize = sizeof(count) * (1 + count * 2);
+    }
+    if (sessionFeatures & TransferOptions::FEATURE_DELTA) {
+        qint64 deltaBytes;
+        if (socket->bytesAvailable() < replySize + static_cast<qint64>(sizeof(deltaBytes))) {
+            // wait for more data
+            return;
+        }
+        QByteArray head = socket->peek(replySize + sizeof(deltaBytes));
+        memcpy(&deltaBytes, head.constData() + replySize, sizeof(deltaBytes));
+        if (deltaBytes < static_cast<qint64>(sizeof(qint64)) || deltaBytes > std::numeric_limits<int>::max() - replySize) {
+            reportError(QStringLiteral("Received invalid data from %1").arg(dest));
+            return;
+        }
+        replySize += sizeof(deltaBytes) + deltaBytes;
+    }
+    if (socket->bytesAvailable() < replySize) {
+        // wait for more data
+        return;
+    }
+    QByteArray reply = socket->read(replySize);
+    const char *d = reply.constData();
+    QHash<qint64, QString> files;
+    if (sessionFeatures & TransferOptions::FEATURE_DEDUP) {
+        qint64 count;
+        memcpy(&count, d, sizeof(count));
+        d += sizeof(count);
+        for (qint64 i = 0; i < count; i++) {
+            qint64 entry[2];
+            memcpy(entry, d, sizeof(entry));
+            d += sizeof(entry);
+            if (entry[0] < resumeElements || entry[0] >= filesToSend.size() || filesToSend.at(entry[0]).isDir()) {
+                reportError(QStringLiteral("Received invalid data from %1").arg(dest));
+                return;
+            }
+            dedupOffers.insert(entry[0], static_cast<quint64>(entry[1]));
+            files.insert(entry[0], filesToSend.at(entry[0]).getPath());
+        }
+    }
+    if (sessionFeatures & TransferOptions::FEATURE_DELTA) {
+        qint64 count;
+        d += sizeof(qint64);
+        memcpy(&count, d, sizeof(count));
+        d += sizeof(count);
+        const char *end = reply.constData() + reply.size();
+        for (qint64 i = 0; i < count; i++) {
+            qint64 index;
+            DeltaSignature signature;
+            qint64 size;
+            if (end - d < static_cast<qint64>(sizeof(index))) {
+                reportError(QStringLiteral("Received invalid data from %1").arg(dest));
+                return;
+            }
+            memcpy(&index, d, sizeof(index));
+            d += sizeof(index);
+            if (index < resumeElements || index >= filesToSend.size() || filesToSend.at(index).isDir()
+                    || signature.decode(d, end - d, size) == false) {
+                reportError(QStringLiteral("Received invalid data from %1").arg(dest));
+                return;
+            }
+            d += size;
+            deltaSignatures.insert(index, signature);
+        }
+    }
+    if ((sessionFeatures & TransferOptions::FEATURE_DEDUP) == 0) {
+        // nothing to compare, the differences are found while sending
+        sendStatus = PHASE_TOTAL_ELEMENTS_AND_SIZE;
+        sendData();
+        return;
+    }
+    // compare with the local copies, away from the transfer thread
+    sendStatus = PHASE_DEDUP_HASHING;
+    stats.begin(TransferStats::PHASE_SCAN);
+    hasher = new FileHasher(this);
+    connect(hasher, &FileHasher::finished, this, &Sender::dedupHashed);
+    hasher->start(files);
+}
+
+void Sender::dedupHashed() {
+    if (hasher == nullptr) {
+        return;
+    }
+    QHash<qint64, quint64> hashes = hasher->results();
+    hasher->deleteLater();
+    hasher = nullptr;
+    stats.end(TransferStats::PHASE_SCAN);
+    QByteArray indexes;
+    for (auto it = dedupOffers.constBegin(); it != dedupOffers.constEnd(); ++it) {
+        if (hashes.contains(it.key()) && hashes.value(it.key()) == it.value()) {
+            qint64 index = it.key();
+            indexes.append(reinterpret_cast<char *>(&index), sizeof(index));
+            dedupElements.insert(index);
+        }
+    }
+    dedupOffers.clear();
+    qint64 count = dedupElements.size();
+    QByteArray bytes(reinterpret_cast<char *>(&count), sizeof(count));
+    bytes.append(indexes);
+    socket->write(bytes);
+    sendStatus = PHASE_TOTAL_ELEMENTS_AND_SIZE;
+    sendData();
+}
+
+void Sender::startRanges(qint64 size, int streams) {
+    for (int i = 1; i < streams; i++) {
+        qint64 header[4] = { TransferOptions::STREAM_MAGIC, sessionToken, currentFileIndex, i };
+        qint64 offset = size * i / streams;
+        qint64 length = size * (i + 1) / streams - offset;
+        RangeSender *range = new RangeSender(dest, port, QByteArray(reinterpret_cast<char *>(header), sizeof(header)), currentFile->getPath(), offset, length, this);
+        connect(range, &RangeSender::progress, this, [this](qint64 bytes) {
+            totalBytesSent += bytes;
+            reportProgress();
+        });
+        connect(range, &RangeSender::completed, this, [this, range]() {
+            rangeSenders.removeOne(range);
+            range->deleteLater();
+            if (sendStatus == PHASE_FINALIZATION) {
+                sendData();
+            }
+        });
+        connect(range, &RangeSender::aborted, this, [this](const QString &error) {
+            reportError(error);
+        });
+        range->setChecksum(sessionFeatures & TransferOptions::FEATURE_CHECKSUM);
+        range->setWindow(options.batchSize, options.minWindow, options.maxWindow);
+        if (limiter != nullptr) {
+            // the ranges take from the rate of the session
+            range->setRateLimiter(limiter, this);
+        }
+        rangeSenders.append(range);
+        range->start();
+    }
+}
+
 void Sender::connectionError(QAbstractSocket::SocketError error) {
     Q_UNUSED(error)
     reportError(socket->errorString());
@@ -216,6 +982,63 @@ void Sender::connectionError(QAbstractSocket::SocketError error) {
 
 
 void Sender::reportError(const QString &error) {
+    reportProgress(true);
+    stats.finish();
+    emit statsUpdated(stats);
     emit aborted(error);
     abort();
 }
+
+#ifdef USE_SENDFILE
+Sender::ZERO_COPY_RESULT Sender::sendFileZeroCopy() {
+    int out = static_cast<int>(socket->socketDescriptor());
+    int in = currentFile->handle();
+    if (out == -1 || in == -1) {
+        zeroCopy = false;
+        return ZC_FALLBACK;
+    }
+    qint64 sliceBytes = 0;
+    while (currentFileSent < currentDataEnd) {
+        off_t offset = currentFile->pos();
+        size_t count = std::min<qint64>(currentDataEnd - currentFileSent, 1024 * 1024);
+        ssize_t n = ::sendfile(out, in, &offset, count);
+        if (n > 0) {
+            currentFile->seek(offset);
+            currentFileSent += n;
+            totalBytesSent += n;
+            sliceBytes += n;
+            // the kernel takes the data straight from the file, no bytesWritten signal tells of it
+            flow.transferred(n);
+            if (sliceBytes >= 16 * 1024 * 1024) {
+                // nothing is left in QTcpSocket's buffer, so no bytesWritten signal will come.
+                // reschedule to keep the event loop responsive
+                QMetaObject::invokeMethod(this, "sendData", Qt::QueuedConnection);
+                return ZC_WAIT;
+            }
+        } else if (n == 0) {
+            reportError(QStringLiteral("%1 has been changed while sending").arg(currentFile->getPath()));
+            return ZC_ERROR;
+        } else if (errno == EINTR) {
+            continue;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            // the socket buffer is full. queue a small chunk in QTcpSocket,
+            // its bytesWritten signal will wake us up when the socket drains
+            QByteArray d = currentFile->read(std::min<qint64>(currentDataEnd - currentFileSent, 64 * 1024));
+            if (d.size() > 0) {
+                socket->write(d.constData(), d.size());
+                currentFileSent += d.size();
+                totalBytesSent += d.size();
+            }
+            return ZC_WAIT;
+        } else if (errno == EINVAL || errno == ENOSYS) {
+            // not supported by the file system, use the buffered path for the rest
+            zeroCopy = false;
+            return sliceBytes > 0 ? ZC_DONE : ZC_FALLBACK;
+        } else {
+            reportError(QString::fromLocal8Bit(strerror(errno)));
+            return ZC_ERROR;
+        }
+    }
+    return ZC_DONE;
+}
+#endif
@@ -21,9 +21,28 @@
 
 #include <QObject>
 #include <QAbstractSocket>
+#include <QSet>
 #include "filedata.h"
+#include "checksum.h"
+#include "delta.h"
+#include "flowwindow.h"
+#include "transferstats.h"
+#include "progressthrottle.h"
+#include "transferoptions.h"
+
+#if defined(Q_OS_LINUX) && !defined(Q_OS_ANDROID)
+// hand file data to the kernel directly instead of copying it through QTcpSocket
+#define USE_SENDFILE
+#endif
 
 class QTcpSocket;
+class QTimer;
+class RangeSender;
+class FileScanner;
+class FileHasher;
+class SharedSource;
+class DeltaEncoder;
+class RateLimiter;
 
 class Sender : public QObject
 {
@@ -32,45 +51,156 @@ public:
     explicit Sender(const QString &dest, quint16 port, QObject *parent = nullptr);
     ~Sender();
 
-    void sendFiles(const QStringList &paths);
-    void sendFile(const QString &path, const QString &name = QString());
-    void sendText(const QString &text);
-    void abort();
+    void setOptions(const TransferOptions &options);
+    // the extensions the receiver announced, only these are offered. a classic
+    // receiver can not be probed, it stops taking transfers on a handshake
+    void setPeerFeatures(qint64 features);
+    // reads the files through a source shared with other senders, see sendShared()
+    void setSource(SharedSource *source);
+    // paces the file data, shared with other sessions
+    void setRateLimiter(RateLimiter *limiter);
+
+    Q_INVOKABLE void sendFiles(const QStringList &paths);
+    Q_INVOKABLE void sendFile(const QString &path, const QString &name = QString());
+    Q_INVOKABLE void sendText(const QString &text);
+    // sends the files of the source set with setSource()
+    Q_INVOKABLE void sendShared();
+    Q_INVOKABLE void abort();
 
 signals:
     void started(qint64 totalSize);
-    void progress(qint64 total, qint64 sent);
+    // wire counts the bytes actually sent, less than sent when data is compressed
+    void progress(qint64 total, qint64 sent, qint64 wire);
     void itemProgress(qint64 total, qint64 current, QString name);
+    // now and then along with progress, and once more before completed or aborted
+    void statsUpdated(TransferStats stats);
     void completed();
     void aborted(QString error);
 
 private slots:
     void sendData();
+    void readHandshake();
     void connectionError(QAbstractSocket::SocketError error);
+    void collectEntries();
+    void scanFinished();
+    void sourceReady();
+    void sourceAdvanced();
+    void dedupHashed();
 
 private:
+    void setupSocket();
+    void fillBatch();
+    void writeBatched(const QByteArray &data);
+    void flushBatch();
+    void writeChecksum();
+    void chargeRate(qint64 bytes);
+    void reportProgress(bool final = false);
+    void reportItem(qint64 total, qint64 current, const QString &name);
+    void connectToReceiver();
+    void startRanges(qint64 size, int streams);
+    qint64 offeredFeatures() const;
+    qint64 transferId() const;
+    QByteArray dedupManifest() const;
+    void readDedupReply();
+    bool isSkipped(int index) const;
     void reportError(const QString &error);
+#ifdef USE_SENDFILE
+    enum ZERO_COPY_RESULT {
+        ZC_DONE,
+        ZC_WAIT,
+        ZC_FALLBACK,
+        ZC_ERROR,
+    };
+    ZERO_COPY_RESULT sendFileZeroCopy();
+#endif
 
     QTcpSocket *socket;
     QString dest;
     quint16 port;
 
+    TransferOptions options;
+    qint64 peerFeatures = 0;
+    qint64 sessionFeatures = 0;
+    qint64 sessionToken = 0;
+    QTimer *handshakeTimer;
+    RateLimiter *limiter = nullptr;
+    // wakes sendData() up once the rate allows more data
+    QTimer *paceTimer;
+    // lets a held progress update through
+    QTimer *progressTimer;
+    // how much is kept in flight and read at a time
+    FlowWindow flow;
+    QList<RangeSender*> rangeSenders;
+    // elements already received in an interrupted session, and bytes of the next one
+    qint64 resumeElements = 0;
+    qint64 resumeOffset = 0;
+    // hashes of files the receiver has, and the elements found to be the same
+    FileHasher *hasher = nullptr;
+    QHash<qint64, quint64> dedupOffers;
+    QSet<qint64> dedupElements;
+    // signatures of the older copies the receiver has, by element index
+    QHash<qint64, DeltaSignature> deltaSignatures;
+
+    // filled by the scanner while the session may be going on already
+    FileScanner *scanner = nullptr;
+    bool scanning = false;
+    bool waitingForScanner = false;
+    // the header had no totals, they are sent once the scan finishes
+    bool streamedList = false;
+    bool sendingText = false;
+    // files listed and read once for a group of senders
+    SharedSource *source = nullptr;
+    bool waitingForSource = false;
+
     QList<FileData> filesToSend;
     qint64 totalElements = 0;
     int currentFileIndex = 0;
     FileData *currentFile = nullptr;
+    // bytes of the current file sent over the session connection, and where they end
+    qint64 currentFileSent = 0;
+    qint64 currentDataEnd = 0;
+    // the current file is sent in compressed frames, and compressing still pays off
+    bool currentCompressed = false;
+    bool currentTryCompress = false;
+    // the current file is sent as differences from the receiver's older copy
+    DeltaEncoder *currentDelta = nullptr;
+    // hash of the data of the current element sent over the session connection
+    Checksum currentChecksum;
     QByteArray textToSend;
+    // small writes waiting to be handed to the socket together
+    QByteArray batch;
     qint64 totalBytes = 0;
     qint64 totalBytesSent = 0;
+    // bytes saved by compression so far
+    qint64 totalBytesSaved = 0;
+    // timings of the session
+    TransferStats stats;
+    // keeps the progress signal to TransferOptions::progressRate
+    ProgressThrottle progressThrottle;
+    // the element of the last itemProgress not let through yet
+    bool itemPending = false;
+    qint64 itemTotal = 0;
+    qint64 itemCurrent = 0;
+    QString itemName;
 
     enum SEND_PHASE {
+        PHASE_NOT_CONNECTED,
+        PHASE_HANDSHAKE,
+        PHASE_HANDSHAKE_REPLY,
+        PHASE_DEDUP_REPLY,
+        PHASE_DEDUP_HASHING,
         PHASE_TOTAL_ELEMENTS_AND_SIZE,
         PHASE_ELEMENT_NAME_AND_SIZE,
         PHASE_ELEMENT_DATA,
         PHASE_FINALIZATION,
-    } sendStatus = PHASE_TOTAL_ELEMENTS_AND_SIZE;
+    } sendStatus = PHASE_NOT_CONNECTED;
 
     static QByteArray textElementName;
+    static QByteArray totalsElementName;
+
+#ifdef USE_SENDFILE
+    bool zeroCopy = true;
+#endif
 
 #ifdef Q_OS_ANDROID
     volatile AndroidScreenOn screenOn;
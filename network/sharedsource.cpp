@@ -0,0 +1,202 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2021 Xu Zhen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+#include "sharedsource.h"
+#include "filescanner.h"
+#include <algorithm>
+
+// unit of reading and caching
+static const qint64 CHUNK_SIZE = 1024 * 1024;
+
+SharedSource::SharedSource(const QStringList &paths, qint64 window, QObject *parent)
+    : QObject(parent), paths(paths), window(std::max(window, CHUNK_SIZE)) {
+}
+
+SharedSource::~SharedSource() {
+    if (scanner != nullptr) {
+        // may block until the running scan tasks stop
+        scanner->disconnect(this);
+        delete scanner;
+    }
+    delete readFile;
+}
+
+void SharedSource::start() {
+    scanner = new FileScanner(paths, this);
+    connect(scanner, &FileScanner::finished, this, &SharedSource::scanFinished);
+    scanner->start();
+}
+
+void SharedSource::scanFinished() {
+    scanError = scanner->error();
+    if (scanError.isEmpty()) {
+        scanner->takeEntries(entries, totalBytes);
+        // the same order as a sender scanning on its own
+        std::sort(entries.begin(), entries.end(), [](const FileData &a, const FileData &b) {
+            return a.getName() < b.getName();
+        });
+        qint64 start = 0;
+        for (const FileData &file : entries) {
+            starts.append(start);
+            if (file.isDir() == false) {
+                start += file.getSize();
+            }
+        }
+    }
+    scanner->deleteLater();
+    scanner = nullptr;
+    scanDone = true;
+    emit ready();
+}
+
+bool SharedSource::isReady() const {
+    return scanDone;
+}
+
+QString SharedSource::error() const {
+    return scanError;
+}
+
+const QList<FileData> &SharedSource::files() const {
+    return entries;
+}
+
+qint64 SharedSource::totalSize() const {
+    return totalBytes;
+}
+
+void SharedSource::addConsumer(QObject *consumer) {
+    positions.insert(consumer, lastSlowest);
+}
+
+void SharedSource::removeConsumer(QObject *consumer) {
+    if (positions.remove(consumer) == 0) {
+        return;
+    }
+    if (positions.isEmpty()) {
+        chunks.clear();
+        return;
+    }
+    qint64 slowest = slowestPosition();
+    if (slowest > lastSlowest) {
+        lastSlowest = slowest;
+        evict();
+        emit advanced();
+    }
+}
+
+qint64 SharedSource::slowestPosition() const {
+    if (positions.isEmpty()) {
+        return lastSlowest;
+    }
+    qint64 slowest = positions.constBegin().value();
+    for (qint64 position : positions) {
+        slowest = std::min(slowest, position);
+    }
+    return slowest;
+}
+
+void SharedSource::advance(QObject *consumer, int index, qint64 offset) {
+    auto it = positions.find(consumer);
+    if (it == positions.end() || index < 0 || index >= starts.size()) {
+        return;
+    }
+    qint64 position = starts.at(index) + offset;
+    if (position <= it.value()) {
+        return;
+    }
+    qint64 previous = it.value();
+    it.value() = position;
+    if (previous > lastSlowest) {
+        // someone else is behind
+        return;
+    }
+    qint64 slowest = slowestPosition();
+    if (slowest > lastSlowest) {
+        lastSlowest = slowest;
+        evict();
+        emit advanced();
+    }
+}
+
+// Drops the chunks every consumer is past
+void SharedSource::evict() {
+    while (chunks.isEmpty() == false && chunks.firstKey() + chunks.first().size() <= lastSlowest) {
+        chunks.erase(chunks.begin());
+    }
+}
+
+SharedSource::READ_RESULT SharedSource::read(QObject *consumer, int index, qint64 offset, qint64 maxSize, QByteArray &data) {
+    data.clear();
+    const FileData &file = entries.at(index);
+    if (file.isDir() || offset >= file.getSize()) {
+        return READ_OK;
+    }
+    qint64 chunkOffset = offset - offset % CHUNK_SIZE;
+    qint64 key = starts.at(index) + chunkOffset;
+    QByteArray chunk;
+    auto it = chunks.constFind(key);
+    if (it != chunks.constEnd()) {
+        chunk = it.value();
+    } else {
+        if (key >= slowestPosition() + window) {
+            // too far ahead of the others
+            return READ_WAIT;
+        }
+        if (readChunk(index, chunkOffset, chunk) == false) {
+            return READ_ERROR;
+        }
+        if (positions.size() > 1 && key + chunk.size() > lastSlowest) {
+            chunks.insert(key, chunk);
+        }
+    }
+    qint64 skip = offset - chunkOffset;
+    if (skip < chunk.size()) {
+        data = chunk.mid(static_cast<int>(skip), static_cast<int>(std::min<qint64>(maxSize, chunk.size() - skip)));
+    }
+    advance(consumer, index, offset + data.size());
+    return READ_OK;
+}
+
+bool SharedSource::readChunk(int index, qint64 chunkOffset, QByteArray &chunk) {
+    if (readIndex != index) {
+        delete readFile;
+        readFile = new FileData(entries.at(index));
+        readIndex = index;
+        readPos = 0;
+        if (readFile->open() == false) {
+            readIndex = -1;
+            return false;
+        }
+    }
+    if (readPos != chunkOffset) {
+#ifdef Q_OS_ANDROID
+        // content URIs are read from the start only, and there is no resume to skip ahead
+        return false;
+#else
+        if (readFile->seek(chunkOffset) == false) {
+            return false;
+        }
+        readPos = chunkOffset;
+#endif
+    }
+    chunk = readFile->read(std::min(CHUNK_SIZE, entries.at(index).getSize() - chunkOffset));
+    readPos += chunk.size();
+    return true;
+}
@@ -0,0 +1,99 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2021 Xu Zhen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+#ifndef SHAREDSOURCE_H
+#define SHAREDSOURCE_H
+
+#include <QObject>
+#include <QHash>
+#include <QMap>
+#include "filedata.h"
+
+class FileScanner;
+
+// The files of one send to several buddies. They are listed once, and every
+// chunk is read from disk once and kept until all senders of the group are
+// past it. The leading sender may get no further than window bytes ahead of
+// the slowest one, so memory stays bounded and the group moves at the pace
+// of its slowest receiver.
+// Lives in the transfer thread along with its senders.
+class SharedSource : public QObject
+{
+    Q_OBJECT
+public:
+    explicit SharedSource(const QStringList &paths, qint64 window, QObject *parent = nullptr);
+    ~SharedSource();
+
+    enum READ_RESULT {
+        READ_OK,
+        READ_WAIT,
+        READ_ERROR,
+    };
+
+    Q_INVOKABLE void start();
+    bool isReady() const;
+    QString error() const;
+    // sorted by name, complete once ready
+    const QList<FileData> &files() const;
+    qint64 totalSize() const;
+
+    void addConsumer(QObject *consumer);
+    void removeConsumer(QObject *consumer);
+    // the consumer has nothing to read before this point, e.g. an element received earlier
+    void advance(QObject *consumer, int index, qint64 offset);
+    // Reads up to maxSize bytes of element index at offset. READ_WAIT means the
+    // data is too far ahead of the slowest consumer, try again after advanced()
+    READ_RESULT read(QObject *consumer, int index, qint64 offset, qint64 maxSize, QByteArray &data);
+
+signals:
+    void ready();
+    // the slowest consumer has moved on, waiting reads may go on
+    void advanced();
+
+private slots:
+    void scanFinished();
+
+private:
+    qint64 slowestPosition() const;
+    void evict();
+    bool readChunk(int index, qint64 chunkOffset, QByteArray &chunk);
+
+    QStringList paths;
+    qint64 window;
+    FileScanner *scanner = nullptr;
+    bool scanDone = false;
+    QString scanError;
+    QList<FileData> entries;
+    // where every element starts in the concatenation of all file data
+    QList<qint64> starts;
+    qint64 totalBytes = 0;
+
+    // position of every consumer in the concatenation
+    QHash<QObject*, qint64> positions;
+    qint64 lastSlowest = 0;
+    // chunks by their position in the concatenation
+    QMap<qint64, QByteArray> chunks;
+
+    // the file chunks are read from
+    FileData *readFile = nullptr;
+    int readIndex = -1;
+    qint64 readPos = 0;
+};
+
+#endif // SHAREDSOURCE_H
@@ -0,0 +1,198 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2021 Xu Zhen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef TRANSFEROPTIONS_H
+#define TRANSFEROPTIONS_H
+
+#include <QtGlobal>
+#include <QHash>
+#include <QString>
+
+/*
+ * Optional extensions of the transfer protocol
+ *
+ * A sender which wants any of them starts the session with
+ *   HANDSHAKE_MAGIC (in place of the total element count)
+ *   offered features
+ * and the receiver answers
+ *   accepted features
+ *   session token
+ * then the classic session follows. All values are qint64.
+ * A classic receiver takes the negative element count as an error and stops
+ * taking transfers, so the handshake is only sent to buddies which announced
+ * the features they accept with a MSG_FEATURES message, see buddymessage.h.
+ *
+ * FEATURE_MULTI_STREAM
+ *   An element with a size >= 0 is followed by its element flags. The low
+ *   byte of the flags is the number of streams N carrying the data. When N > 1,
+ *   the data is split into N ranges, range i covers [size * i / N, size * (i + 1) / N).
+ *   Range 0 follows on the session connection, every other range is sent over
+ *   a new connection which starts with
+ *     STREAM_MAGIC
+ *     session token
+ *     element index
+ *     range index
+ *
+ * FEATURE_RESUME
+ *   The offered features are followed by a transfer id, a hash of the element
+ *   names, sizes and modification times. If the feature is accepted, the reply
+ *   is followed by
+ *     number of elements already received
+ *     bytes of the next element already received
+ *   from an earlier, interrupted session with the same id. The sender then sends
+ *   the names and sizes of the received elements without their data, and the
+ *   data of the next element from that offset, over the session connection only.
+ *
+ * FEATURE_COMPRESSION
+ *   An element with a size >= 0 is followed by its element flags, as with
+ *   FEATURE_MULTI_STREAM. If ELEMENT_COMPRESSED is set, the element is sent
+ *   over one stream and its data is a sequence of frames, see compression.cpp.
+ *
+ * FEATURE_STREAMED_LIST
+ *   The sender may start before it has listed all its files, with -1 as both
+ *   the total element count and the total size. Once the list is complete it
+ *   sends, between two elements, a control element named ___DUKTO___TOTALS___
+ *   with a size of 16, whose data is the total element count and the total size.
+ *   The control element is not counted as an element.
+ *
+ * FEATURE_CHECKSUM
+ *   The data of every file and text element is followed by the XXH64 hash
+ *   (seed 0) of that data, see checksum.cpp. The hash covers the data as
+ *   carried by the connection, before compression and without the part skipped
+ *   by a resume. Likewise, every range sent over an extra connection is followed
+ *   by the hash of the range. A receiver finding a mismatch ends the session
+ *   and restarts the element on resume.
+ *
+ * FEATURE_DEDUP
+ *   Right after the handshake reply (and the resume point), the sender sends
+ *   a manifest of the files it would rather not send if the receiver has them
+ *     entry count
+ *     entry { element index, size, element name + '\0' }...
+ *   The receiver looks for files with the same name and size in its
+ *   destination directory, hashes them and answers
+ *     entry count
+ *     entry { element index, XXH64 hash of the whole file }...
+ *   The sender hashes its own copies of these files and tells which ones match
+ *     element count
+ *     element index...
+ *   The matching elements are then sent like the ones received before a
+ *   resume, the names and sizes without their data. A single file stays as
+ *   it is on the receiver; files of a folder which lands under a new name are
+ *   hard-linked from the local copies, or copied where links are not possible.
+ *
+ * FEATURE_DELTA
+ *   The manifest of FEATURE_DEDUP is sent, and the receiver adds to its
+ *   answer (after the hashes, if FEATURE_DEDUP is accepted too)
+ *     byte count of the rest
+ *     entry count
+ *     entry { element index, signature }...
+ *   with the signature of every file with the name of an entry, whatever its
+ *   size, see delta.h. The match list of FEATURE_DEDUP is only sent if that
+ *   feature is accepted. Elements with a size >= 0 are followed by element
+ *   flags, as with FEATURE_MULTI_STREAM. If ELEMENT_DELTA is set, the element
+ *   is sent over one stream and its data is a sequence of delta instructions
+ *   against the file of the signature. The receiver rebuilds the element
+ *   under its own path, the older copy is left as it is.
+ *   With FEATURE_CHECKSUM, the hash covers the rebuilt data.
+ */
+class TransferOptions
+{
+public:
+    enum MAGIC : qint64 {
+        HANDSHAKE_MAGIC = -0x44554b544f0001LL,
+        STREAM_MAGIC    = -0x44554b544f0002LL,
+    };
+
+    enum FEATURE : qint64 {
+        FEATURE_MULTI_STREAM  = 0x01,
+        FEATURE_RESUME        = 0x02,
+        FEATURE_COMPRESSION   = 0x04,
+        FEATURE_STREAMED_LIST = 0x08,
+        FEATURE_CHECKSUM      = 0x10,
+        FEATURE_DEDUP         = 0x20,
+        FEATURE_DELTA         = 0x40,
+    };
+
+    enum ELEMENT_FLAG : qint64 {
+        ELEMENT_STREAMS_MASK = 0xff,
+        ELEMENT_COMPRESSED   = 0x100,
+        ELEMENT_DELTA        = 0x200,
+    };
+
+    static qint64 supportedFeatures() {
+#ifdef Q_OS_ANDROID
+        // content URIs can be neither read nor written at an offset
+        return 0;
+#else
+        qint64 features = FEATURE_MULTI_STREAM | FEATURE_RESUME | FEATURE_STREAMED_LIST | FEATURE_CHECKSUM | FEATURE_DEDUP | FEATURE_DELTA;
+#ifdef USE_LZ4
+        // the frames are LZ4 blocks, see compression.cpp
+        features |= FEATURE_COMPRESSION;
+#endif
+        return features;
+#endif
+    }
+
+    // features which add element flags after the size of an element
+    static qint64 elementFlagFeatures() {
+        return FEATURE_MULTI_STREAM | FEATURE_COMPRESSION | FEATURE_DELTA;
+    }
+
+    // features offered when sending
+    qint64 sendFeatures = 0;
+    // features accepted when receiving
+    qint64 receiveFeatures = supportedFeatures();
+
+    // number of connections used for a large file
+    int streams = 4;
+    // files smaller than this are sent over a single connection
+    qint64 multiStreamThreshold = 64 * 1024 * 1024;
+    // headers and data of small files are collected up to this size before a
+    // socket write. it is also the first size of the window below
+    int batchSize = 1024 * 1024;
+    // the data a sender leaves in the socket buffer and its file reads follow
+    // the bandwidth-delay product of the connection between these, see FlowWindow
+    qint64 minWindow = 64 * 1024;
+    qint64 maxWindow = 16 * 1024 * 1024;
+    // large files are sent with sendfile() where the platform has it, see Sender
+    bool zeroCopy = true;
+    // files smaller than this are not compressed
+    qint64 compressionThreshold = 4096;
+    // files smaller than this are sent even if the receiver may have them,
+    // reading them on both ends would cost more than sending them
+    qint64 dedupThreshold = 1024 * 1024;
+    // files smaller than this are sent whole even if the receiver has an older copy
+    qint64 deltaThreshold = 16 * 1024 * 1024;
+    // received data waiting for the disk is limited to this
+    qint64 writeBufferSize = 16 * 1024 * 1024;
+    // sessions received at the same time, further senders wait in a queue
+    int concurrentSessions = 4;
+    // sessions sent at the same time, further send jobs wait in a queue
+    int concurrentSends = 4;
+    // when sending to several buddies at once, data read ahead of the slowest one is limited to this
+    qint64 fanOutWindow = 32 * 1024 * 1024;
+    // progress signals a session emits per second at most, 0 for one per change.
+    // the last one is emitted in any case
+    int progressRate = 10;
+    // bytes per second all transfers together may use, 0 for no limit, see RateLimiter
+    qint64 rateLimit = 0;
+    // the same for the transfers with one buddy, by address
+    QHash<QString, qint64> peerRateLimits;
+};
+
+#endif // TRANSFEROPTIONS_H
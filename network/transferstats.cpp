@@ -0,0 +1,231 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2021 Xu Zhen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "transferstats.h"
+#include <QDateTime>
+#include <algorithm>
+#include <cmath>
+
+// the rate is taken over this long, in ms
+#define RATE_WINDOW 5000
+// samples of the rate are this far apart at least, in ms
+#define SAMPLE_TIME 100
+// blocked for longer than this counts as a stall, in ms
+#define STALL_TIME 1000
+// copies are handed out this often, in ms
+#define REPORT_TIME 500
+
+void TransferStats::start(bool sending, const QString &peer) {
+    this->sending = sending;
+    this->peer = peer;
+    startedAt = QDateTime::currentMSecsSinceEpoch();
+    clock.start();
+}
+
+qint64 TransferStats::now() const {
+    if (finishedAfter >= 0) {
+        return finishedAfter;
+    }
+    return clock.isValid() ? clock.elapsed() : 0;
+}
+
+qint64 TransferStats::elapsed() const {
+    return now();
+}
+
+void TransferStats::begin(PHASE phase) {
+    Phase &p = phases[phase];
+    if (p.openedAt >= 0 || finishedAfter >= 0) {
+        return;
+    }
+    p.openedAt = now();
+    if (p.start < 0) {
+        p.start = p.openedAt;
+    }
+    p.count++;
+}
+
+void TransferStats::end(PHASE phase) {
+    Phase &p = phases[phase];
+    if (p.openedAt < 0) {
+        return;
+    }
+    p.time += now() - p.openedAt;
+    p.openedAt = -1;
+}
+
+void TransferStats::enter(PHASE phase) {
+    if (current == phase) {
+        return;
+    }
+    if (current >= 0) {
+        end(static_cast<PHASE>(current));
+    }
+    current = phase;
+    begin(phase);
+}
+
+void TransferStats::progress(qint64 total, qint64 transferred, qint64 wire) {
+    totalBytes = total;
+    transferredBytes = transferred;
+    wireBytes = wire;
+    qint64 t = now();
+    if (samples.isEmpty() == false && t - samples.last().time < SAMPLE_TIME) {
+        return;
+    }
+    samples.append({t, transferred});
+    int old = 0;
+    while (old < samples.size() - 1 && samples.at(old + 1).time <= t - RATE_WINDOW) {
+        old++;
+    }
+    if (old > 0) {
+        samples.remove(0, old);
+    }
+}
+
+void TransferStats::setUpdates(qint64 emitted, qint64 held) {
+    updatesEmitted = emitted;
+    updatesHeld = held;
+}
+
+void TransferStats::setBlocked(bool blocked) {
+    if (blocked) {
+        if (blockedSince < 0) {
+            blockedSince = now();
+        }
+        return;
+    }
+    if (blockedSince >= 0) {
+        qint64 time = now() - blockedSince;
+        if (time >= STALL_TIME) {
+            stallCount++;
+            stallMs += time;
+        }
+        blockedSince = -1;
+    }
+}
+
+void TransferStats::finish() {
+    if (finishedAfter >= 0) {
+        return;
+    }
+    setBlocked(false);
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        end(static_cast<PHASE>(i));
+    }
+    current = -1;
+    finishedAfter = now();
+}
+
+bool TransferStats::due() {
+    qint64 t = now();
+    if (lastReport >= 0 && t - lastReport < REPORT_TIME) {
+        return false;
+    }
+    lastReport = t;
+    return true;
+}
+
+double TransferStats::rate() const {
+    if (samples.isEmpty()) {
+        return 0;
+    }
+    // a stall shows as a falling rate, not as the last one measured
+    qint64 span = now() - samples.first().time;
+    if (span < SAMPLE_TIME) {
+        return 0;
+    }
+    return (transferredBytes - samples.first().bytes) * 1000.0 / span;
+}
+
+double TransferStats::averageRate() const {
+    qint64 span = now();
+    if (span <= 0) {
+        return 0;
+    }
+    return transferredBytes * 1000.0 / span;
+}
+
+qint64 TransferStats::eta() const {
+    double r = rate();
+    if (totalBytes < 0 || r <= 0) {
+        return -1;
+    }
+    return static_cast<qint64>(std::ceil(std::max<qint64>(totalBytes - transferredBytes, 0) / r));
+}
+
+qint64 TransferStats::stallTime() const {
+    // a stall still going on counts once it is long enough
+    qint64 time = (blockedSince >= 0 ? now() - blockedSince : 0);
+    return stallMs + (time >= STALL_TIME ? time : 0);
+}
+
+qint64 TransferStats::phaseTime(PHASE phase) const {
+    const Phase &p = phases[phase];
+    return p.time + (p.openedAt >= 0 ? now() - p.openedAt : 0);
+}
+
+qint64 TransferStats::phaseStart(PHASE phase) const {
+    return phases[phase].start;
+}
+
+int TransferStats::phaseCount(PHASE phase) const {
+    return phases[phase].count;
+}
+
+const char *TransferStats::phaseName(PHASE phase) {
+    static const char *names[PHASE_COUNT] = { "scan", "connect", "header", "data", "finalization" };
+    return names[phase];
+}
+
+QJsonObject TransferStats::toJson() const {
+    QJsonObject json;
+    json.insert(QStringLiteral("direction"), sending ? QStringLiteral("send") : QStringLiteral("receive"));
+    json.insert(QStringLiteral("peer"), peer);
+    json.insert(QStringLiteral("startedAt"), QDateTime::fromMSecsSinceEpoch(startedAt).toString(Qt::ISODate));
+    json.insert(QStringLiteral("elapsedMs"), elapsed());
+    json.insert(QStringLiteral("finished"), finishedAfter >= 0);
+    json.insert(QStringLiteral("totalBytes"), totalBytes);
+    json.insert(QStringLiteral("transferredBytes"), transferredBytes);
+    json.insert(QStringLiteral("wireBytes"), wireBytes);
+    json.insert(QStringLiteral("rate"), rate());
+    json.insert(QStringLiteral("averageRate"), averageRate());
+    json.insert(QStringLiteral("eta"), eta());
+    json.insert(QStringLiteral("stalls"), stallCount);
+    json.insert(QStringLiteral("stallMs"), stallTime());
+    json.insert(QStringLiteral("progressUpdates"), updatesEmitted);
+    json.insert(QStringLiteral("progressHeld"), updatesHeld);
+    QJsonObject phaseTimes;
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        PHASE phase = static_cast<PHASE>(i);
+        if (phaseCount(phase) == 0) {
+            continue;
+        }
+        QJsonObject p;
+        p.insert(QStringLiteral("startMs"), phaseStart(phase));
+        p.insert(QStringLiteral("timeMs"), phaseTime(phase));
+        p.insert(QStringLiteral("count"), phaseCount(phase));
+        phaseTimes.insert(QString::fromLatin1(phaseName(phase)), p);
+    }
+    json.insert(QStringLiteral("phases"), phaseTimes);
+    return json;
+}
+
+QVariantMap TransferStats::toVariantMap() const {
+    return toJson().toVariantMap();
+}
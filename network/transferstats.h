@@ -0,0 +1,137 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2021 Xu Zhen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef TRANSFERSTATS_H
+#define TRANSFERSTATS_H
+
+#include <QElapsedTimer>
+#include <QJsonObject>
+#include <QMetaType>
+#include <QVariantMap>
+#include <QVector>
+
+// Where the time of a session goes, kept by Sender and Receiver and handed
+// out as copies with their statsUpdated() signal. The phases of the main line
+// follow each other, the scan overlaps them. Times are relative to start()
+class TransferStats
+{
+public:
+    enum PHASE {
+        // listing the files to send, or hashing the local copies the sender may skip
+        PHASE_SCAN,
+        // connection and extension handshake
+        PHASE_CONNECT,
+        // element headers
+        PHASE_HEADER,
+        // element data
+        PHASE_DATA,
+        // waiting for the data to drain to the peer or to the disk
+        PHASE_FINALIZATION,
+        PHASE_COUNT
+    };
+
+    void start(bool sending, const QString &peer);
+    // begin() and end() time a phase which may overlap others
+    void begin(PHASE phase);
+    void end(PHASE phase);
+    // ends the current phase of the main line and begins this one
+    void enter(PHASE phase);
+    // the values of the progress signal
+    void progress(qint64 total, qint64 transferred, qint64 wire);
+    // progress signals emitted and held back by ProgressThrottle so far
+    void setUpdates(qint64 emitted, qint64 held);
+    // the data can not go on, the socket or the disk is full
+    void setBlocked(bool blocked);
+    // ends what is still running, the values do not change any more
+    void finish();
+    // true at most every REPORT_TIME ms, so that copies are not made for every chunk
+    bool due();
+
+    qint64 elapsed() const;
+    bool finished() const {
+        return finishedAfter >= 0;
+    }
+    qint64 total() const {
+        return totalBytes;
+    }
+    qint64 transferred() const {
+        return transferredBytes;
+    }
+    qint64 wire() const {
+        return wireBytes;
+    }
+    // bytes per second over the last RATE_WINDOW ms, and over the whole session
+    double rate() const;
+    double averageRate() const;
+    // seconds left at the current rate, -1 if unknown
+    qint64 eta() const;
+    int stalls() const {
+        return stallCount;
+    }
+    qint64 stallTime() const;
+    // ms the phase has taken so far, and when it was first entered, -1 if never
+    qint64 phaseTime(PHASE phase) const;
+    qint64 phaseStart(PHASE phase) const;
+    int phaseCount(PHASE phase) const;
+
+    QJsonObject toJson() const;
+    QVariantMap toVariantMap() const;
+
+    static const char *phaseName(PHASE phase);
+
+private:
+    qint64 now() const;
+
+    QElapsedTimer clock;
+    bool sending = false;
+    QString peer;
+    qint64 startedAt = 0;
+    qint64 finishedAfter = -1;
+
+    qint64 totalBytes = -1;
+    qint64 transferredBytes = 0;
+    qint64 wireBytes = 0;
+    qint64 updatesEmitted = 0;
+    qint64 updatesHeld = 0;
+
+    struct Phase {
+        qint64 start = -1;
+        qint64 time = 0;
+        qint64 openedAt = -1;
+        int count = 0;
+    };
+    Phase phases[PHASE_COUNT];
+    int current = -1;
+
+    // transferred bytes over time, for the rate over the last RATE_WINDOW ms
+    struct Sample {
+        qint64 time;
+        qint64 bytes;
+    };
+    QVector<Sample> samples;
+
+    qint64 blockedSince = -1;
+    int stallCount = 0;
+    qint64 stallMs = 0;
+
+    qint64 lastReport = -1;
+};
+
+Q_DECLARE_METATYPE(TransferStats)
+
+#endif // TRANSFERSTATS_H
@@ -19,7 +19,7 @@
 import QtQuick 2.3
 
 Flickable {
-    property var lastItem: (guiBehind.isDesktopApp() ? cswitch : colorBoxes)
+    property var lastItem: rateRect
 
     id: settingsPage
     interactive: (lastItem.y + lastItem.height + 20) > height
@@ -312,5 +312,54 @@ Flickable {
                 }
             }
         }
+
+        SText {
+            id: labelRate
+            anchors.left: labelPath.left
+            anchors.top: (guiBehind.isDesktopApp() ? cswitch.bottom : picker.bottom)
+            anchors.topMargin: 30
+            font.pixelSize: 16
+            text: "Limit transfers to (KB/s, 0 for no limit):"
+            color: "#888888"
+        }
+
+        Rectangle {
+            id: rateRect
+            anchors.left: labelPath.left
+            anchors.top: labelRate.bottom
+            anchors.topMargin: 8
+            width: 120
+            height: 30
+            color: theme.mainColor
+            clip: true
+
+            Image {
+                anchors.top: parent.top
+                anchors.left: parent.left
+                source: "PanelGradient.png"
+            }
+
+            TextInput {
+                id: rateText
+                anchors.leftMargin: 5
+                anchors.rightMargin: 5
+                anchors.fill: parent
+                horizontalAlignment: Text.AlignLeft
+                verticalAlignment: Text.AlignVCenter
+                font.pixelSize: 12
+                font.family: duktofontsmall.name
+                selectByMouse: true
+                validator: IntValidator { bottom: 0 }
+                text: guiBehind.rateLimit
+                color: "#ffffff"
+                Connections {
+                    function onEditingFinished() {
+                        if (rateText.text !== "" && guiBehind.rateLimit !== parseInt(rateText.text)) {
+                            guiBehind.rateLimit = parseInt(rateText.text)
+                        }
+                    }
+                }
+            }
+        }
     }
 }
@@ -21,6 +21,7 @@
 
 #include <QSettings>
 #include <QDir>
+#include <algorithm>
 #include "theme.h"
 
 
@@ -127,3 +128,166 @@ void Settings::saveCloseToTrayEnabled(bool enabled) {
     mSettings.setValue("CloseToTray", enabled);
     mSettings.sync();
 }
+
+int Settings::transferStreams() {
+    return mSettings.value("TransferStreams", 1).toInt();
+}
+
+void Settings::saveTransferStreams(int streams) {
+    mSettings.setValue("TransferStreams", streams);
+    mSettings.sync();
+}
+
+bool Settings::resumeTransfersEnabled() {
+    return mSettings.value("ResumeTransfers", false).toBool();
+}
+
+void Settings::saveResumeTransfersEnabled(bool enabled) {
+    mSettings.setValue("ResumeTransfers", enabled);
+    mSettings.sync();
+}
+
+bool Settings::compressionEnabled() {
+    return mSettings.value("TransferCompression", false).toBool();
+}
+
+void Settings::saveCompressionEnabled(bool enabled) {
+    mSettings.setValue("TransferCompression", enabled);
+    mSettings.sync();
+}
+
+bool Settings::checksumEnabled() {
+    return mSettings.value("VerifyTransfers", false).toBool();
+}
+
+void Settings::saveChecksumEnabled(bool enabled) {
+    mSettings.setValue("VerifyTransfers", enabled);
+    mSettings.sync();
+}
+
+bool Settings::dedupEnabled() {
+    return mSettings.value("SkipExistingFiles", false).toBool();
+}
+
+void Settings::saveDedupEnabled(bool enabled) {
+    mSettings.setValue("SkipExistingFiles", enabled);
+    mSettings.sync();
+}
+
+bool Settings::deltaEnabled() {
+    return mSettings.value("DeltaTransfers", false).toBool();
+}
+
+void Settings::saveDeltaEnabled(bool enabled) {
+    mSettings.setValue("DeltaTransfers", enabled);
+    mSettings.sync();
+}
+
+bool Settings::streamedListEnabled() {
+    return mSettings.value("StreamedFolderList", false).toBool();
+}
+
+void Settings::saveStreamedListEnabled(bool enabled) {
+    mSettings.setValue("StreamedFolderList", enabled);
+    mSettings.sync();
+}
+
+int Settings::concurrentTransfers() {
+    return mSettings.value("ConcurrentTransfers", 4).toInt();
+}
+
+void Settings::saveConcurrentTransfers(int sessions) {
+    mSettings.setValue("ConcurrentTransfers", sessions);
+    mSettings.sync();
+}
+
+int Settings::concurrentSends() {
+    return mSettings.value("ConcurrentSends", 4).toInt();
+}
+
+void Settings::saveConcurrentSends(int sessions) {
+    mSettings.setValue("ConcurrentSends", sessions);
+    mSettings.sync();
+}
+
+qint64 Settings::rateLimit() {
+    return mSettings.value("RateLimit", 0).toLongLong();
+}
+
+void Settings::saveRateLimit(qint64 rate) {
+    mSettings.setValue("RateLimit", rate);
+    mSettings.sync();
+}
+
+QHash<QString, qint64> Settings::peerRateLimits() {
+    QHash<QString, qint64> rates;
+    mSettings.beginGroup("PeerRateLimits");
+    const QStringList addresses = mSettings.childKeys();
+    for (const QString &address : addresses) {
+        qint64 rate = mSettings.value(address, 0).toLongLong();
+        if (rate > 0) {
+            rates.insert(address, rate);
+        }
+    }
+    mSettings.endGroup();
+    return rates;
+}
+
+void Settings::savePeerRateLimit(const QString &address, qint64 rate) {
+    mSettings.beginGroup("PeerRateLimits");
+    if (rate > 0) {
+        mSettings.setValue(address, rate);
+    } else {
+        mSettings.remove(address);
+    }
+    mSettings.endGroup();
+    mSettings.sync();
+}
+
+bool Settings::metricsEnabled() {
+    return mSettings.value("ServeMetrics", false).toBool();
+}
+
+void Settings::saveMetricsEnabled(bool enabled) {
+    mSettings.setValue("ServeMetrics", enabled);
+    mSettings.sync();
+}
+
+TransferOptions Settings::transferOptions() {
+    // Large files are split over several connections only when asked to
+    TransferOptions options;
+    options.streams = transferStreams();
+    if (options.streams > 1) {
+        options.sendFeatures |= TransferOptions::FEATURE_MULTI_STREAM;
+    }
+    // and interrupted transfers are continued only when asked to
+    if (resumeTransfersEnabled()) {
+        options.sendFeatures |= TransferOptions::FEATURE_RESUME;
+    }
+    if (compressionEnabled()) {
+        options.sendFeatures |= TransferOptions::FEATURE_COMPRESSION;
+    }
+    // and elements are verified end to end only when asked to
+    if (checksumEnabled()) {
+        options.sendFeatures |= TransferOptions::FEATURE_CHECKSUM;
+    }
+    // and files the receiver has already are skipped only when asked to
+    if (dedupEnabled()) {
+        options.sendFeatures |= TransferOptions::FEATURE_DEDUP;
+    }
+    // and only the changed blocks of files the receiver has an older copy of
+    if (deltaEnabled()) {
+        options.sendFeatures |= TransferOptions::FEATURE_DELTA;
+    }
+    // and large folders are sent before they have been listed completely only when asked to
+    if (streamedListEnabled()) {
+        options.sendFeatures |= TransferOptions::FEATURE_STREAMED_LIST;
+    }
+    // Further senders wait for one of these
+    options.concurrentSessions = std::max(1, concurrentTransfers());
+    options.concurrentSends = std::max(1, concurrentSends());
+    // Leave room on shared links when asked to
+    options.rateLimit = std::max<qint64>(0, rateLimit());
+    options.peerRateLimits = peerRateLimits();
+    return options;
+}
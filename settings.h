@@ -21,6 +21,7 @@
 
 #include <QObject>
 #include <QSettings>
+#include "network/transferoptions.h"
 
 #define gSettings (&Settings::instance())
 
@@ -44,6 +45,33 @@ public:
     void saveNotificationEnabled(bool enabled);
     bool closeToTrayEnabled();
     void saveCloseToTrayEnabled(bool enabled);
+    int transferStreams();
+    void saveTransferStreams(int streams);
+    bool resumeTransfersEnabled();
+    void saveResumeTransfersEnabled(bool enabled);
+    bool compressionEnabled();
+    void saveCompressionEnabled(bool enabled);
+    bool checksumEnabled();
+    void saveChecksumEnabled(bool enabled);
+    bool dedupEnabled();
+    void saveDedupEnabled(bool enabled);
+    bool deltaEnabled();
+    void saveDeltaEnabled(bool enabled);
+    bool streamedListEnabled();
+    void saveStreamedListEnabled(bool enabled);
+    int concurrentTransfers();
+    void saveConcurrentTransfers(int sessions);
+    int concurrentSends();
+    void saveConcurrentSends(int sessions);
+    // bytes per second, 0 for no limit
+    qint64 rateLimit();
+    void saveRateLimit(qint64 rate);
+    QHash<QString, qint64> peerRateLimits();
+    void savePeerRateLimit(const QString &address, qint64 rate);
+    // totals of the transfers at /metrics of the avatar server
+    bool metricsEnabled();
+    void saveMetricsEnabled(bool enabled);
+    TransferOptions transferOptions();
 
 private:
     explicit Settings(QObject *parent = nullptr);
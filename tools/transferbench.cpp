@@ -0,0 +1,451 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2021 Xu Zhen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+// Runs a Sender and a Receiver over the loopback interface against synthetic
+// file trees and reports throughput, CPU time and peak memory. Both sides live
+// in one process, each on a thread of its own, as on two machines.
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QTemporaryDir>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QThread>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTextStream>
+#include <algorithm>
+#include "network/sender.h"
+#include "network/receiver.h"
+#include "network/transferoptions.h"
+
+#ifdef Q_OS_UNIX
+#include <sys/resource.h>
+#include <sys/time.h>
+#endif
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 10, 0)
+#include <QRandomGenerator>
+#endif
+
+struct Usage {
+    // seconds of CPU time, -1 if unknown
+    double cpu = -1;
+    // peak resident set size in bytes, -1 if unknown
+    qint64 peakRss = -1;
+};
+
+#if defined(Q_OS_LINUX)
+// The peak resident set size in bytes as VmHWM tells it, -1 if unknown. Unlike
+// ru_maxrss it follows resetPeakRss()
+static qint64 highWaterMark() {
+    QFile status(QStringLiteral("/proc/self/status"));
+    if (status.open(QFile::ReadOnly | QFile::Text) == false) {
+        return -1;
+    }
+    // VmHWM:     12345 kB
+    QByteArray line;
+    while ((line = status.readLine()).isEmpty() == false) {
+        if (line.startsWith("VmHWM:")) {
+            bool ok;
+            qint64 kb = line.mid(6).trimmed().split(' ').value(0).toLongLong(&ok);
+            return ok ? kb * 1024 : -1;
+        }
+    }
+    return -1;
+}
+#endif
+
+static Usage currentUsage() {
+    Usage usage;
+#ifdef Q_OS_UNIX
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) == 0) {
+        usage.cpu = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+#ifdef Q_OS_MACOS
+        usage.peakRss = ru.ru_maxrss;
+#else
+        usage.peakRss = ru.ru_maxrss * 1024LL;
+#endif
+    }
+#endif
+#if defined(Q_OS_LINUX)
+    qint64 hwm = highWaterMark();
+    if (hwm >= 0) {
+        usage.peakRss = hwm;
+    }
+#endif
+    return usage;
+}
+
+// Lets the peak of the next scenario be measured on its own, where the kernel
+// allows it. Only VmHWM is reset, ru_maxrss keeps the peak of the whole process
+static void resetPeakRss() {
+#if defined(Q_OS_LINUX)
+    QFile clearRefs(QStringLiteral("/proc/self/clear_refs"));
+    if (clearRefs.open(QFile::WriteOnly)) {
+        clearRefs.write("5");
+    }
+#endif
+}
+
+static QByteArray randomBlock(int size) {
+    QByteArray block(size, Qt::Uninitialized);
+    quint32 *p = reinterpret_cast<quint32 *>(block.data());
+    for (int i = 0; i < size / 4; i++) {
+#if QT_VERSION >= QT_VERSION_CHECK(5, 10, 0)
+        p[i] = QRandomGenerator::global()->generate();
+#else
+        p[i] = static_cast<quint32>(qrand()) << 16 ^ static_cast<quint32>(qrand());
+#endif
+    }
+    return block;
+}
+
+static QByteArray textBlock(int size) {
+    static const QByteArray line("The quick brown fox jumps over the lazy dog, again and again and again.\n");
+    QByteArray block;
+    block.reserve(size);
+    while (block.size() < size) {
+        block.append(line);
+    }
+    block.truncate(size);
+    return block;
+}
+
+static bool writeFile(const QString &path, qint64 size, const QByteArray &block) {
+    QFile file(path);
+    if (file.open(QFile::WriteOnly) == false) {
+        return false;
+    }
+    while (size > 0) {
+        qint64 n = std::min<qint64>(size, block.size());
+        if (file.write(block.constData(), n) < n) {
+            return false;
+        }
+        size -= n;
+    }
+    return true;
+}
+
+struct Tree {
+    QString name;
+    QStringList paths;
+    qint64 files = 0;
+    qint64 bytes = 0;
+};
+
+static bool makeHugeTree(const QString &root, qint64 size, Tree &tree) {
+    tree.name = QStringLiteral("huge");
+    QString path = QDir(root).filePath(QStringLiteral("huge.bin"));
+    tree.paths << path;
+    tree.files = 1;
+    tree.bytes = size;
+    return writeFile(path, size, randomBlock(1024 * 1024));
+}
+
+// name is tiny, or headers for files of a few bytes, where the time goes into
+// the element headers rather than the data
+static bool makeTinyTree(const QString &root, const QString &name, int count, int size, Tree &tree) {
+    tree.name = name;
+    QDir dir(root);
+    QByteArray block = randomBlock(size);
+    for (int i = 0; i < count; i++) {
+        // no more than a thousand entries per directory
+        QString sub = QStringLiteral("%1/d%2").arg(name).arg(i / 1000, 3, 10, QChar('0'));
+        if (i % 1000 == 0 && dir.mkpath(sub) == false) {
+            return false;
+        }
+        if (writeFile(dir.filePath(QStringLiteral("%1/f%2").arg(sub).arg(i, 6, 10, QChar('0'))), block.size(), block) == false) {
+            return false;
+        }
+    }
+    tree.paths << dir.filePath(name);
+    tree.files = count;
+    tree.bytes = count * static_cast<qint64>(block.size());
+    return true;
+}
+
+static bool makeMixedTree(const QString &root, Tree &tree) {
+    tree.name = QStringLiteral("mixed");
+    // count, size, compressible
+    static const struct { int count; qint64 size; bool text; } groups[] = {
+        { 2000, 4 * 1024, true },
+        { 2000, 4 * 1024, false },
+        { 200, 256 * 1024, true },
+        { 200, 256 * 1024, false },
+        { 20, 8 * 1024 * 1024, false },
+        { 2, 128 * 1024 * 1024, false },
+    };
+    QDir dir(root);
+    QByteArray random = randomBlock(1024 * 1024);
+    QByteArray text = textBlock(1024 * 1024);
+    int n = 0;
+    int g = 0;
+    for (const auto &group : groups) {
+        for (int i = 0; i < group.count; i++, n++) {
+            QString sub = QStringLiteral("mixed/g%1/d%2").arg(g).arg(i / 100);
+            if (i % 100 == 0 && dir.mkpath(sub) == false) {
+                return false;
+            }
+            if (writeFile(dir.filePath(QStringLiteral("%1/f%2").arg(sub).arg(n)), group.size, group.text ? text : random) == false) {
+                return false;
+            }
+            tree.files++;
+            tree.bytes += group.size;
+        }
+        g++;
+    }
+    tree.paths << dir.filePath(QStringLiteral("mixed"));
+    return true;
+}
+
+static void countFiles(const QString &root, qint64 &files, qint64 &bytes) {
+    files = 0;
+    bytes = 0;
+    QDirIterator it(root, QDir::Files | QDir::Hidden | QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        it.next();
+        files++;
+        bytes += it.fileInfo().size();
+    }
+}
+
+// Does with a progress signal what the user interface does, so that the cost
+// of frequent updates shows in the CPU time
+static void showProgress(qint64 total, qint64 partial, qint64 &updates) {
+    static QString shown;
+    QString stats = QString::number(partial * 1.0 / 1048576, 'f', 1) + " MB of " + QString::number(total * 1.0 / 1048576, 'f', 1) + " MB";
+    int percent = static_cast<int>(total > 0 ? partial * 100 / total : 0);
+    shown = stats + QStringLiteral(" (%1%)").arg(percent);
+    updates++;
+}
+
+// Sends the tree to destDir, returns an error message or an empty string.
+// updates counts the progress signals of both ends
+static QString transfer(const Tree &tree, const QString &destDir, const TransferOptions &options, qint64 &updates) {
+    QTcpServer server;
+    if (server.listen(QHostAddress::LocalHost) == false) {
+        return server.errorString();
+    }
+    QThread receiverThread;
+    QThread senderThread;
+    receiverThread.start();
+    senderThread.start();
+
+    QEventLoop loop;
+    QString error;
+    bool senderDone = false;
+    bool receiverDone = false;
+    Receiver *receiver = nullptr;
+    auto fail = [&](const QString &message) {
+        if (error.isEmpty()) {
+            error = message;
+        }
+        loop.quit();
+    };
+    auto done = [&]() {
+        if (senderDone && receiverDone) {
+            loop.quit();
+        }
+    };
+
+    QObject::connect(&server, &QTcpServer::newConnection, &loop, [&]() {
+        while (QTcpSocket *s = server.nextPendingConnection()) {
+            s->setParent(nullptr);
+            if (receiver != nullptr) {
+                // an extra connection of a multi-stream session
+                s->moveToThread(&receiverThread);
+                QMetaObject::invokeMethod(receiver, "addStream", Qt::QueuedConnection, Q_ARG(QTcpSocket*, s));
+                continue;
+            }
+            receiver = new Receiver(s, destDir);
+            receiver->setOptions(options);
+            QObject::connect(receiver, &Receiver::completed, &loop, [&]() {
+                receiverDone = true;
+                done();
+            });
+            QObject::connect(receiver, &Receiver::aborted, &loop, fail);
+            QObject::connect(receiver, &Receiver::progress, &loop, [&updates](qint64 total, qint64 received, qint64 wire) {
+                Q_UNUSED(wire)
+                showProgress(total, received, updates);
+            });
+            receiver->moveToThread(&receiverThread);
+            QMetaObject::invokeMethod(receiver, "start", Qt::QueuedConnection);
+        }
+    });
+
+    Sender *sender = new Sender(QStringLiteral("127.0.0.1"), server.serverPort());
+    sender->setOptions(options);
+    // the receiver is ours, no need to wait for it to announce its features
+    sender->setPeerFeatures(options.receiveFeatures);
+    QObject::connect(sender, &Sender::completed, &loop, [&]() {
+        senderDone = true;
+        done();
+    });
+    QObject::connect(sender, &Sender::aborted, &loop, fail);
+    QObject::connect(sender, &Sender::progress, &loop, [&updates](qint64 total, qint64 sent, qint64 wire) {
+        Q_UNUSED(wire)
+        showProgress(total, sent, updates);
+    });
+    sender->moveToThread(&senderThread);
+    QMetaObject::invokeMethod(sender, "sendFiles", Qt::QueuedConnection, Q_ARG(QStringList, tree.paths));
+
+    loop.exec();
+
+    // deferred deletions are done when the threads finish
+    sender->deleteLater();
+    if (receiver != nullptr) {
+        receiver->deleteLater();
+    }
+    senderThread.quit();
+    receiverThread.quit();
+    senderThread.wait();
+    receiverThread.wait();
+    return error;
+}
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName(QStringLiteral("transferbench"));
+    qRegisterMetaType<QTcpSocket*>();
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Measures the transfer engine over the loopback interface."));
+    parser.addHelpOption();
+    QCommandLineOption scenarioOption(QStringLiteral("scenario"), QStringLiteral("huge, tiny, headers, mixed or all (default)."), QStringLiteral("name"), QStringLiteral("all"));
+    QCommandLineOption hugeOption(QStringLiteral("huge-mib"), QStringLiteral("Size of the huge file in MiB (default 1024)."), QStringLiteral("size"), QStringLiteral("1024"));
+    QCommandLineOption tinyOption(QStringLiteral("tiny-count"), QStringLiteral("Number of tiny files, and of the 16 byte files of headers (default 100000)."), QStringLiteral("count"), QStringLiteral("100000"));
+    QCommandLineOption streamsOption(QStringLiteral("streams"), QStringLiteral("Connections for large files, more than 1 enables multi-stream mode."), QStringLiteral("count"), QStringLiteral("1"));
+    QCommandLineOption compressionOption(QStringLiteral("compression"), QStringLiteral("Offer compression."));
+    QCommandLineOption checksumOption(QStringLiteral("checksum"), QStringLiteral("Offer end-to-end checksums."));
+    QCommandLineOption noSendfileOption(QStringLiteral("no-sendfile"), QStringLiteral("Send file data through the socket buffer instead of sendfile()."));
+    QCommandLineOption progressOption(QStringLiteral("progress-rate"), QStringLiteral("Progress signals per second and end, 0 for one per change (default 10)."), QStringLiteral("count"), QStringLiteral("10"));
+    QCommandLineOption dirOption(QStringLiteral("dir"), QStringLiteral("Where the trees are created, the disk matters."), QStringLiteral("path"), QDir::tempPath());
+    parser.addOption(scenarioOption);
+    parser.addOption(hugeOption);
+    parser.addOption(tinyOption);
+    parser.addOption(streamsOption);
+    parser.addOption(compressionOption);
+    parser.addOption(checksumOption);
+    parser.addOption(noSendfileOption);
+    parser.addOption(progressOption);
+    parser.addOption(dirOption);
+    parser.process(app);
+
+    QTextStream out(stdout);
+    QTextStream err(stderr);
+
+    TransferOptions options;
+    options.streams = std::max(1, parser.value(streamsOption).toInt());
+    if (options.streams > 1) {
+        options.sendFeatures |= TransferOptions::FEATURE_MULTI_STREAM;
+    }
+    if (parser.isSet(compressionOption)) {
+        options.sendFeatures |= TransferOptions::FEATURE_COMPRESSION;
+    }
+    if (parser.isSet(checksumOption)) {
+        options.sendFeatures |= TransferOptions::FEATURE_CHECKSUM;
+    }
+    options.sendFeatures |= TransferOptions::FEATURE_STREAMED_LIST;
+    options.zeroCopy = (parser.isSet(noSendfileOption) == false);
+    options.progressRate = std::max(0, parser.value(progressOption).toInt());
+
+    QString scenario = parser.value(scenarioOption);
+    QStringList scenarios;
+    if (scenario == QStringLiteral("all")) {
+        scenarios << QStringLiteral("huge") << QStringLiteral("tiny") << QStringLiteral("headers") << QStringLiteral("mixed");
+    } else if (scenario == QStringLiteral("huge") || scenario == QStringLiteral("tiny") || scenario == QStringLiteral("headers")
+               || scenario == QStringLiteral("mixed")) {
+        scenarios << scenario;
+    } else {
+        err << "Unknown scenario " << scenario << "\n";
+        return 2;
+    }
+
+    out << QStringLiteral("%1 %2 %3 %4 %5 %6 %7 %8 %9\n")
+           .arg(QStringLiteral("scenario"), -10).arg(QStringLiteral("files"), 8).arg(QStringLiteral("MiB"), 9)
+           .arg(QStringLiteral("seconds"), 8).arg(QStringLiteral("MB/s"), 8).arg(QStringLiteral("files/s"), 9)
+           .arg(QStringLiteral("cpu_s"), 8).arg(QStringLiteral("rss_MiB"), 8).arg(QStringLiteral("updates"), 9);
+    out.flush();
+
+    int result = 0;
+    for (const QString &name : scenarios) {
+        QTemporaryDir work(QDir(parser.value(dirOption)).filePath(QStringLiteral("transferbench-XXXXXX")));
+        if (work.isValid() == false) {
+            err << "Can not create a directory in " << parser.value(dirOption) << "\n";
+            return 2;
+        }
+        QDir workDir(work.path());
+        workDir.mkpath(QStringLiteral("source"));
+        workDir.mkpath(QStringLiteral("dest"));
+        QString source = workDir.filePath(QStringLiteral("source"));
+        QString dest = workDir.filePath(QStringLiteral("dest"));
+
+        Tree tree;
+        bool created;
+        if (name == QStringLiteral("huge")) {
+            created = makeHugeTree(source, parser.value(hugeOption).toLongLong() * 1024 * 1024, tree);
+        } else if (name == QStringLiteral("tiny")) {
+            created = makeTinyTree(source, name, parser.value(tinyOption).toInt(), 1024, tree);
+        } else if (name == QStringLiteral("headers")) {
+            created = makeTinyTree(source, name, parser.value(tinyOption).toInt(), 16, tree);
+        } else {
+            created = makeMixedTree(source, tree);
+        }
+        if (created == false) {
+            err << "Can not create the " << name << " tree in " << source << "\n";
+            return 2;
+        }
+
+        resetPeakRss();
+        Usage before = currentUsage();
+        QElapsedTimer timer;
+        timer.start();
+        qint64 updates = 0;
+        QString error = transfer(tree, dest, options, updates);
+        double seconds = std::max<qint64>(timer.nsecsElapsed(), 1) / 1e9;
+        Usage after = currentUsage();
+
+        if (error.isEmpty() == false) {
+            err << name << ": " << error << "\n";
+            result = 1;
+            continue;
+        }
+        qint64 files, bytes;
+        countFiles(dest, files, bytes);
+        if (files != tree.files || bytes != tree.bytes) {
+            err << name << ": received " << files << " files of " << bytes << " bytes, expected "
+                << tree.files << " files of " << tree.bytes << " bytes\n";
+            result = 1;
+        }
+
+        out << QStringLiteral("%1 %2 %3 %4 %5 %6 %7 %8 %9\n")
+               .arg(name, -10).arg(tree.files, 8).arg(tree.bytes / 1048576.0, 9, 'f', 1)
+               .arg(seconds, 8, 'f', 2).arg(tree.bytes / 1e6 / seconds, 8, 'f', 1).arg(tree.files / seconds, 9, 'f', 0)
+               .arg(before.cpu < 0 ? QStringLiteral("n/a") : QString::number(after.cpu - before.cpu, 'f', 2), 8)
+               .arg(after.peakRss < 0 ? QStringLiteral("n/a") : QString::number(after.peakRss / 1048576.0, 'f', 1), 8)
+               .arg(updates, 9);
+        out.flush();
+    }
+    return result;
+}
@@ -0,0 +1,75 @@
+# Loopback benchmark of the transfer engine, see tools/transferbench.cpp.
+# Built from dukto.pro with "make transferbench", "make transferbench-check"
+# runs the same short smoke runs as ctest does with CMake
+QT += core network
+QT -= gui
+
+greaterThan(QT_MAJOR_VERSION, 5) {
+    CONFIG += c++17
+} else {
+    CONFIG += c++11
+}
+CONFIG += console
+CONFIG -= app_bundle
+
+TARGET = transferbench
+TEMPLATE = app
+
+# kept apart from the objects of the application
+OBJECTS_DIR = transferbench-obj
+MOC_DIR = transferbench-obj
+
+INCLUDEPATH += $$PWD/..
+
+SOURCES += transferbench.cpp \
+    ../network/checksum.cpp \
+    ../network/compression.cpp \
+    ../network/delta.cpp \
+    ../network/diskwriter.cpp \
+    ../network/filedata.cpp \
+    ../network/filehasher.cpp \
+    ../network/filescanner.cpp \
+    ../network/flowwindow.cpp \
+    ../network/progressthrottle.cpp \
+    ../network/rangereceiver.cpp \
+    ../network/rangesender.cpp \
+    ../network/ratelimiter.cpp \
+    ../network/receiver.cpp \
+    ../network/resumejournal.cpp \
+    ../network/sender.cpp \
+    ../network/sharedsource.cpp \
+    ../network/transferstats.cpp
+
+HEADERS += \
+    ../network/checksum.h \
+    ../network/compression.h \
+    ../network/delta.h \
+    ../network/diskwriter.h \
+    ../network/filedata.h \
+    ../network/filehasher.h \
+    ../network/filescanner.h \
+    ../network/flowwindow.h \
+    ../network/progressthrottle.h \
+    ../network/rangereceiver.h \
+    ../network/rangesender.h \
+    ../network/ratelimiter.h \
+    ../network/receiver.h \
+    ../network/resumejournal.h \
+    ../network/sender.h \
+    ../network/sharedsource.h \
+    ../network/transferoptions.h \
+    ../network/transferstats.h
+
+# compressed frames are LZ4 blocks, without the library compression is
+# not offered, see network/compression.cpp
+unix:!android:packagesExist(liblz4) {
+    CONFIG += link_pkgconfig
+    PKGCONFIG += liblz4
+    DEFINES += USE_LZ4
+}
+
+check.commands = ./transferbench --scenario tiny --tiny-count 500 --dir $$OUT_PWD && \
+                 ./transferbench --scenario huge --huge-mib 16 --dir $$OUT_PWD && \
+                 ./transferbench --scenario tiny --tiny-count 500 --streams 4 --compression --checksum --dir $$OUT_PWD
+check.depends = $(TARGET)
+QMAKE_EXTRA_TARGETS += check
@@ -0,0 +1,195 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2021 Xu Zhen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "transfermetrics.h"
+
+#include <QTextStream>
+
+#include "duktoprotocol.h"
+#include "peer.h"
+
+// upper bounds of the buckets of the phase times, in seconds
+static const double bounds[] = { 0.005, 0.025, 0.1, 0.25, 1, 2.5, 10, 30, 120, 600 };
+static const int BUCKETS = sizeof(bounds) / sizeof(bounds[0]);
+
+static const char *directionNames[] = { "send", "receive" };
+
+TransferMetrics::TransferMetrics(DuktoProtocol *protocol, QObject *parent) : QObject(parent)
+{
+    for (Histogram &histogram : phases) {
+        histogram.counts.fill(0, BUCKETS);
+    }
+    connect(protocol, &DuktoProtocol::sendStarted, this, [this](qint64 session) {
+        sessionStarted(session, SEND);
+    });
+    connect(protocol, &DuktoProtocol::receiveQueued, this, [this](qint64 session) {
+        sessionStarted(session, RECEIVE);
+    });
+    connect(protocol, &DuktoProtocol::receiveStarted, this, [this](qint64 session) {
+        sessionStarted(session, RECEIVE);
+    });
+    connect(protocol, &DuktoProtocol::sendFileComplete, this, [this](qint64 session) {
+        sessionEnded(session, false);
+    });
+    connect(protocol, &DuktoProtocol::sendFileError, this, [this](qint64 session) {
+        sessionEnded(session, true);
+    });
+    connect(protocol, &DuktoProtocol::sendFileAborted, this, [this](qint64 session) {
+        sessionEnded(session, false);
+    });
+    connect(protocol, &DuktoProtocol::receiveCompleted, this, [this](qint64 session) {
+        sessionEnded(session, false);
+    });
+    connect(protocol, &DuktoProtocol::receiveAborted, this, [this](qint64 session, const QString &error) {
+        // no error when aborted by the user
+        sessionEnded(session, error.isEmpty() == false);
+    });
+    connect(protocol, &DuktoProtocol::transferStatusUpdate, this, [this](qint64 session, qint64 total, qint64 partial, qint64 wire) {
+        Q_UNUSED(total)
+        statusUpdated(session, partial, wire);
+    });
+    connect(protocol, &DuktoProtocol::transferStatsUpdate, this, &TransferMetrics::statsUpdated);
+    connect(protocol, &DuktoProtocol::peerListAdded, this, [this](const Peer &peer) {
+        peers.insert(peer.address.toString() + QChar(':') + QString::number(peer.port));
+    });
+    connect(protocol, &DuktoProtocol::peerListRemoved, this, [this](const Peer &peer) {
+        peers.remove(peer.address.toString() + QChar(':') + QString::number(peer.port));
+    });
+}
+
+void TransferMetrics::sessionStarted(qint64 session, DIRECTION direction) {
+    if (sessions.contains(session)) {
+        // a queued receive session which starts now
+        return;
+    }
+    Session s;
+    s.direction = direction;
+    sessions.insert(session, s);
+    started[direction]++;
+}
+
+void TransferMetrics::sessionEnded(qint64 session, bool failed) {
+    auto it = sessions.find(session);
+    if (it == sessions.end()) {
+        // a send job removed from the queue before it started
+        return;
+    }
+    // what the session has moved stays in the totals, so that they never go down
+    bytes[it->direction] += it->bytes;
+    wire[it->direction] += it->wire;
+    if (failed) {
+        failures[it->direction]++;
+    }
+    sessions.erase(it);
+}
+
+void TransferMetrics::statusUpdated(qint64 session, qint64 partial, qint64 wire) {
+    auto it = sessions.find(session);
+    if (it != sessions.end()) {
+        it->bytes = partial;
+        it->wire = wire;
+    }
+}
+
+void TransferMetrics::statsUpdated(qint64 session, const TransferStats &stats) {
+    auto it = sessions.find(session);
+    if (it == sessions.end() || it->timed) {
+        return;
+    }
+    it->rate = stats.rate();
+    if (stats.finished() == false) {
+        return;
+    }
+    // the last timings of the session
+    it->timed = true;
+    it->rate = 0;
+    stalls[it->direction] += stats.stalls();
+    for (int i = 0; i < TransferStats::PHASE_COUNT; i++) {
+        TransferStats::PHASE phase = static_cast<TransferStats::PHASE>(i);
+        if (stats.phaseCount(phase) == 0) {
+            continue;
+        }
+        double seconds = stats.phaseTime(phase) / 1000.0;
+        Histogram &histogram = phases[i];
+        for (int b = 0; b < BUCKETS; b++) {
+            if (seconds <= bounds[b]) {
+                histogram.counts[b]++;
+            }
+        }
+        histogram.count++;
+        histogram.sum += seconds;
+    }
+}
+
+QByteArray TransferMetrics::render() const {
+    qint64 liveBytes[DIRECTION_COUNT] = {};
+    qint64 liveWire[DIRECTION_COUNT] = {};
+    qint64 active[DIRECTION_COUNT] = {};
+    double rate[DIRECTION_COUNT] = {};
+    for (const Session &s : sessions) {
+        liveBytes[s.direction] += s.bytes;
+        liveWire[s.direction] += s.wire;
+        active[s.direction]++;
+        rate[s.direction] += s.rate;
+    }
+
+    QByteArray out;
+    QTextStream os(&out);
+    auto family = [&os](const char *name, const char *type, const char *help) {
+        os << "# HELP " << name << ' ' << help << '\n';
+        os << "# TYPE " << name << ' ' << type << '\n';
+    };
+    auto perDirection = [&os](const char *name, const qint64 *ended, const qint64 *live) {
+        for (int d = 0; d < DIRECTION_COUNT; d++) {
+            os << name << "{direction=\"" << directionNames[d] << "\"} " << ended[d] + (live != nullptr ? live[d] : 0) << '\n';
+        }
+    };
+
+    family("dukto_transferred_bytes_total", "counter", "Bytes of the transferred elements, including skipped and compressed ones in full.");
+    perDirection("dukto_transferred_bytes_total", bytes, liveBytes);
+    family("dukto_wire_bytes_total", "counter", "Bytes of element data which actually crossed the network.");
+    perDirection("dukto_wire_bytes_total", wire, liveWire);
+    family("dukto_sessions_total", "counter", "Sessions started.");
+    perDirection("dukto_sessions_total", started, nullptr);
+    family("dukto_session_failures_total", "counter", "Sessions ended by an error.");
+    perDirection("dukto_session_failures_total", failures, nullptr);
+    family("dukto_stalls_total", "counter", "Times the data of an ended session could not go on for a second or more.");
+    perDirection("dukto_stalls_total", stalls, nullptr);
+    family("dukto_sessions_active", "gauge", "Sessions running or queued.");
+    perDirection("dukto_sessions_active", active, nullptr);
+    family("dukto_throughput_bytes_per_second", "gauge", "Rate of the running sessions over the last seconds.");
+    for (int d = 0; d < DIRECTION_COUNT; d++) {
+        os << "dukto_throughput_bytes_per_second{direction=\"" << directionNames[d] << "\"} " << QString::number(rate[d], 'f', 0) << '\n';
+    }
+    family("dukto_peers", "gauge", "Buddies found on the network.");
+    os << "dukto_peers " << peers.size() << '\n';
+
+    family("dukto_phase_duration_seconds", "histogram", "Time ended sessions have spent in each phase.");
+    for (int i = 0; i < TransferStats::PHASE_COUNT; i++) {
+        const char *phase = TransferStats::phaseName(static_cast<TransferStats::PHASE>(i));
+        const Histogram &histogram = phases[i];
+        for (int b = 0; b < BUCKETS; b++) {
+            os << "dukto_phase_duration_seconds_bucket{phase=\"" << phase << "\",le=\"" << bounds[b] << "\"} " << histogram.counts.at(b) << '\n';
+        }
+        os << "dukto_phase_duration_seconds_bucket{phase=\"" << phase << "\",le=\"+Inf\"} " << histogram.count << '\n';
+        os << "dukto_phase_duration_seconds_sum{phase=\"" << phase << "\"} " << histogram.sum << '\n';
+        os << "dukto_phase_duration_seconds_count{phase=\"" << phase << "\"} " << histogram.count << '\n';
+    }
+    os.flush();
+    return out;
+}
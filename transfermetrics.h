@@ -0,0 +1,80 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2021 Xu Zhen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef TRANSFERMETRICS_H
+#define TRANSFERMETRICS_H
+
+#include <QObject>
+#include <QHash>
+#include <QSet>
+#include <QVector>
+
+#include "network/transferstats.h"
+
+class DuktoProtocol;
+class Peer;
+
+// Totals of all sessions since the start, in the Prometheus text format,
+// for monitoring to scrape from MiniWebServer's /metrics
+class TransferMetrics : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit TransferMetrics(DuktoProtocol *protocol, QObject *parent = nullptr);
+
+    QByteArray render() const;
+
+private:
+    enum DIRECTION {
+        SEND,
+        RECEIVE,
+        DIRECTION_COUNT
+    };
+    void sessionStarted(qint64 session, DIRECTION direction);
+    void sessionEnded(qint64 session, bool failed);
+    void statusUpdated(qint64 session, qint64 partial, qint64 wire);
+    void statsUpdated(qint64 session, const TransferStats &stats);
+
+    struct Session {
+        DIRECTION direction = SEND;
+        qint64 bytes = 0;
+        qint64 wire = 0;
+        double rate = 0;
+        bool timed = false;
+    };
+    QHash<qint64, Session> sessions;
+    QSet<QString> peers;
+
+    // of the sessions which have ended
+    qint64 bytes[DIRECTION_COUNT] = {};
+    qint64 wire[DIRECTION_COUNT] = {};
+    qint64 started[DIRECTION_COUNT] = {};
+    qint64 failures[DIRECTION_COUNT] = {};
+    qint64 stalls[DIRECTION_COUNT] = {};
+
+    // time of every phase of the sessions which have ended, in seconds
+    struct Histogram {
+        QVector<qint64> counts;
+        qint64 count = 0;
+        double sum = 0;
+    };
+    Histogram phases[TransferStats::PHASE_COUNT];
+};
+
+#endif // TRANSFERMETRICS_H